@@ -25,6 +25,242 @@
 #include "ace/SOCK_Stream.h"
 #include "ace/SOCK_Acceptor.h"
 #include "ace/Log_Msg.h"
+#include "ace/Select_Reactor.h"
+#include "ace/Dev_Poll_Reactor.h"
+#include "ace/Thread_Manager.h"
+#include "ace/Get_Opt.h"
+#include "ace/OS_NS_unistd.h"
+#include "ace/ACE.h"
+#include "ace/OS_NS_string.h"
+#include "ace/OS_NS_errno.h"
+#include "ace/Message_Block.h"
+#include "ace/Numeric_Limits.h"
+#include "ace/High_Res_Timer.h"
+#include "ace/OS_NS_time.h"
+#include "ace/SString.h"
+#include "ace/Hash_Map_Manager_T.h"
+#include "ace/Functor_String.h"
+#include "ace/Null_Mutex.h"
+#include "ace/OS_NS_ctype.h"
+#include "ace/OS_NS_stdlib.h"
+#include "ace/OS_NS_stdio.h"
+#include "ace/OS_NS_fcntl.h"
+#include "ace/OS_NS_sys_stat.h"
+#include "ace/OS_NS_sys_mman.h"
+#include "ace/OS_NS_sys_sendfile.h"
+#include "ace/os_include/os_limits.h"
+#include "ace/os_include/sys/os_uio.h"
+
+// Shared with the Concurrent Webserver (Asgn4-ConcurrentWebserverACE/g++)
+#include "HTTP_Parser.h"
+#include "Handler_Pool.h"
+#include "Timeout_Wheel.h"
+#include "Uring.h"
+
+/**
+* @class Line_Buffer
+* @brief Per-connection ring buffer that frames the input into lines
+*
+* Received bytes are appended at the tail and complete lines are taken from
+* the head, so lines split across reads and several lines in one read are
+* handled alike. A line ends with "\n", "\r" or "\r\n". Delimiters are located
+* with memchr() over whole contiguous spans, and each byte is scanned once:
+* a partial line is not scanned again when more of it arrives. A buffer that
+* fills up without a delimiter is released as it is, so a client cannot make
+* the server hold more than SIZE bytes.
+*
+* Positions are free-running counters, reduced modulo SIZE on access.
+*/
+class Line_Buffer
+{
+public:
+	enum
+	{
+		/// Capacity in bytes; must be a power of two.
+		SIZE = 16 * 1024
+	};
+
+	Line_Buffer()
+		: head_(0), tail_(0), framed_(0), scanned_(0)
+	{
+	}
+
+	/// Describes the free space as one or two iovecs, for recvv().
+	/// Returns the number of iovecs, 0 if the buffer is full.
+	int space(iovec iov[2])
+	{
+		return this->segments(iov, tail_, SIZE - (tail_ - head_));
+	}
+
+	/// Accounts for n bytes received into the space().
+	void produced(size_t n)
+	{
+		tail_ += n;
+	}
+
+	/// Returns the number of bytes at the head that make up complete lines.
+	size_t complete_lines(void)
+	{
+		for (size_t eol; (eol = this->find_eol(scanned_)) != tail_;)
+		{
+			size_t end = eol + 1;
+			if (data_[eol & MASK] == '\r'
+				&& end != tail_
+				&& data_[end & MASK] == '\n')
+				++end;
+			framed_ = scanned_ = end;
+		}
+		scanned_ = tail_;
+
+		// A full buffer without a delimiter is handed out as one line
+		if (framed_ == head_ && tail_ - head_ == SIZE)
+			framed_ = tail_;
+
+		return framed_ - head_;
+	}
+
+	/// Describes the first n bytes as one or two iovecs, for sendv_n().
+	int peek(iovec iov[2], size_t n)
+	{
+		return this->segments(iov, head_, n);
+	}
+
+	/// Drops n bytes from the head.
+	void consumed(size_t n)
+	{
+		head_ += n;
+	}
+
+	/// Empties the buffer.
+	void clear(void)
+	{
+		head_ = tail_ = framed_ = scanned_ = 0;
+	}
+
+	/// Number of bytes held: the current partial line.
+	size_t size(void) const
+	{
+		return tail_ - head_;
+	}
+
+private:
+	enum { MASK = SIZE - 1 };
+
+	/// Splits [pos, pos + n) where it wraps around.
+	int segments(iovec iov[2], size_t pos, size_t n)
+	{
+		if (n == 0)
+			return 0;
+
+		size_t offset = pos & MASK;
+		size_t first = SIZE - offset < n ? SIZE - offset : n;
+		iov[0].iov_base = data_ + offset;
+		iov[0].iov_len = first;
+		if (first == n)
+			return 1;
+
+		iov[1].iov_base = data_;
+		iov[1].iov_len = n - first;
+		return 2;
+	}
+
+	/// Returns the position of the first '\r' or '\n' at or after pos,
+	/// or tail_ if there is none.
+	size_t find_eol(size_t pos) const
+	{
+		while (pos != tail_)
+		{
+			size_t offset = pos & MASK;
+			size_t n = tail_ - pos < SIZE - offset ? tail_ - pos : SIZE - offset;
+			const char *span = data_ + offset;
+
+			// The '\r' search stops at the first '\n', so a byte is
+			// looked at by at most two memchr() calls
+			const char *lf = static_cast<const char *> (ACE_OS::memchr(span, '\n', n));
+			const char *cr = static_cast<const char *> (
+				ACE_OS::memchr(span, '\r', lf != 0 ? lf - span : n));
+			const char *eol = cr != 0 ? cr : lf;
+			if (eol != 0)
+				return pos + (eol - span);
+
+			pos += n;
+		}
+		return tail_;
+	}
+
+	/// Next byte to send, next byte to receive.
+	size_t head_;
+	size_t tail_;
+
+	/// End of the last complete line found.
+	size_t framed_;
+
+	/// Everything before this position has been searched for delimiters.
+	size_t scanned_;
+
+	char data_[SIZE];
+};
+
+
+/// The connection timeouts of one event loop, which needs no locking.
+typedef Timeout_Wheel<ACE_Null_Mutex> Echo_Timeout_Wheel;
+
+/**
+* @struct Connection_Timeouts
+* @brief How long a connection of an event loop may stay silent
+*
+* A connection is closed once it has read nothing for idle, or once read
+* has passed since the first byte of a line (or request) that is still
+* incomplete, however slowly the rest trickles in.
+*/
+struct Connection_Timeouts
+{
+	/// The event loop's wheel, 0 if the timeouts are disabled.
+	Echo_Timeout_Wheel *wheel;
+
+	ACE_Time_Value idle;
+
+	/// 0 leaves incomplete input to the idle timeout.
+	ACE_Time_Value read;
+
+	/// Re-arms timer for handler after a read, partial when it left
+	/// incomplete input behind. reading is set while the timer runs for
+	/// the read timeout.
+	void touch(Echo_Timeout_Wheel::Timer *timer, ACE_Event_Handler *handler,
+		bool partial, bool &reading) const
+	{
+		if (wheel == 0)
+			return;
+		partial = partial && read != ACE_Time_Value::zero;
+		if (partial && reading)
+			return;
+		reading = partial;
+		wheel->schedule(timer, handler, partial ? read : idle);
+	}
+};
+
+
+#if defined (ECHO_HAS_IO_URING)
+/// Kinds of operations on an event loop's ring, the tags of their user_data.
+enum Uring_Operation
+{
+	URING_ACCEPT,
+	URING_RECV,
+	URING_SEND,
+	URING_TICK,
+	URING_CANCEL
+};
+#else
+class Uring;
+#endif /* ECHO_HAS_IO_URING */
+
+class Echo_Svc_Handler;
+class HTTP_Svc_Handler;
+
+/// Closed handlers of one event loop, kept for its next connections.
+typedef Handler_Pool<Echo_Svc_Handler, ACE_Null_Mutex> Echo_Handler_Pool;
+typedef Handler_Pool<HTTP_Svc_Handler, ACE_Null_Mutex> HTTP_Handler_Pool;
+
 
 /**
 * @class Echo_Svc_Handler
@@ -35,11 +271,122 @@
 * either (a) a "chunk" at a time or (b) a "line" at a time (i.e., until
 * the symbols "\n", "\r", or "\r\n" are read), rather than a character at a time
 * [ACE_Svc_Handler, ACE_SOCK_Stream, etc.].
+*
+* Replies are sent without blocking. What the socket does not take at once
+* waits in the handler's message queue and is flushed by handle_output()
+* when the reactor reports the socket writable, so a client that does not
+* read its replies never stalls the event loop. While more than
+* OUTPUT_HIGH_WATER bytes wait for such a client the handler stops reading
+* from it, until the backlog falls to OUTPUT_LOW_WATER. A client that
+* closes its side of the connection still gets the replies queued for it:
+* the handler stops reading, and handle_output() closes the connection once
+* they are out.
+*
+* A handler taken from a Handler_Pool goes back to it, reset, when its
+* connection closes. Every read re-arms its timer on the Timeout_Wheel (see
+* Connection_Timeouts).
+*
+* Under -r uring a Uring_Loop runs the connection instead of a reactor,
+* through the uring_ methods: the same lines are echoed, but the loop
+* receives them into its provided buffers and the replies go out as linked
+* sends, one chain in flight at a time.
 */
 class Echo_Svc_Handler : public ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >
 {
 
 public:
+	enum
+	{
+		/// Queued output above which reading from the client is suspended.
+		OUTPUT_HIGH_WATER = 64 * 1024,
+
+		/// Queued output at which reading resumes.
+		OUTPUT_LOW_WATER = 16 * 1024,
+
+		/// -r uring: most sends linked in one chain.
+		URING_CHAIN = 16
+	};
+
+	Echo_Svc_Handler()
+		: drain_(false), input_suspended_(false), input_over_(false),
+		handler_pool_(0), accept_time_(0),
+		timeouts_(0), reading_(false), uring_(0), uring_receiving_(false),
+		uring_armed_(false), uring_failed_(false), uring_sending_(0),
+		uring_sending_tail_(0), uring_in_flight_(0), uring_prev_(0), uring_next_(0)
+	{
+	}
+
+	/// Pool the handler returns to when closed; 0 to delete it instead.
+	void handler_pool(Echo_Handler_Pool *hp)
+	{
+		handler_pool_ = hp;
+	}
+
+	/// When the acceptor started on the connection.
+	void accept_time(ACE_hrtime_t time)
+	{
+		accept_time_ = time;
+	}
+
+	void timeouts(const Connection_Timeouts *ct)
+	{
+		timeouts_ = ct;
+	}
+
+	/// Called by the Timeout_Wheel: closes the connection. Under -r uring
+	/// it shuts the socket down instead, which ends the receive, after which
+	/// the Uring_Loop closes the connection.
+	virtual int handle_timeout(const ACE_Time_Value &, const void *)
+	{
+		ACE_DEBUG((LM_DEBUG,
+			"(%P|%t) connection timed out\n"));
+		if (uring_ != 0)
+		{
+			ACE_OS::shutdown(this->get_handle(), ACE_SHUTDOWN_BOTH);
+			return 0;
+		}
+		return -1;
+	}
+
+	/// Shuts the connection down and returns the handler to its pool, or
+	/// deletes it if it has none.
+	virtual void destroy(void)
+	{
+		if (handler_pool_ == 0)
+		{
+			ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >::destroy();
+			return;
+		}
+
+		// What the destructor of ACE_Svc_Handler would do: leave the
+		// reactor and close the socket
+		if (timeouts_->wheel != 0)
+			timeouts_->wheel->cancel(&timer_);
+		this->shutdown();
+
+		this->msg_queue()->flush();
+		this->reactor(0);
+		drain_ = false;
+		input_.clear();
+		input_suspended_ = false;
+		input_over_ = false;
+		accept_time_ = 0;
+		timeouts_ = 0;
+		reading_ = false;
+		while (uring_sending_ != 0)
+		{
+			ACE_Message_Block *mb = uring_sending_;
+			uring_sending_ = mb->next();
+			mb->release();
+		}
+		uring_ = 0;
+		uring_receiving_ = false;
+		uring_armed_ = false;
+		uring_failed_ = false;
+		uring_sending_tail_ = 0;
+		uring_in_flight_ = 0;
+		handler_pool_->put(this);
+	}
 
 	/// When a client connection request arrives, the ACE_Reactor will automatically call
 	/// the handle_input() method of the ACE_Acceptor. This template method automatically
@@ -51,87 +398,1955 @@ public:
 		ACE_DEBUG((LM_DEBUG,
 			"(%P|%t) client connection request\n"));
 
+		// The acceptor has already made the connection non-blocking if asked
+		// to (epoll); replies need it to be non-blocking in any case
+		drain_ = ACE_BIT_ENABLED(ACE::get_flags(this->get_handle()), ACE_NONBLOCK);
+		if (!drain_ && this->peer().enable(ACE_NONBLOCK) == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) %p\n",
+			"enable"),
+			-1);
+
+		// The output backlog is bounded by suspending input, so the queue
+		// itself must never refuse a reply
+		this->msg_queue()->high_water_mark(ACE_Numeric_Limits<size_t>::max());
+
 		if (reactor()->register_handler(this,
 			ACE_Event_Handler::READ_MASK) == -1)
 			ACE_ERROR_RETURN((LM_ERROR,
 			"(%P|%t) can't register with reactor\n"),
 			-1);
+		timeouts_->touch(&timer_, this, false, reading_);
+		return 0;
+	}
+
+#if defined (ECHO_HAS_IO_URING)
+	// = Completion-based I/O (-r uring), for the Uring_Loop.
+
+	/// Sets an accepted connection up on the event loop's ring, with no
+	/// reactor, and arms its receive. Returns -1 on failure.
+	int uring_open(Uring *ring)
+	{
+		ACE_DEBUG((LM_DEBUG,
+			"(%P|%t) client connection request\n"));
+
+		uring_ = ring;
+		uring_receiving_ = true;
+		this->reactor(0);
+		this->msg_queue()->high_water_mark(ACE_Numeric_Limits<size_t>::max());
+		timeouts_->touch(&timer_, this, false, reading_);
+		return this->uring_receive();
+	}
+
+	/// Echoes the complete lines among the length bytes the receive placed
+	/// in buf, like handle_input(), and cancels the receive once the output
+	/// backlog is too large. Returns -1 on failure.
+	int uring_input(const char *buf, size_t length)
+	{
+		if (accept_time_ != 0)
+		{
+			handler_pool_->first_byte(ACE_OS::gethrtime() - accept_time_);
+			accept_time_ = 0;
+		}
+
+		iovec iov[2];
+		while (length > 0)
+		{
+			// Never full here: a full buffer is always sent out as a line
+			int iovcnt = input_.space(iov);
+			size_t n = 0;
+			for (int i = 0; i < iovcnt && n < length; ++i)
+			{
+				size_t chunk = length - n < iov[i].iov_len ? length - n : iov[i].iov_len;
+				ACE_OS::memcpy(iov[i].iov_base, buf + n, chunk);
+				n += chunk;
+			}
+			input_.produced(n);
+			buf += n;
+			length -= n;
+
+			size_t lines = input_.complete_lines();
+			timeouts_->touch(&timer_, this, input_.size() > lines, reading_);
+			if (lines == 0)
+				continue;
+
+			// Copied out, as the sends complete after the space is reused
+			ACE_Message_Block *mb = 0;
+			ACE_NEW_RETURN(mb, ACE_Message_Block(lines), -1);
+			iovcnt = input_.peek(iov, lines);
+			for (int i = 0; i < iovcnt; ++i)
+				mb->copy(static_cast<const char *> (iov[i].iov_base), iov[i].iov_len);
+			input_.consumed(lines);
+			if (this->putq(mb) == -1)
+			{
+				mb->release();
+				return -1;
+			}
+		}
+		this->uring_flush();
+
+		// Stops receiving from a client that does not read its replies;
+		// uring_flush() resumes once the backlog has drained
+		if (!input_suspended_
+			&& this->msg_queue()->message_bytes() >= OUTPUT_HIGH_WATER)
+		{
+			io_uring_sqe *sqe = uring_->sqe();
+			if (sqe == 0)
+				return -1;
+			Uring::prep(sqe, IORING_OP_ASYNC_CANCEL, -1, 0, 0,
+				Uring::tag(0, URING_CANCEL));
+			sqe->addr = Uring::tag(this, URING_RECV);
+			input_suspended_ = true;
+		}
 		return 0;
 	}
 
+	/// The multishot receive ended with res: re-arms it unless the client's
+	/// input is over, or the output backlog holds it back.
+	void uring_rearm(int res)
+	{
+		uring_armed_ = false;
+
+		// Cancelled for the output backlog: uring_flush() re-arms it
+		if (res == -ECANCELED && input_suspended_)
+			return;
+
+		// A multishot receive also ends when the buffers ran out, or when it
+		// was cancelled but the backlog has drained meanwhile
+		if ((res > 0 || res == -ENOBUFS || res == -ECANCELED)
+			&& this->uring_receive() == 0)
+			return;
+
+		ACE_DEBUG((LM_DEBUG,
+			"(%P|%t) closing log daemon (fd = %d)\n",
+			this->get_handle()));
+		uring_receiving_ = false;
+	}
+
+	/// Submits the queued output as a chain of linked sends, unless one is
+	/// still in flight, and resumes the receive once the backlog has
+	/// drained.
+	void uring_flush(void)
+	{
+		if (uring_in_flight_ > 0)
+			return;
+
+		// A client that only closed its side still gets its replies; once
+		// a send failed nothing more is sent
+		if (uring_failed_)
+		{
+			this->msg_queue()->flush();
+			return;
+		}
+
+		if (input_suspended_
+			&& this->msg_queue()->message_bytes() <= OUTPUT_LOW_WATER)
+		{
+			// The receive may not have ended yet, in which case
+			// uring_rearm() re-arms it when it does
+			input_suspended_ = false;
+			if (!uring_armed_ && this->uring_receive() == -1)
+			{
+				input_suspended_ = true;
+				ACE_ERROR((LM_ERROR,
+					"(%P|%t) %p\n",
+					"uring_receive"));
+			}
+		}
+
+		if (this->msg_queue()->is_empty())
+			return;
+
+		// Room for a whole chain, so that it is not cut in two
+		if (uring_->reserve(URING_CHAIN) == -1)
+		{
+			this->uring_fail(errno, "io_uring_enter");
+			this->msg_queue()->flush();
+			return;
+		}
+
+		// MSG_WAITALL: a send completes short only if the connection
+		// failed, which cancels the rest of the chain
+		io_uring_sqe *previous = 0;
+		ACE_Message_Block *mb = 0;
+		while (uring_in_flight_ < URING_CHAIN
+			&& !this->msg_queue()->is_empty()
+			&& this->getq(mb) != -1)
+		{
+			io_uring_sqe *sqe = uring_->sqe();
+			Uring::prep(sqe, IORING_OP_SEND, this->get_handle(), mb->rd_ptr(),
+				static_cast<unsigned> (mb->length()), Uring::tag(this, URING_SEND));
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			if (previous != 0)
+				previous->flags = IOSQE_IO_LINK;
+			previous = sqe;
+
+			if (uring_sending_tail_ != 0)
+				uring_sending_tail_->next(mb);
+			else
+				uring_sending_ = mb;
+			uring_sending_tail_ = mb;
+			++uring_in_flight_;
+		}
+	}
+
+	/// A send of the chain completed with res. Returns the sends still in
+	/// flight.
+	int uring_sent(int res)
+	{
+		ACE_Message_Block *mb = uring_sending_;
+		uring_sending_ = mb->next();
+		if (uring_sending_ == 0)
+			uring_sending_tail_ = 0;
+		mb->next(0);
+		if (res != static_cast<int> (mb->length()))
+			this->uring_fail(res < 0 ? -res : EPIPE, "send");
+		mb->release();
+		return --uring_in_flight_;
+	}
+
+	/// Set once the input is over and all the output is sent: the event
+	/// loop then closes the connection.
+	bool uring_idle(void)
+	{
+		return !uring_receiving_ && uring_in_flight_ == 0
+			&& this->msg_queue()->is_empty();
+	}
+#endif /* ECHO_HAS_IO_URING */
+
 
 protected:
 
 	/// When data arrives from the client the ACE_Reactor will automatically call back on
 	/// the Echo_Svc_Handler::handle_input() method, which you will need to write so that
 	/// it echos the client's input back to the client [ACE_SOCK_Stream].
+	/// The input is echoed back a line at a time; all the complete lines
+	/// received so far go out in one gathered write.
+	/// On a non-blocking connection it keeps reading until recv() would block.
 	virtual int handle_input(ACE_HANDLE)
 	{
-		char buf[ACE_DEFAULT_MAX_SOCKET_BUFSIZ];
-		ssize_t recv_cnt, send_cnt;
+		iovec iov[2];
+		ssize_t recv_cnt;
 
-		switch (recv_cnt = this->peer().recv(buf, sizeof(buf)))
+		do
 		{
-		case -1:
-			ACE_ERROR_RETURN((LM_ERROR,
-				"(%P|%t) %p bad read\n",
-				"client logger"),
-				-1);
-		case 0:
-			ACE_ERROR_RETURN((LM_ERROR,
-				"(%P|%t) closing log daemon (fd = %d)\n",
-				this->get_handle()),
-				-1);
-		default:
-			buf[recv_cnt] = '\0';
-			ACE_DEBUG((LM_DEBUG,
-				"(%P|%t) from client: %s",
-				buf));
+			// Stops reading from a client that does not read its replies;
+			// handle_output() resumes once the backlog has drained
+			if (this->msg_queue()->message_bytes() >= OUTPUT_HIGH_WATER)
+			{
+				input_suspended_ = true;
+				return this->reactor()->cancel_wakeup(this,
+					ACE_Event_Handler::READ_MASK) == -1 ? -1 : 0;
+			}
 
-			send_cnt = this->peer().send(buf, recv_cnt);
-			if (send_cnt < 0)
+			// Never full here: a full buffer is always sent out as a line
+			switch (recv_cnt = this->peer().recvv(iov, input_.space(iov)))
+			{
+			case -1:
+				if (errno == EWOULDBLOCK)
+					return 0;
 				ACE_ERROR_RETURN((LM_ERROR,
-				"%s\n",
-				"send_n failed"),
-				-1);
+					"(%P|%t) %p bad read\n",
+					"client logger"),
+					-1);
+			case 0:
+				// The client only closed its side: the replies still
+				// queued go out before handle_output() closes
+				if (!this->msg_queue()->is_empty())
+				{
+					input_over_ = true;
+					return this->reactor()->cancel_wakeup(this,
+						ACE_Event_Handler::READ_MASK) == -1 ? -1 : 0;
+				}
+				ACE_ERROR_RETURN((LM_ERROR,
+					"(%P|%t) closing log daemon (fd = %d)\n",
+					this->get_handle()),
+					-1);
+			default:
+				if (accept_time_ != 0)
+				{
+					handler_pool_->first_byte(ACE_OS::gethrtime() - accept_time_);
+					accept_time_ = 0;
+				}
+				input_.produced(recv_cnt);
+
+				size_t length = input_.complete_lines();
+				timeouts_->touch(&timer_, this, input_.size() > length, reading_);
+				if (length == 0)
+					break;
+
+				int iovcnt = input_.peek(iov, length);
+				ACE_DEBUG((LM_DEBUG,
+					"(%P|%t) from client: %.*s%.*s",
+					(int) iov[0].iov_len, (char *) iov[0].iov_base,
+					iovcnt > 1 ? (int) iov[1].iov_len : 0,
+					iovcnt > 1 ? (char *) iov[1].iov_base : ""));
+
+				if (this->send_reply(iov, iovcnt, length) == -1)
+					ACE_ERROR_RETURN((LM_ERROR,
+					"(%P|%t) %p\n",
+					"send_reply"),
+					-1);
+				input_.consumed(length);
+			}
+		} while (drain_);
+
+		return 0;
+	}
+
+	/// Called by the reactor when the socket can take more of the queued
+	/// output. Cancels the notification once the queue is empty, or returns
+	/// -1 then if the client's input is over.
+	virtual int handle_output(ACE_HANDLE)
+	{
+		ACE_Message_Block *mb = 0;
+		while (!this->msg_queue()->is_empty())
+		{
+			this->getq(mb);
+			ssize_t send_cnt = this->peer().send(mb->rd_ptr(), mb->length());
+			if (send_cnt == -1 && errno != EWOULDBLOCK)
+			{
+				mb->release();
+				ACE_ERROR_RETURN((LM_ERROR,
+					"(%P|%t) %p\n",
+					"send"),
+					-1);
+			}
+			if (send_cnt > 0)
+				mb->rd_ptr(send_cnt);
+			if (mb->length() > 0)
+			{
+				// The socket is full again
+				this->ungetq(mb);
+				break;
+			}
+			mb->release();
 		}
 
+		size_t pending = this->msg_queue()->message_bytes();
+		if (input_suspended_ && pending <= OUTPUT_LOW_WATER)
+		{
+			input_suspended_ = false;
+			if (this->reactor()->schedule_wakeup(this,
+				ACE_Event_Handler::READ_MASK) == -1)
+				return -1;
+		}
+		if (pending == 0
+			&& (input_over_
+				|| this->reactor()->cancel_wakeup(this,
+					ACE_Event_Handler::WRITE_MASK) == -1))
+			return -1;
+
 		return 0;
 	}
-};
 
+	/// Sends the length bytes described by iov without blocking. Whatever
+	/// the socket does not take is queued behind any earlier output, and
+	/// the reactor is asked to call handle_output(). Returns -1 on error.
+	int send_reply(const iovec iov[], int iovcnt, size_t length)
+	{
+		bool idle = this->msg_queue()->is_empty();
+		size_t sent = 0;
+
+		// Nothing may overtake output that is already queued
+		if (idle)
+		{
+			ssize_t send_cnt = this->peer().sendv(iov, iovcnt);
+			if (send_cnt == -1 && errno != EWOULDBLOCK)
+				return -1;
+			if (send_cnt > 0)
+				sent = send_cnt;
+			if (sent == length)
+				return 0;
+		}
+
+		ACE_Message_Block *mb = 0;
+		ACE_NEW_RETURN(mb, ACE_Message_Block(length - sent), -1);
+		for (int i = 0; i < iovcnt; ++i)
+		{
+			size_t skip = sent < iov[i].iov_len ? sent : iov[i].iov_len;
+			sent -= skip;
+			mb->copy(static_cast<const char *> (iov[i].iov_base) + skip,
+				iov[i].iov_len - skip);
+		}
+
+		if (this->putq(mb) == -1)
+		{
+			mb->release();
+			return -1;
+		}
+
+		if (idle)
+			return this->reactor()->schedule_wakeup(this,
+				ACE_Event_Handler::WRITE_MASK) == -1 ? -1 : 0;
+		return 0;
+	}
+
+private:
+	friend class Uring_Loop;
+
+#if defined (ECHO_HAS_IO_URING)
+	/// Arms the multishot receive. Returns -1 if the ring is full.
+	int uring_receive(void)
+	{
+		io_uring_sqe *sqe = uring_->sqe();
+		if (sqe == 0)
+			return -1;
+
+		// Every completion carries one of the loop's buffers, until the
+		// input is over or the receive is cancelled
+		Uring::prep(sqe, IORING_OP_RECV, this->get_handle(), 0, 0,
+			Uring::tag(this, URING_RECV));
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = uring_->buffer_group();
+		uring_armed_ = true;
+		return 0;
+	}
+
+	/// Stops sending after a failed send, and shuts the connection down so
+	/// that its receive ends as well.
+	void uring_fail(int error, const char *what)
+	{
+		// The sends linked after the failed one complete with ECANCELED
+		if (uring_failed_)
+			return;
+		uring_failed_ = true;
+		errno = error;
+		ACE_ERROR((LM_ERROR,
+			"(%P|%t) %p\n",
+			what));
+		ACE_OS::shutdown(this->get_handle(), ACE_SHUTDOWN_BOTH);
+	}
+#endif /* ECHO_HAS_IO_URING */
+
+	/// Set on non-blocking connections. ACE_Dev_Poll_Reactor reports a
+	/// readable socket once per arrival, so whatever handle_input() left
+	/// unread would wait for the client's next write.
+	bool drain_;
+
+	/// Input not yet echoed: the current partial line.
+	Line_Buffer input_;
+
+	/// Set while READ_MASK is cancelled because of the output backlog.
+	bool input_suspended_;
+
+	/// Set once the client has closed its side while replies were queued:
+	/// READ_MASK is cancelled, and the connection closes when they are out.
+	bool input_over_;
+
+	Echo_Handler_Pool *handler_pool_;
+
+	/// Set by the acceptor of a pooled handler, cleared once the first
+	/// byte is read.
+	ACE_hrtime_t accept_time_;
+
+	const Connection_Timeouts *timeouts_;
+	Echo_Timeout_Wheel::Timer timer_;
+
+	/// Set while the timer runs for the read timeout.
+	bool reading_;
+
+	/// -r uring: the event loop's ring; 0 under a reactor.
+	Uring *uring_;
+
+	/// -r uring: set until the client's input is over, set while a receive
+	/// is armed, and set once a send failed.
+	bool uring_receiving_;
+	bool uring_armed_;
+	bool uring_failed_;
+
+	/// -r uring: the blocks of the sends in flight, oldest first, and their
+	/// number.
+	ACE_Message_Block *uring_sending_;
+	ACE_Message_Block *uring_sending_tail_;
+	int uring_in_flight_;
+
+	/// Links of the Uring_Loop's list of connections.
+	Echo_Svc_Handler *uring_prev_;
+	Echo_Svc_Handler *uring_next_;
+};
 
 /**
-* @class Echo_Acceptor
-* @brief Acceptor using TCP sockets stream
+* @class File_Cache
+* @brief LRU cache of memory-mapped files and their response headers
 *
-* Create an Echo_Acceptor that inherits from ACE_Acceptor (or uses a simple typedef)
-* and uses an Internet domain ''passive-mode'' stream socket to listen a designated
-* port number [ACE_Acceptor, ACE_SOCK_Acceptor, ACE_INET_Addr, etc.].
+* An entry maps a file of the document root and holds the status line and
+* header fields of its "200 OK" response, so a hit is answered with one
+* gathered write of the header and the mapping: the file is neither read nor
+* copied in user space. Once the mapped bytes exceed the budget the least
+* recently used entries are dropped; an entry that a connection is still
+* sending stays mapped until the connection releases it. Files too large for
+* the cache go out with sendfile().
+*
+* Files are assumed not to change while they are being served. Every event
+* loop has its own cache, so no locking is needed.
+*
+* As an event handler it logs its hit rate on every timeout.
 */
-typedef ACE_Acceptor<Echo_Svc_Handler, ACE_SOCK_ACCEPTOR> Echo_Acceptor;
+class File_Cache : public ACE_Event_Handler
+{
+public:
+	/**
+	* @struct Entry
+	* @brief One cached file
+	*/
+	struct Entry
+	{
+		/// Request path, relative to the document root.
+		ACE_CString path;
 
+		/// Precomputed status line and header fields, up to the
+		/// Connection field that depends on the request.
+		ACE_CString header;
 
-/* Program's entry point */
-int ACE_TMAIN(int argc, ACE_TCHAR *argv[])
-{
-	ACE_OS::printf("Usage: %s [port-number]\n", argv[0]);
-	u_short port = argc < 2 ? ACE_DEFAULT_SERVER_PORT : ACE_OS::atoi(argv[1]);
+		/// Mapped contents, 0 for an empty file.
+		char *data;
+		size_t size;
 
-	/// Creating an address object which specifies the TCP/IP port on
-	/// which the server will listen for new connection requests. 
-	/// (using a wrapper facade INET_Addr class that encapsulates the Internet domain address struct)
-	ACE_INET_Addr addr(port);
+		/// The cache, while the entry is cached, plus each connection
+		/// sending it. The file is unmapped when the last one releases it.
+		int refs;
+
+		/// Least recently used list, most recent first.
+		Entry *prev;
+		Entry *next;
+	};
+
+	explicit File_Cache(size_t budget)
+		: budget_(budget), bytes_(0), head_(0), tail_(0), hits_(0), misses_(0)
+	{
+	}
+
+	~File_Cache()
+	{
+		while (tail_ != 0)
+			this->evict(tail_);
+	}
+
+	/// Whether a file of size bytes is worth caching: one file may take
+	/// at most a quarter of the budget.
+	bool cacheable(size_t size) const
+	{
+		return size <= budget_ / 4;
+	}
+
+	/// Returns the entry for path, or 0 on a miss. The caller must
+	/// release() the entry.
+	Entry *find(const ACE_CString &path)
+	{
+		Entry *entry = 0;
+		if (map_.find(path, entry) == -1)
+		{
+			++misses_;
+			return 0;
+		}
+
+		++hits_;
+		this->unlink(entry);
+		this->push_front(entry);
+		++entry->refs;
+		return entry;
+	}
+
+	/// Maps the size bytes of file and caches them under path, with their
+	/// header fields, evicting older entries to stay within the budget.
+	/// Returns the new entry, which the caller must release(), or 0 if the
+	/// file cannot be mapped.
+	Entry *insert(const ACE_CString &path, ACE_HANDLE file, size_t size,
+		const char *header)
+	{
+		char *data = 0;
+		if (size > 0)
+		{
+			void *addr = ACE_OS::mmap(0, size, PROT_READ, MAP_SHARED, file);
+			if (addr == MAP_FAILED)
+				return 0;
+			data = static_cast<char *> (addr);
+		}
+
+		Entry *entry = 0;
+		ACE_NEW_NORETURN(entry, Entry);
+		if (entry == 0 || map_.bind(path, entry) == -1)
+		{
+			delete entry;
+			if (data != 0)
+				ACE_OS::munmap(data, size);
+			return 0;
+		}
+
+		entry->path = path;
+		entry->header = header;
+		entry->data = data;
+		entry->size = size;
+		entry->refs = 2;
+		this->push_front(entry);
+		bytes_ += size;
+
+		while (bytes_ > budget_ && tail_ != entry)
+			this->evict(tail_);
+		return entry;
+	}
+
+	/// Drops a reference returned by find() or insert().
+	void release(Entry *entry)
+	{
+		if (--entry->refs > 0)
+			return;
+
+		if (entry->data != 0)
+			ACE_OS::munmap(entry->data, entry->size);
+		delete entry;
+	}
+
+	/// Logs the hit rate and the size of the cache.
+	virtual int handle_timeout(const ACE_Time_Value &, const void *)
+	{
+		unsigned long lookups = hits_ + misses_;
+		ACE_DEBUG((LM_INFO,
+			"(%P|%t) file cache: %lu hits, %lu misses (%.1f%% hits), "
+			"%lu files, %lu bytes\n",
+			hits_, misses_,
+			lookups ? 100.0 * hits_ / lookups : 0.0,
+			(unsigned long) map_.current_size(),
+			(unsigned long) bytes_));
+		return 0;
+	}
+
+private:
+	typedef ACE_Hash_Map_Manager_Ex < ACE_CString, Entry *,
+		ACE_Hash<ACE_CString>, ACE_Equal_To<ACE_CString>, ACE_Null_Mutex > Entry_Map;
+
+	void push_front(Entry *entry)
+	{
+		entry->prev = 0;
+		entry->next = head_;
+		if (head_ != 0)
+			head_->prev = entry;
+		else
+			tail_ = entry;
+		head_ = entry;
+	}
+
+	void unlink(Entry *entry)
+	{
+		if (entry->prev != 0)
+			entry->prev->next = entry->next;
+		else
+			head_ = entry->next;
+		if (entry->next != 0)
+			entry->next->prev = entry->prev;
+		else
+			tail_ = entry->prev;
+	}
+
+	/// Removes entry from the cache; it is unmapped once no connection
+	/// is sending it any more.
+	void evict(Entry *entry)
+	{
+		map_.unbind(entry->path);
+		this->unlink(entry);
+		bytes_ -= entry->size;
+		this->release(entry);
+	}
+
+	Entry_Map map_;
+
+	/// Most bytes mapped by cached entries, and bytes mapped now.
+	size_t budget_;
+	size_t bytes_;
+
+	/// Most and least recently used entries.
+	Entry *head_;
+	Entry *tail_;
+
+	unsigned long hits_;
+	unsigned long misses_;
+};
+
+
+/**
+* @class HTTP_Svc_Handler
+* @brief Serves the files of a document root over HTTP/1.1
+*
+* Sibling of Echo_Svc_Handler, selected with the -d option. Requests are
+* parsed as they arrive, so a request split across reads and several
+* pipelined requests in one read are handled alike, and the connection
+* stays open for the next ones unless the client asks otherwise. Responses
+* are sent in the order of the requests, those ready together in a single
+* gathered write, without blocking and without copying the files: a cached
+* file goes out as its precomputed header plus its mapping, any other file
+* with sendfile() after its header. handle_output() carries on when the
+* socket cannot take everything at once. While MAX_PIPELINE responses wait
+* to be sent no more requests are read. Handlers are recycled through a
+* Handler_Pool like Echo_Svc_Handlers.
+*/
+class HTTP_Svc_Handler : public ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >
+{
+public:
+	enum
+	{
+		/// Largest request accepted, header and body.
+		MAX_REQUEST = 8 * 1024,
+
+		/// Most responses waiting to be sent.
+		MAX_PIPELINE = 16
+	};
+
+	HTTP_Svc_Handler(const char *docroot = 0, File_Cache *cache = 0)
+		: docroot_(docroot), cache_(cache), drain_(false), request_length_(0),
+		first_(0), count_(0), closing_(false), write_scheduled_(false),
+		input_suspended_(false), handler_pool_(0), accept_time_(0), timeouts_(0),
+		reading_(false)
+	{
+	}
+
+	/// Sets the document root and the file cache of the next connection.
+	void serve(const char *docroot, File_Cache *cache)
+	{
+		docroot_ = docroot;
+		cache_ = cache;
+	}
+
+	/// Same as Echo_Svc_Handler.
+	void handler_pool(HTTP_Handler_Pool *hp)
+	{
+		handler_pool_ = hp;
+	}
+
+	void accept_time(ACE_hrtime_t time)
+	{
+		accept_time_ = time;
+	}
+
+	void timeouts(const Connection_Timeouts *ct)
+	{
+		timeouts_ = ct;
+	}
+
+	virtual int handle_timeout(const ACE_Time_Value &, const void *)
+	{
+		return -1;
+	}
+
+	virtual void destroy(void)
+	{
+		if (handler_pool_ == 0)
+		{
+			ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >::destroy();
+			return;
+		}
+
+		if (timeouts_->wheel != 0)
+			timeouts_->wheel->cancel(&timer_);
+		this->shutdown();
+
+		while (count_ > 0)
+			this->retire();
+		this->reactor(0);
+		docroot_ = 0;
+		cache_ = 0;
+		drain_ = false;
+		parser_.next();
+		request_length_ = 0;
+		first_ = 0;
+		closing_ = false;
+		write_scheduled_ = false;
+		input_suspended_ = false;
+		accept_time_ = 0;
+		timeouts_ = 0;
+		reading_ = false;
+		handler_pool_->put(this);
+	}
+
+	~HTTP_Svc_Handler()
+	{
+		while (count_ > 0)
+			this->retire();
+	}
+
+	int open(void *)
+	{
+		drain_ = ACE_BIT_ENABLED(ACE::get_flags(this->get_handle()), ACE_NONBLOCK);
+		if (!drain_ && this->peer().enable(ACE_NONBLOCK) == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) %p\n",
+			"enable"),
+			-1);
+
+		if (reactor()->register_handler(this,
+			ACE_Event_Handler::READ_MASK) == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) can't register with reactor\n"),
+			-1);
+		timeouts_->touch(&timer_, this, false, reading_);
+		return 0;
+	}
+
+protected:
+	/// Reads requests and answers those that are complete. After a
+	/// response that closes the connection is out, returns -1.
+	virtual int handle_input(ACE_HANDLE)
+	{
+		do
+		{
+			// Stops reading while every response slot is taken;
+			// handle_output() resumes once some have been sent
+			if (count_ == MAX_PIPELINE)
+			{
+				input_suspended_ = true;
+				return this->reactor()->cancel_wakeup(this,
+					ACE_Event_Handler::READ_MASK) == -1 ? -1 : 0;
+			}
+
+			// Never full here: send_responses() has answered every complete
+			// request, and parse_requests() rejects one that does not fit
+			ssize_t recv_cnt = this->peer().recv(request_ + request_length_,
+				MAX_REQUEST - request_length_);
+			if (recv_cnt == -1 && errno == EWOULDBLOCK)
+				return 0;
+			if (recv_cnt == 0)
+				return this->input_over();
+			if (recv_cnt < 0)
+				return -1;
+			if (accept_time_ != 0)
+			{
+				handler_pool_->first_byte(ACE_OS::gethrtime() - accept_time_);
+				accept_time_ = 0;
+			}
+
+			// Nothing after a request closing the connection is answered
+			if (closing_)
+				continue;
+
+			request_length_ += recv_cnt;
+			this->parse_requests();
+			timeouts_->touch(&timer_, this, request_length_ > 0, reading_);
+			if (this->send_responses() == -1)
+				return -1;
+		} while (drain_);
+
+		return 0;
+	}
+
+	/// The client closed its side: stops reading, drops the incomplete
+	/// request and sends the responses still waiting, after which the
+	/// connection closes. Returns -1 once they are out.
+	int input_over(void)
+	{
+		if (this->reactor()->cancel_wakeup(this,
+			ACE_Event_Handler::READ_MASK) == -1)
+			return -1;
+		closing_ = true;
+		request_length_ = 0;
+		return this->send_responses();
+	}
+
+	/// Sends more of the responses, answering the requests that were left
+	/// waiting for a free slot, and resumes reading once a slot is free.
+	virtual int handle_output(ACE_HANDLE)
+	{
+		if (this->send_responses() == -1)
+			return -1;
+
+		if (input_suspended_ && count_ < MAX_PIPELINE)
+		{
+			input_suspended_ = false;
+			if (this->reactor()->schedule_wakeup(this,
+				ACE_Event_Handler::READ_MASK) == -1)
+				return -1;
+		}
+		return 0;
+	}
+
+private:
+	/**
+	* @struct Response
+	* @brief A response waiting to be sent
+	*/
+	struct Response
+	{
+		/// Unsent parts: status line and header fields, end of the
+		/// header (with the Connection field, if any), body.
+		iovec iov[3];
+
+		/// First part not completely sent.
+		int part;
+
+		/// Cached file the body maps, or 0.
+		File_Cache::Entry *entry;
+
+		/// Uncached file sent with sendfile() after the parts.
+		ACE_HANDLE file;
+		off_t file_offset;
+		size_t file_length;
+
+		/// Header fields (and body) of an uncached or error response.
+		char text[512];
+	};
+
+	/// Sets up the responses to the complete requests received, as long as
+	/// slots are free, and moves the rest of the input to the front of
+	/// request_. Returns the number of responses set up.
+	size_t parse_requests(void)
+	{
+		size_t consumed = 0;
+		size_t before = count_;
+		while (count_ < MAX_PIPELINE && !closing_)
+		{
+			const char *request = request_ + consumed;
+			size_t length = request_length_ - consumed;
+			HTTP_Parser::Result result = parser_.parse(request, length);
+			if (result == HTTP_Parser::INVALID)
+			{
+				this->respond_error(400, "Bad Request", true);
+				break;
+			}
+
+			const HTTP_Request &r = parser_.request();
+			if (result == HTTP_Parser::INCOMPLETE)
+			{
+				bool too_large = r.header_length != 0
+					? r.length > MAX_REQUEST
+					: length == MAX_REQUEST;
+				if (too_large)
+					this->respond_error(413, "Payload Too Large", true);
+				break;
+			}
+
+			this->respond(request, r);
+			consumed += r.length;
+			parser_.next();
+		}
+
+		if (closing_)
+			request_length_ = 0;
+		else
+		{
+			request_length_ -= consumed;
+			ACE_OS::memmove(request_, request_ + consumed, request_length_);
+		}
+		return count_ - before;
+	}
+
+	/// Sends what it can of the responses and arranges to be called back
+	/// for the rest. Returns -1 on error, or once the response closing the
+	/// connection is out.
+	int send_responses(void)
+	{
+		// Answers the requests that waited for a slot as slots free up, so
+		// request_ only ever holds a request in progress unless every slot
+		// is taken
+		int result;
+		while ((result = this->transmit()) != -1
+			&& count_ < MAX_PIPELINE
+			&& request_length_ > 0
+			&& this->parse_requests() > 0)
+			;
+
+		if (result == -1 || (result == 1 && closing_))
+			return -1;
+
+		bool pending = result == 0;
+		if (pending != write_scheduled_)
+		{
+			write_scheduled_ = pending;
+			if ((pending
+				? this->reactor()->schedule_wakeup(this, ACE_Event_Handler::WRITE_MASK)
+				: this->reactor()->cancel_wakeup(this, ACE_Event_Handler::WRITE_MASK)) == -1)
+				return -1;
+		}
+		return 0;
+	}
+
+	/// Returns the end of the header of a response: "\r\n", preceded by a
+	/// Connection field where the default does not apply.
+	const char *end_of_header(const HTTP_Request &r)
+	{
+		if (!r.keep_alive)
+		{
+			closing_ = true;
+			return "Connection: close\r\n\r\n";
+		}
+		return r.minor_version == 0 ? "Connection: keep-alive\r\n\r\n" : "\r\n";
+	}
+
+	/// Takes the next free response slot.
+	Response &add_response(void)
+	{
+		Response &response = responses_[(first_ + count_++) % MAX_PIPELINE];
+		for (int i = 0; i < 3; ++i)
+			response.iov[i].iov_len = 0;
+		response.part = 0;
+		response.entry = 0;
+		response.file = ACE_INVALID_HANDLE;
+		response.file_offset = 0;
+		response.file_length = 0;
+		return response;
+	}
+
+	/// Frees the slot of the oldest response.
+	void retire(void)
+	{
+		Response &response = responses_[first_];
+		if (response.entry != 0)
+			cache_->release(response.entry);
+		if (response.file != ACE_INVALID_HANDLE)
+			ACE_OS::close(response.file);
+		first_ = (first_ + 1) % MAX_PIPELINE;
+		--count_;
+	}
+
+	static void set(iovec &iov, const char *base, size_t length)
+	{
+		iov.iov_base = const_cast<char *> (base);
+		iov.iov_len = length;
+	}
+
+	/// Decodes the "%XX" escapes of the n bytes of path into out, which
+	/// has room for size bytes. Returns the decoded length, or -1 if path
+	/// is malformed, too long or leaves the document root.
+	static int decode_path(const char *path, size_t n, char *out, size_t size)
+	{
+		size_t length = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			char c = path[i];
+			if (c == '%')
+			{
+				if (i + 2 >= n || !ACE_OS::ace_isxdigit(path[i + 1])
+					|| !ACE_OS::ace_isxdigit(path[i + 2]))
+					return -1;
+				char hex[3] = { path[i + 1], path[i + 2], '\0' };
+				c = static_cast<char> (ACE_OS::strtol(hex, 0, 16));
+				i += 2;
+			}
+			if (c == '\0' || length + 1 >= size)
+				return -1;
+			out[length++] = c;
+		}
+		out[length] = '\0';
+
+		// No "." or ".." segment may walk out of the document root
+		for (const char *segment = out; segment != 0;)
+		{
+			const char *slash = ACE_OS::strchr(segment + 1, '/');
+			size_t segment_length = (slash != 0 ? slash : out + length) - segment;
+			if ((segment_length == 2 && segment[1] == '.')
+				|| (segment_length == 3 && segment[1] == '.' && segment[2] == '.'))
+				return -1;
+			segment = slash;
+		}
+		return static_cast<int> (length);
+	}
+
+	/// Returns the media type of a file, from its extension.
+	static const char *content_type(const char *path)
+	{
+		static const struct
+		{
+			const char *extension;
+			const char *type;
+		} types[] =
+		{
+			{ ".html", "text/html" },
+			{ ".htm", "text/html" },
+			{ ".css", "text/css" },
+			{ ".js", "application/javascript" },
+			{ ".json", "application/json" },
+			{ ".txt", "text/plain" },
+			{ ".xml", "application/xml" },
+			{ ".svg", "image/svg+xml" },
+			{ ".png", "image/png" },
+			{ ".jpg", "image/jpeg" },
+			{ ".jpeg", "image/jpeg" },
+			{ ".gif", "image/gif" },
+			{ ".ico", "image/x-icon" },
+			{ ".woff", "font/woff" },
+			{ ".woff2", "font/woff2" },
+			{ ".pdf", "application/pdf" }
+		};
+
+		const char *dot = ACE_OS::strrchr(path, '.');
+		if (dot != 0 && ACE_OS::strchr(dot, '/') == 0)
+			for (size_t i = 0; i < sizeof types / sizeof types[0]; ++i)
+				if (ACE_OS::strcasecmp(dot, types[i].extension) == 0)
+					return types[i].type;
+		return "application/octet-stream";
+	}
+
+	/// Sets up the response to the complete request r, which starts at
+	/// request.
+	void respond(const char *request, const HTTP_Request &r)
+	{
+		bool head = r.method_length == 4 && ACE_OS::strncmp(request, "HEAD", 4) == 0;
+		if (!head && (r.method_length != 3 || ACE_OS::strncmp(request, "GET", 3) != 0))
+		{
+			this->respond_error(405, "Method Not Allowed", !r.keep_alive);
+			return;
+		}
+
+		// The query string does not select the file
+		const char *target = request + r.target_offset;
+		const char *target_end = target + r.target_length;
+		const char *query = static_cast<const char *> (
+			ACE_OS::memchr(target, '?', target_end - target));
+		if (query != 0)
+			target_end = query;
+
+		char path[MAXPATHLEN + 1];
+		int path_length = *target == '/'
+			? decode_path(target, target_end - target,
+			path, sizeof path - sizeof "index.html")
+			: -1;
+		if (path_length == -1)
+		{
+			this->respond_error(400, "Bad Request", !r.keep_alive);
+			return;
+		}
+		if (path[path_length - 1] == '/')
+			path_length += ACE_OS::sprintf(path + path_length, "index.html");
+
+		ACE_DEBUG((LM_DEBUG,
+			"(%P|%t) %s %s\n",
+			head ? "HEAD" : "GET", path));
+
+		// The key refers to path rather than copying it
+		ACE_CString key(path, path_length, 0, false);
+		File_Cache::Entry *entry = cache_->find(key);
+		if (entry == 0)
+		{
+			this->respond_file(key, head, r);
+			return;
+		}
+
+		Response &response = this->add_response();
+		response.entry = entry;
+		set(response.iov[0], entry->header.c_str(), entry->header.length());
+		const char *end = this->end_of_header(r);
+		set(response.iov[1], end, ACE_OS::strlen(end));
+		if (!head)
+			set(response.iov[2], entry->data, entry->size);
+	}
+
+	/// Cache miss: opens the file and caches it, or else sets it up to be
+	/// sent with sendfile().
+	void respond_file(const ACE_CString &path, bool head, const HTTP_Request &r)
+	{
+		char file_name[MAXPATHLEN + 1];
+		if (ACE_OS::snprintf(file_name, sizeof file_name, "%s%s",
+			docroot_, path.c_str()) >= (int) sizeof file_name)
+		{
+			this->respond_error(404, "Not Found", !r.keep_alive);
+			return;
+		}
+
+		ACE_HANDLE file = ACE_OS::open(file_name, O_RDONLY);
+		if (file == ACE_INVALID_HANDLE)
+		{
+			if (errno == EACCES)
+				this->respond_error(403, "Forbidden", !r.keep_alive);
+			else
+				this->respond_error(404, "Not Found", !r.keep_alive);
+			return;
+		}
+
+		ACE_stat st;
+		if (ACE_OS::fstat(file, &st) == -1 || !S_ISREG(st.st_mode))
+		{
+			ACE_OS::close(file);
+			this->respond_error(404, "Not Found", !r.keep_alive);
+			return;
+		}
+
+		Response &response = this->add_response();
+		size_t size = static_cast<size_t> (st.st_size);
+		int header_length = ACE_OS::snprintf(response.text, sizeof response.text,
+			"HTTP/1.1 200 OK\r\n"
+			"Server: ReactiveWebserver\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %lu\r\n",
+			content_type(path.c_str()), (unsigned long) size);
+
+		if (cache_->cacheable(size))
+			response.entry = cache_->insert(path, file, size, response.text);
+
+		if (response.entry != 0)
+		{
+			ACE_OS::close(file);
+			if (!head)
+				set(response.iov[2], response.entry->data, size);
+		}
+		else
+		{
+			response.file = file;
+			if (!head)
+				response.file_length = size;
+		}
+
+		set(response.iov[0], response.text, header_length);
+		const char *end = this->end_of_header(r);
+		set(response.iov[1], end, ACE_OS::strlen(end));
+	}
+
+	/// Sets up an error response with a short text body. close is set
+	/// when the connection cannot go on, or the client asked to close it.
+	void respond_error(int status, const char *reason, bool close)
+	{
+		Response &response = this->add_response();
+		int header_length = ACE_OS::snprintf(response.text, sizeof response.text,
+			"HTTP/1.1 %d %s\r\n"
+			"Server: ReactiveWebserver\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: %lu\r\n"
+			"%s",
+			status, reason,
+			(unsigned long) (ACE_OS::strlen(reason) + 5),
+			status == 405 ? "Allow: GET, HEAD\r\n" : "");
+		char *body = response.text + header_length + 1;
+		int body_length = ACE_OS::sprintf(body, "%d %s\n", status, reason);
+
+		HTTP_Request r;
+		r.keep_alive = !close;
+		r.minor_version = 1;
+		const char *end = this->end_of_header(r);
+		set(response.iov[0], response.text, header_length);
+		set(response.iov[1], end, ACE_OS::strlen(end));
+		set(response.iov[2], body, body_length);
+	}
+
+	/// Sends as much of the responses as the socket takes: all the parts up
+	/// to the next file sent with sendfile() in one gathered write, then
+	/// that file. Returns 1 once everything has been sent, 0 if the socket
+	/// is full, -1 on error.
+	int transmit(void)
+	{
+		while (count_ > 0)
+		{
+			iovec iov[3 * MAX_PIPELINE];
+			int iovcnt = 0;
+			size_t length = 0;
+			for (size_t i = 0; i < count_; ++i)
+			{
+				Response &response = responses_[(first_ + i) % MAX_PIPELINE];
+				for (int part = response.part; part < 3; ++part)
+					if (response.iov[part].iov_len > 0)
+					{
+						iov[iovcnt++] = response.iov[part];
+						length += response.iov[part].iov_len;
+					}
+				if (response.file_length > 0)
+					break;
+			}
+
+			if (iovcnt > 0)
+			{
+				ssize_t send_cnt = this->peer().sendv(iov, iovcnt);
+				if (send_cnt == -1)
+					return errno == EWOULDBLOCK ? 0 : -1;
+				this->sent(send_cnt);
+				if (static_cast<size_t> (send_cnt) < length)
+					return 0;	// The socket is full
+			}
+			if (count_ == 0)
+				break;
+
+			// The oldest response has nothing but its file left
+			Response &response = responses_[first_];
+			while (response.file_length > 0)
+			{
+				ssize_t send_cnt = ACE_OS::sendfile(this->get_handle(),
+					response.file, &response.file_offset, response.file_length);
+				if (send_cnt == -1)
+					return errno == EWOULDBLOCK ? 0 : -1;
+				if (send_cnt == 0)
+					return -1;	// The file was truncated
+				response.file_length -= send_cnt;
+			}
+			this->retire();
+		}
+		return 1;
+	}
+
+	/// Accounts for n bytes of the responses sent, retiring those that are
+	/// complete.
+	void sent(size_t n)
+	{
+		while (count_ > 0)
+		{
+			Response &response = responses_[first_];
+			for (; response.part < 3; ++response.part)
+			{
+				iovec &iov = response.iov[response.part];
+				size_t taken = n < iov.iov_len ? n : iov.iov_len;
+				iov.iov_base = static_cast<char *> (iov.iov_base) + taken;
+				iov.iov_len -= taken;
+				n -= taken;
+				if (iov.iov_len > 0)
+					return;
+			}
+			if (response.file_length > 0)
+				return;
+			this->retire();
+		}
+	}
+
+	/// Directory the request paths are relative to.
+	const char *docroot_;
+
+	/// The event loop's file cache.
+	File_Cache *cache_;
+
+	/// Set on non-blocking connections (see Echo_Svc_Handler).
+	bool drain_;
+
+	/// Requests received but not answered yet, the first one partly parsed.
+	HTTP_Parser parser_;
+	char request_[MAX_REQUEST];
+	size_t request_length_;
+
+	/// Ring of responses waiting to be sent, oldest first.
+	Response responses_[MAX_PIPELINE];
+	size_t first_;
+	size_t count_;
+
+	/// Set once a response closes the connection, or the client closed its
+	/// side: no request after it is answered, and the connection is closed
+	/// when the responses have been sent.
+	bool closing_;
+
+	/// Set while WRITE_MASK is scheduled.
+	bool write_scheduled_;
+
+	/// Set while READ_MASK is cancelled because every slot is taken.
+	bool input_suspended_;
+
+	HTTP_Handler_Pool *handler_pool_;
+	ACE_hrtime_t accept_time_;
+	const Connection_Timeouts *timeouts_;
+	Echo_Timeout_Wheel::Timer timer_;
+	bool reading_;
+};
+
+
+/**
+* @class Reuseport_SOCK_Acceptor
+* @brief Passive-mode socket that shares its port with other acceptors
+*
+* Same as ACE_SOCK_Acceptor, but sets SO_REUSEPORT before binding, so that
+* every event loop can open its own listening socket on the same port and
+* the kernel spreads the incoming connections across them.
+*/
+class Reuseport_SOCK_Acceptor : public ACE_SOCK_Acceptor
+{
+public:
+	int open(const ACE_Addr &local_sap,
+		int reuse_addr = 0,
+		int protocol_family = PF_UNSPEC,
+		int backlog = ACE_DEFAULT_BACKLOG,
+		int protocol = 0)
+	{
+		if (local_sap != ACE_Addr::sap_any)
+			protocol_family = local_sap.get_type();
+		else if (protocol_family == PF_UNSPEC)
+			protocol_family = ACE::ipv6_enabled() ? PF_INET6 : PF_INET;
+
+		if (ACE_SOCK::open(SOCK_STREAM, protocol_family, protocol, reuse_addr) == -1)
+			return -1;
+
+#if defined (SO_REUSEPORT)
+		int one = 1;
+		if (this->set_option(SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) == -1)
+		{
+			this->close();
+			return -1;
+		}
+#endif /* SO_REUSEPORT */
+
+		return this->shared_open(local_sap, protocol_family, backlog);
+	}
+};
+
+
+/**
+* @class Echo_Acceptor
+* @brief Acceptor using TCP sockets stream
+*
+* Create an Echo_Acceptor that inherits from ACE_Acceptor (or uses a simple typedef)
+* and uses an Internet domain ''passive-mode'' stream socket to listen a designated
+* port number [ACE_Acceptor, ACE_SOCK_Acceptor, ACE_INET_Addr, etc.].
+*
+* Takes its handlers from the event loop's Handler_Pool.
+*/
+class Echo_Acceptor : public ACE_Acceptor<Echo_Svc_Handler, Reuseport_SOCK_Acceptor>
+{
+public:
+	Echo_Acceptor(Echo_Handler_Pool *pool, const Connection_Timeouts *timeouts)
+		: pool_(pool), timeouts_(timeouts)
+	{
+	}
+
+	virtual int make_svc_handler(Echo_Svc_Handler *&sh)
+	{
+		ACE_hrtime_t now = ACE_OS::gethrtime();
+		if (sh == 0 && (sh = pool_->take()) == 0)
+			return -1;
+		sh->accept_time(now);
+		sh->timeouts(timeouts_);
+		sh->reactor(this->reactor());
+		return 0;
+	}
+
+private:
+	Echo_Handler_Pool *pool_;
+	const Connection_Timeouts *timeouts_;
+};
+
+
+/**
+* @class HTTP_Acceptor
+* @brief Acceptor of the HTTP_Svc_Handlers of one event loop
+*
+* Hands every new handler, taken from the loop's Handler_Pool, the document
+* root and the loop's File_Cache.
+*/
+class HTTP_Acceptor : public ACE_Acceptor<HTTP_Svc_Handler, Reuseport_SOCK_Acceptor>
+{
+public:
+	HTTP_Acceptor(const char *docroot, File_Cache *cache,
+		HTTP_Handler_Pool *pool, const Connection_Timeouts *timeouts)
+		: docroot_(docroot), cache_(cache), pool_(pool), timeouts_(timeouts)
+	{
+	}
+
+	virtual int make_svc_handler(HTTP_Svc_Handler *&sh)
+	{
+		ACE_hrtime_t now = ACE_OS::gethrtime();
+		if (sh == 0 && (sh = pool_->take()) == 0)
+			return -1;
+		sh->serve(docroot_, cache_);
+		sh->accept_time(now);
+		sh->timeouts(timeouts_);
+		sh->reactor(this->reactor());
+		return 0;
+	}
+
+private:
+	const char *docroot_;
+	File_Cache *cache_;
+	HTTP_Handler_Pool *pool_;
+	const Connection_Timeouts *timeouts_;
+};
+
+
+#if defined (ECHO_HAS_IO_URING)
+/**
+* @class Uring_Loop
+* @brief Event loop of the echo service on io_uring rather than a reactor
+*
+* Accepts with a multishot accept on the loop's own SO_REUSEPORT socket,
+* receives with one multishot receive per connection drawing on a ring of
+* provided buffers, and sends the lines echoed as chains of linked sends.
+* Each pass submits whatever the completions brought about and waits for
+* the next ones in a single io_uring_enter(), so a busy loop makes one
+* system call for many requests instead of a recv() and a send() each. A
+* timeout re-armed on every tick drives the Timeout_Wheel and the
+* statistics in place of the reactor's timers.
+*
+* A connection is closed once its input is over and no send is in flight.
+* Every event loop has its own ring, so no locking is needed.
+*/
+class Uring_Loop
+{
+public:
+	enum
+	{
+		/// Submission queue entries.
+		ENTRIES = 1024,
+
+		/// Buffer group the receives draw on, its number of buffers and
+		/// their size.
+		BUFFER_GROUP = 0,
+		BUFFERS = 1024,
+		BUFFER_SIZE = 4096
+	};
+
+	/// Takes the handlers through acceptor, which is not opened. wheel is
+	/// 0 if the timeouts are disabled.
+	Uring_Loop(Echo_Acceptor *acceptor, Echo_Handler_Pool *pool,
+		Echo_Timeout_Wheel *wheel, int stats_interval)
+		: acceptor_(acceptor), pool_(pool), wheel_(wheel),
+		stats_interval_(stats_interval), connections_(0), sends_(0)
+	{
+	}
+
+	~Uring_Loop()
+	{
+		// Closing the ring cancels whatever is in flight
+		ring_.close();
+		while (connections_ != 0)
+			this->close_connection(connections_);
+		listener_.close();
+	}
+
+	/// Sets the ring up and starts accepting connections at addr. Returns -1
+	/// on failure.
+	int open(const ACE_INET_Addr &addr)
+	{
+		if (ring_.open(ENTRIES) == -1
+			|| ring_.buffers(BUFFER_GROUP, BUFFERS, BUFFER_SIZE) == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) %p\n",
+			"io_uring"),
+			-1);
+		if (listener_.open(addr, 1) == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) %p\n",
+			"open"),
+			-1);
+
+		last_stats_ = ACE_OS::gettimeofday();
+		if (this->arm_accept() == -1 || this->arm_tick() == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) %p\n",
+			"io_uring_enter"),
+			-1);
+		return 0;
+	}
+
+	/// Runs the loop; returns -1 only if io_uring_enter() fails.
+	int run(void)
+	{
+		for (;;)
+		{
+			// Waits only with no completion left to handle
+			if (ring_.enter(ring_.peek() == 0 ? 1 : 0) == -1 && errno != EINTR)
+				ACE_ERROR_RETURN((LM_ERROR,
+				"(%P|%t) %p\n",
+				"io_uring_enter"),
+				-1);
+
+			// Each completion is copied out, so that its slot is free for
+			// the kernel again before it is handled
+			for (io_uring_cqe *cqe; (cqe = ring_.peek()) != 0;)
+			{
+				io_uring_cqe completion = *cqe;
+				ring_.advance();
+				this->dispatch(completion);
+			}
+		}
+	}
+
+private:
+	void dispatch(const io_uring_cqe &cqe)
+	{
+		Echo_Svc_Handler *sh = static_cast<Echo_Svc_Handler *> (Uring::pointer(cqe.user_data));
+		switch (Uring::tag_of(cqe.user_data))
+		{
+		case URING_ACCEPT:
+			this->accepted(cqe);
+			break;
+		case URING_RECV:
+			this->received(sh, cqe);
+			break;
+		case URING_SEND:
+			// Once the whole chain is in, the next one goes out
+			++sends_;
+			if (sh->uring_sent(cqe.res) == 0)
+			{
+				sh->uring_flush();
+				if (sh->uring_idle())
+					this->close_connection(sh);
+			}
+			break;
+		case URING_TICK:
+			this->tick();
+			break;
+		default:
+			// A cancellation, whose outcome shows in the receive cancelled
+			break;
+		}
+	}
+
+	void accepted(const io_uring_cqe &cqe)
+	{
+		if (cqe.res < 0)
+		{
+			errno = -cqe.res;
+			ACE_ERROR((LM_ERROR,
+				"(%P|%t) %p\n",
+				"accept"));
+		}
+		else
+		{
+			Echo_Svc_Handler *sh = 0;
+			if (acceptor_->make_svc_handler(sh) == -1)
+			{
+				ACE_ERROR((LM_ERROR,
+					"(%P|%t) %p\n",
+					"make_svc_handler"));
+				ACE_OS::closesocket(cqe.res);
+			}
+			else
+			{
+				sh->set_handle(cqe.res);
+				if (sh->uring_open(&ring_) == -1)
+					sh->handle_close(sh->get_handle(), ACE_Event_Handler::ALL_EVENTS_MASK);
+				else
+					this->add_connection(sh);
+			}
+		}
+
+		// The multishot accept stops on some errors
+		if (ACE_BIT_DISABLED(cqe.flags, IORING_CQE_F_MORE) && this->arm_accept() == -1)
+			ACE_ERROR((LM_ERROR,
+			"(%P|%t) %p\n",
+			"arm_accept"));
+	}
+
+	void received(Echo_Svc_Handler *sh, const io_uring_cqe &cqe)
+	{
+		if (ACE_BIT_ENABLED(cqe.flags, IORING_CQE_F_BUFFER))
+		{
+			unsigned short bid = static_cast<unsigned short> (cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			if (cqe.res > 0 && sh->uring_input(ring_.buffer(bid), cqe.res) == -1)
+				ACE_OS::shutdown(sh->get_handle(), ACE_SHUTDOWN_BOTH);
+			ring_.recycle(bid);
+		}
+
+		if (ACE_BIT_DISABLED(cqe.flags, IORING_CQE_F_MORE))
+		{
+			// The backlog held back by a suspended receive still goes out
+			sh->uring_rearm(cqe.res);
+			sh->uring_flush();
+			if (sh->uring_idle())
+				this->close_connection(sh);
+		}
+	}
+
+	/// Advances the Timeout_Wheel, logs the statistics when due, and
+	/// re-arms the timeout.
+	void tick(void)
+	{
+		ACE_Time_Value now = ACE_OS::gettimeofday();
+		if (wheel_ != 0)
+			wheel_->handle_timeout(now, 0);
+
+		if (stats_interval_ > 0 && now - last_stats_ >= ACE_Time_Value(stats_interval_))
+		{
+			last_stats_ = now;
+			pool_->handle_timeout(now, 0);
+			ACE_DEBUG((LM_INFO,
+				"(%P|%t) ring: %Q io_uring_enter() calls for %Q sends "
+				"(%.3f per send)\n",
+				ring_.enters(), sends_,
+				sends_ ? (double) ring_.enters() / sends_ : 0.0));
+		}
+
+		if (this->arm_tick() == -1)
+			ACE_ERROR((LM_ERROR,
+			"(%P|%t) %p\n",
+			"arm_tick"));
+	}
+
+	int arm_accept(void)
+	{
+		io_uring_sqe *sqe = ring_.sqe();
+		if (sqe == 0)
+			return -1;
+		Uring::prep(sqe, IORING_OP_ACCEPT, listener_.get_handle(), 0, 0,
+			Uring::tag(this, URING_ACCEPT));
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		return 0;
+	}
+
+	int arm_tick(void)
+	{
+		io_uring_sqe *sqe = ring_.sqe();
+		if (sqe == 0)
+			return -1;
+		ACE_Time_Value tick = wheel_ != 0
+			? wheel_->tick()
+			: ACE_Time_Value(0, Echo_Timeout_Wheel::DEFAULT_TICK_MSEC * 1000);
+		tick_.tv_sec = tick.sec();
+		tick_.tv_nsec = tick.usec() * 1000L;
+		Uring::prep(sqe, IORING_OP_TIMEOUT, -1, &tick_, 1, Uring::tag(this, URING_TICK));
+		return 0;
+	}
+
+	void add_connection(Echo_Svc_Handler *sh)
+	{
+		sh->uring_prev_ = 0;
+		sh->uring_next_ = connections_;
+		if (connections_ != 0)
+			connections_->uring_prev_ = sh;
+		connections_ = sh;
+	}
+
+	/// Takes sh off the list and closes it, which returns it to its pool.
+	void close_connection(Echo_Svc_Handler *sh)
+	{
+		if (sh->uring_prev_ != 0)
+			sh->uring_prev_->uring_next_ = sh->uring_next_;
+		else
+			connections_ = sh->uring_next_;
+		if (sh->uring_next_ != 0)
+			sh->uring_next_->uring_prev_ = sh->uring_prev_;
+		sh->uring_prev_ = sh->uring_next_ = 0;
+		sh->handle_close(sh->get_handle(), ACE_Event_Handler::ALL_EVENTS_MASK);
+	}
+
+	Uring ring_;
+	Reuseport_SOCK_Acceptor listener_;
+	Echo_Acceptor *acceptor_;
+	Echo_Handler_Pool *pool_;
+	Echo_Timeout_Wheel *wheel_;
+	int stats_interval_;
+	__kernel_timespec tick_;
+	ACE_Time_Value last_stats_;
+
+	/// Connections whose input is not over, or with sends in flight.
+	Echo_Svc_Handler *connections_;
+
+	/// Sends completed, for the statistics.
+	ACE_UINT64 sends_;
+};
+#endif /* ECHO_HAS_IO_URING */
+
+
+/**
+* @struct Loop_Options
+* @brief Startup configuration shared by all event loops
+*/
+struct Loop_Options
+{
+	ACE_INET_Addr addr;
+
+	/// Run on ACE_Dev_Poll_Reactor (epoll) with non-blocking connections
+	/// instead of on ACE_Select_Reactor.
+	bool dev_poll;
+
+	/// Run the echo service on a Uring_Loop instead of a reactor (-r uring).
+	bool uring;
+
+	/// Serve the files under this directory over HTTP rather than echo;
+	/// 0 (default) keeps the echo service.
+	const char *docroot;
+
+	/// Byte budget of each event loop's File_Cache.
+	size_t cache_bytes;
+
+	/// Interval between File_Cache and Handler_Pool statistics reports;
+	/// 0 disables them.
+	int stats_interval;
+
+	/// Handlers each event loop allocates at startup, at most one per
+	/// descriptor the process may open.
+	size_t prewarm_handlers;
+
+	/// Idle and read timeouts (-i); an idle timeout of 0 disables both.
+	ACE_Time_Value idle_timeout;
+	ACE_Time_Value read_timeout;
+};
+
+
+/// Runs one event loop: a private reactor and an Echo_Acceptor (or an
+/// HTTP_Acceptor) listening on the port passed in arg. Loops share nothing,
+/// so each connection is served entirely by the thread that accepted it.
+static ACE_THR_FUNC_RETURN event_loop(void *arg)
+{
+	const Loop_Options &options = *static_cast<Loop_Options *> (arg);
+
+	// Outlive the reactor, which closes the connections still using them
+	File_Cache cache(options.cache_bytes);
+	Echo_Timeout_Wheel wheel;
+	Echo_Handler_Pool echo_pool;
+	HTTP_Handler_Pool http_pool;
+	if ((options.docroot != 0
+		? http_pool.prewarm(options.prewarm_handlers)
+		: echo_pool.prewarm(options.prewarm_handlers)) == -1)
+		ACE_ERROR_RETURN((LM_ERROR,
+		"(%P|%t) %p\n",
+		"prewarm"),
+		0);
+
+	ACE_Reactor_Impl *impl = 0;
+#if defined (ACE_HAS_EVENT_POLL) || defined (ACE_HAS_DEV_POLL)
+	if (options.dev_poll)
+		ACE_NEW_RETURN(impl, ACE_Dev_Poll_Reactor, 0);
+	else
+#endif /* ACE_HAS_EVENT_POLL || ACE_HAS_DEV_POLL */
+		ACE_NEW_RETURN(impl, ACE_Select_Reactor, 0);
+	ACE_Reactor reactor(impl, true);
+
+	Connection_Timeouts timeouts;
+	timeouts.wheel = 0;
+	timeouts.idle = options.idle_timeout;
+	timeouts.read = options.read_timeout;
+	if (options.idle_timeout != ACE_Time_Value::zero)
+	{
+		if (wheel.open(options.uring ? 0 : &reactor) == -1)
+			ACE_ERROR_RETURN((LM_ERROR,
+			"(%P|%t) %p\n",
+			"timeout wheel"),
+			0);
+		timeouts.wheel = &wheel;
+	}
+
+	int flags = options.dev_poll ? ACE_NONBLOCK : 0;
+	Echo_Acceptor echo_acceptor(&echo_pool, &timeouts);
+#if defined (ECHO_HAS_IO_URING)
+	if (options.uring)
+	{
+		// The acceptor only configures the handlers the loop accepts
+		Uring_Loop loop(&echo_acceptor, &echo_pool, timeouts.wheel, options.stats_interval);
+		if (loop.open(options.addr) == 0)
+			loop.run();
+		return 0;
+	}
+#endif /* ECHO_HAS_IO_URING */
+	HTTP_Acceptor http_acceptor(options.docroot, &cache, &http_pool, &timeouts);
+	if ((options.docroot != 0
+		? http_acceptor.open(options.addr, &reactor, flags)
+		: echo_acceptor.open(options.addr, &reactor, flags)) == -1)
+		ACE_ERROR_RETURN((LM_ERROR,
+		"(%P|%t) %p\n",
+		"open"),
+		0);
+
+	if (options.stats_interval > 0)
+	{
+		ACE_Time_Value interval(options.stats_interval);
+		if (options.docroot != 0)
+		{
+			reactor.schedule_timer(&cache, 0, interval, interval);
+			reactor.schedule_timer(&http_pool, 0, interval, interval);
+		}
+		else
+			reactor.schedule_timer(&echo_pool, 0, interval, interval);
+	}
+
+	reactor.run_reactor_event_loop();
+	return 0;
+}
+
+
+/* Program's entry point */
+int ACE_TMAIN(int argc, ACE_TCHAR *argv[])
+{
+	ACE_OS::printf("Usage: %s [-n event-loops] [-r select|epoll|uring] [-d docroot] "
+		"[-c cache-bytes] [-s stats-seconds] [-k prewarm-handlers] "
+		"[-i idle-seconds[:read-seconds]] [port-number]\n",
+		argv[0]);
+
+	/// One event loop per online CPU unless told otherwise
+	long n_loops = ACE_OS::num_processors_online();
+	Loop_Options options;
+	options.dev_poll = false;
+	options.uring = false;
+	options.docroot = 0;
+	options.cache_bytes = 64 * 1024 * 1024;
+	options.stats_interval = 0;
+	options.prewarm_handlers = 0;
+	options.idle_timeout.set(60, 0);
+	options.read_timeout.set(10, 0);
+	ACE_Get_Opt get_opt(argc, argv, ACE_TEXT("n:r:d:c:s:k:i:"));
+	for (int c; (c = get_opt()) != -1;)
+	{
+		switch (c)
+		{
+		case 'n':
+			n_loops = ACE_OS::atoi(get_opt.opt_arg());
+			break;
+		case 'r':
+			options.dev_poll = options.uring = false;
+			if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("select")) == 0)
+				options.dev_poll = false;
+#if defined (ACE_HAS_EVENT_POLL) || defined (ACE_HAS_DEV_POLL)
+			else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("epoll")) == 0)
+				options.dev_poll = true;
+#endif /* ACE_HAS_EVENT_POLL || ACE_HAS_DEV_POLL */
+#if defined (ECHO_HAS_IO_URING)
+			else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("uring")) == 0)
+				options.uring = true;
+#endif /* ECHO_HAS_IO_URING */
+			else
+				return 1;
+			break;
+		case 'd':
+			options.docroot = get_opt.opt_arg();
+			break;
+		case 'c':
+			options.cache_bytes = ACE_OS::strtoul(get_opt.opt_arg(), 0, 10);
+			break;
+		case 's':
+			options.stats_interval = ACE_OS::atoi(get_opt.opt_arg());
+			break;
+		case 'k':
+		{
+			ACE_TCHAR *end = 0;
+			long handlers = ACE_OS::strtol(get_opt.opt_arg(), &end, 10);
+			if (end == get_opt.opt_arg() || *end != 0
+				|| handlers < 0 || handlers > ACE::max_handles())
+				return 1;
+			options.prewarm_handlers = handlers;
+			break;
+		}
+		case 'i':
+		{
+			ACE_TCHAR *end = 0;
+			options.idle_timeout.set(ACE_OS::strtod(get_opt.opt_arg(), &end));
+			if (*end == ACE_TEXT(':'))
+				options.read_timeout.set(ACE_OS::strtod(end + 1, &end));
+			if (*end != 0)
+				return 1;
+			break;
+		}
+		default:
+			return 1;
+		}
+	}
+	if (n_loops < 1)
+		n_loops = 1;
+	if (options.uring && options.docroot != 0)
+	{
+		ACE_DEBUG((LM_WARNING,
+			"(%P|%t) -r uring serves the echo service only; using select\n"));
+		options.uring = false;
+	}
+#if !defined (SO_REUSEPORT)
+	// Without SO_REUSEPORT only one socket can listen on the port
+	n_loops = 1;
+#endif /* SO_REUSEPORT */
+
+	u_short port = get_opt.opt_ind() < argc
+		? ACE_OS::atoi(argv[get_opt.opt_ind()])
+		: ACE_DEFAULT_SERVER_PORT;
+
+	/// Creating an address object which specifies the TCP/IP port on
+	/// which the server will listen for new connection requests. 
+	/// (using a wrapper facade INET_Addr class that encapsulates the Internet domain address struct)
+	options.addr.set(port);
+
+	/// epoll is not limited to FD_SETSIZE handles: let the process (and the
+	/// reactors, which size themselves on it) use as many as allowed
+	if (options.dev_poll)
+		ACE::set_handle_limit();
 
-	/// Create an ACE_Reactor (or use the singleton instance of the ACE_Reactor), register
-	/// the Echo_Acceptor instance with it [ACE_Reactor::register_handler()], and use its
-	/// event loop [ACE_Reactor::run_reactor_event_loop()] to wait for a connection
-	/// to arrive from a client.  
-	Echo_Acceptor acceptor(addr, ACE_Reactor::instance());
+	/// Each event loop creates its own ACE_Reactor, registers its own Echo_Acceptor
+	/// instance with it [ACE_Reactor::register_handler()], and uses its
+	/// event loop [ACE_Reactor::run_reactor_event_loop()] to wait for connections
+	/// to arrive from clients.  
+	if (ACE_Thread_Manager::instance()->spawn_n(n_loops, event_loop, &options) == -1)
+		ACE_ERROR_RETURN((LM_ERROR,
+		"(%P|%t) %p\n",
+		"spawn_n"),
+		1);
 
-	ACE_OS::printf("listening at port %d\n", port);
+	ACE_OS::printf("listening at port %d with %ld event loops\n", port, n_loops);
 
-	ACE_Reactor::instance()->run_reactor_event_loop();
+	ACE_Thread_Manager::instance()->wait();
 
 	return 0;
 };
@@ -0,0 +1,112 @@
+// $Id$
+
+/**
+ * @file Batch_Message_Queue.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * ACE_Message_Queue from which a consumer can take several messages in a
+ * single queue operation, or a message that passes a check.
+ */
+
+#ifndef BATCH_MESSAGE_QUEUE_H
+#define BATCH_MESSAGE_QUEUE_H
+
+#include "ace/Message_Queue_T.h"
+#include "ace/Message_Block.h"
+#include "ace/Time_Value.h"
+#include "ace/OS_NS_errno.h"
+#include "ace/Guard_T.h"
+
+/**
+ * @class Batch_Message_Queue
+ * @brief ACE_Message_Queue with a dequeue_batch() operation
+ *
+ * dequeue_batch() waits for the queue to be non-empty like dequeue_head(),
+ * then takes as many messages as it may under the same lock acquisition,
+ * so a batch costs one lock round trip and at most one wake-up instead of
+ * one of each per message.
+ *
+ * A consumer takes its share of the queue rather than all of it: with
+ * sharers consumers draining the queue, at most count / sharers messages
+ * (rounded up) go to one of them, so the batch size follows the queue
+ * depth, down to a single message when the queue is short, and one worker
+ * never leaves the others idle by taking everything.
+ */
+class Batch_Message_Queue : public ACE_Message_Queue < ACE_MT_SYNCH >
+{
+public:
+  Batch_Message_Queue()
+  {
+  }
+
+  virtual ~Batch_Message_Queue()
+  {
+  }
+
+  /// Takes up to max messages, oldest first, into batch: at least one,
+  /// waiting until timeout (absolute time, 0 waits forever) for it, and at
+  /// most the share of one of sharers consumers. Returns the number taken,
+  /// or -1 with errno set to EWOULDBLOCK (timed out) or ESHUTDOWN.
+  virtual int dequeue_batch(ACE_Message_Block *batch[],
+			    size_t max,
+			    size_t sharers,
+			    ACE_Time_Value *timeout = 0)
+  {
+    ACE_GUARD_RETURN(ACE_MT_SYNCH::MUTEX, guard, this->lock_, -1);
+    if (this->state_ == ACE_Message_Queue_Base::DEACTIVATED)
+      {
+	errno = ESHUTDOWN;
+	return -1;
+      }
+    if (this->wait_not_empty_cond(timeout) == -1)
+      return -1;
+
+    size_t n = share(this->cur_count_, max, sharers);
+    for (size_t i = 0; i < n; ++i)
+      if (this->dequeue_head_i(batch[i]) == -1)
+	return i == 0 ? -1 : static_cast<int> (i);
+    return static_cast<int> (n);
+  }
+
+  /// Takes the oldest message if allow(message, arg), called under the
+  /// queue's lock, says so. Never waits: returns -1 with errno set to
+  /// EWOULDBLOCK if the queue is empty or the message is not allowed, or
+  /// to ESHUTDOWN.
+  int dequeue_head_if(ACE_Message_Block *&mb,
+		      bool (*allow)(ACE_Message_Block *, void *),
+		      void *arg)
+  {
+    ACE_GUARD_RETURN(ACE_MT_SYNCH::MUTEX, guard, this->lock_, -1);
+    if (this->state_ == ACE_Message_Queue_Base::DEACTIVATED)
+      {
+	errno = ESHUTDOWN;
+	return -1;
+      }
+    if (this->is_empty_i() || !allow(this->head_, arg))
+      {
+	errno = EWOULDBLOCK;
+	return -1;
+      }
+    return this->dequeue_head_i(mb);
+  }
+
+protected:
+  /// One consumer's share of count queued messages: between 1 and max.
+  static size_t share(size_t count, size_t max, size_t sharers)
+  {
+    size_t n = sharers <= 1 ? count : (count + sharers - 1) / sharers;
+    if (n > max)
+      n = max;
+    return n == 0 ? 1 : n;
+  }
+
+private:
+  // = Disallow copying.
+  Batch_Message_Queue(const Batch_Message_Queue &);
+  Batch_Message_Queue &operator=(const Batch_Message_Queue &);
+};
+
+#endif /* BATCH_MESSAGE_QUEUE_H */
@@ -0,0 +1,579 @@
+// $Id$
+
+/**
+ * @file Binary_Log.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Asynchronous logger for the request path: threads store fixed-size
+ * binary records, a background thread formats and writes them.
+ */
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include "ace/Task.h"
+#include "ace/Thread_Manager.h"
+#include "ace/Log_Msg.h"
+#include "ace/ACE.h"
+#include "ace/OS_NS_Thread.h"
+#include "ace/OS_NS_unistd.h"
+#include "ace/OS_NS_string.h"
+#include "ace/OS_NS_stdio.h"
+#include "ace/OS_NS_errno.h"
+
+#include <atomic>
+
+#include "Per_Thread.h"
+
+/**
+ * @class Binary_Log
+ * @brief Logger whose callers only copy their arguments into a ring
+ *
+ * log() takes a printf-like format and up to four arguments, as ACE_DEBUG
+ * does, but leaves the formatting to a drain thread: it copies the format
+ * pointer, the arguments and the thread id into the next record of the
+ * calling thread's ring, a single-producer/single-consumer ring of its own
+ * (Per_Thread), and returns. It takes no lock, makes no system call and
+ * never waits: when the ring is full the record is dropped and counted.
+ * Records below the priority threshold, which can be changed at any time,
+ * cost a single load.
+ *
+ * The drain thread wakes up every DRAIN_INTERVAL_MSEC, formats whatever
+ * the rings hold and writes it to standard error in one call per buffer.
+ * Lines of different threads may therefore come out of order, but those
+ * of one thread never do.
+ *
+ * The format must be a string literal, as only its address is kept. It
+ * supports %t (the thread id) and %p (the string argument, a colon and
+ * the text of the caller's errno) as with ACE_Log_Msg, %%, and the printf
+ * conversions d, i, u, x, X, o, c, f, e, g and s with flags, width and
+ * precision, either of which may be * to take it from the arguments;
+ * length modifiers are ignored, as every argument carries its type. A
+ * string (or a text(), for data that is not NUL-terminated) is copied into
+ * the record, truncated to what is left of TEXT_SIZE.
+ */
+class Binary_Log : public ACE_Task_Base
+{
+public:
+  enum
+  {
+    MAX_ARGS = 4,
+
+    /// Bytes of strings a record can hold.
+    TEXT_SIZE = 72,
+
+    /// Records per ring, a power of two.
+    RING_SIZE = 1024,
+
+    /// Formatted output written at a time.
+    BUFFER_SIZE = 64 * 1024,
+
+    /// Period at which the drain thread empties the rings.
+    DRAIN_INTERVAL_MSEC = 10
+  };
+
+  /// One argument of a record.
+  class Arg
+  {
+  public:
+    enum Kind
+    {
+      SIGNED,
+      UNSIGNED,
+      DOUBLE,
+      TEXT
+    };
+
+    Arg(int value) : kind_(SIGNED) { value_.i = value; }
+    Arg(long value) : kind_(SIGNED) { value_.i = value; }
+    Arg(long long value) : kind_(SIGNED) { value_.i = value; }
+    Arg(unsigned value) : kind_(UNSIGNED) { value_.u = value; }
+    Arg(unsigned long value) : kind_(UNSIGNED) { value_.u = value; }
+    Arg(unsigned long long value) : kind_(UNSIGNED) { value_.u = value; }
+    Arg(double value) : kind_(DOUBLE) { value_.d = value; }
+
+    Arg(const char *text)
+      : kind_(TEXT),
+	text_(text),
+	length_(text == 0 ? 0 : ACE_OS::strlen(text))
+    {
+    }
+
+    Arg(const char *text, size_t length)
+      : kind_(TEXT),
+	text_(text),
+	length_(length)
+    {
+    }
+
+  private:
+    friend class Binary_Log;
+
+    Kind kind_;
+    union
+    {
+      ACE_INT64 i;
+      ACE_UINT64 u;
+      double d;
+    } value_;
+    const char *text_;
+    size_t length_;
+  };
+
+  /// The first length bytes at text, as a string argument.
+  static Arg text(const char *text, size_t length)
+  {
+    return Arg(text, length);
+  }
+
+  static Binary_Log *instance(void)
+  {
+    static Binary_Log log;
+    return &log;
+  }
+
+  Binary_Log()
+    : ACE_Task_Base(&thr_mgr_),
+      threshold_(LM_DEBUG),
+      stop_(false),
+      length_(0)
+  {
+  }
+
+  virtual ~Binary_Log()
+  {
+    this->close();
+  }
+
+  /// Starts the drain thread.
+  virtual int open(void * = 0)
+  {
+    stop_.store(false, std::memory_order_relaxed);
+    return this->activate(THR_NEW_LWP | THR_JOINABLE, 1);
+  }
+
+  /// Writes what is left in the rings and stops the drain thread.
+  virtual int close(u_long = 0)
+  {
+    if (this->thr_count() == 0)
+      return 0;
+    stop_.store(true, std::memory_order_release);
+    return this->wait();
+  }
+
+  /// Records of a lower priority are left out. Thread-safe.
+  void threshold(ACE_Log_Priority priority)
+  {
+    threshold_.store(priority, std::memory_order_relaxed);
+  }
+
+  ACE_Log_Priority threshold(void) const
+  {
+    return static_cast<ACE_Log_Priority> (
+      threshold_.load(std::memory_order_relaxed));
+  }
+
+  bool enabled(ACE_Log_Priority priority) const
+  {
+    return priority >= threshold_.load(std::memory_order_relaxed);
+  }
+
+  /// Sets priority to the threshold called name ("trace", "debug",
+  /// "info", "notice", "warning", "error" or "off"). Returns -1 if there
+  /// is none.
+  static int parse(const char *name, ACE_Log_Priority &priority)
+  {
+    static const struct
+    {
+      const char *name;
+      u_long priority;
+    } names[] =
+      {
+	{ "trace", LM_TRACE },
+	{ "debug", LM_DEBUG },
+	{ "info", LM_INFO },
+	{ "notice", LM_NOTICE },
+	{ "warning", LM_WARNING },
+	{ "error", LM_ERROR },
+	{ "off", LM_MAX << 1 }
+      };
+
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; ++i)
+      if (ACE_OS::strcmp(name, names[i].name) == 0)
+	{
+	  priority = static_cast<ACE_Log_Priority> (names[i].priority);
+	  return 0;
+	}
+    return -1;
+  }
+
+  /// Records dropped because a ring was full.
+  ACE_UINT64 dropped(void) const
+  {
+    ACE_UINT64 dropped = 0;
+    for (const Per_Thread < Ring >::Node *node = rings_.head();
+	 node != 0;
+	 node = node->next)
+      dropped += node->value.dropped.load(std::memory_order_relaxed);
+    return dropped;
+  }
+
+  void log(ACE_Log_Priority priority, const char *format)
+  {
+    if (this->enabled(priority))
+      this->store(priority, format, 0, 0);
+  }
+
+  void log(ACE_Log_Priority priority, const char *format, const Arg &a0)
+  {
+    if (this->enabled(priority))
+      this->store(priority, format, &a0, 1);
+  }
+
+  void log(ACE_Log_Priority priority, const char *format,
+	   const Arg &a0, const Arg &a1)
+  {
+    if (this->enabled(priority))
+      {
+	const Arg args[] = { a0, a1 };
+	this->store(priority, format, args, 2);
+      }
+  }
+
+  void log(ACE_Log_Priority priority, const char *format,
+	   const Arg &a0, const Arg &a1, const Arg &a2)
+  {
+    if (this->enabled(priority))
+      {
+	const Arg args[] = { a0, a1, a2 };
+	this->store(priority, format, args, 3);
+      }
+  }
+
+  void log(ACE_Log_Priority priority, const char *format,
+	   const Arg &a0, const Arg &a1, const Arg &a2, const Arg &a3)
+  {
+    if (this->enabled(priority))
+      {
+	const Arg args[] = { a0, a1, a2, a3 };
+	this->store(priority, format, args, 4);
+      }
+  }
+
+  /// Drains the rings every DRAIN_INTERVAL_MSEC until close().
+  virtual int svc(void)
+  {
+    const ACE_Time_Value interval(0, DRAIN_INTERVAL_MSEC * 1000);
+    while (!stop_.load(std::memory_order_acquire))
+      if (this->drain() == 0)
+	ACE_OS::sleep(interval);
+    this->drain();
+    return 0;
+  }
+
+private:
+  struct Record
+  {
+    const char *format;
+    ACE_thread_t thread;
+
+    /// The caller's errno, for %p.
+    int error;
+
+    unsigned char nargs;
+    unsigned char kinds[MAX_ARGS];
+
+    /// Numbers, or the offset in text (high half) and length of a string.
+    ACE_UINT64 values[MAX_ARGS];
+
+    char text[TEXT_SIZE];
+  };
+
+  /// Written by its thread (tail), read by the drain thread (head).
+  struct Ring
+  {
+    Ring()
+      : head(0),
+	tail(0),
+	cached_head(0),
+	dropped(0)
+    {
+    }
+
+    std::atomic<size_t> head;
+    char pad0_[ECHO_CACHE_LINE_SIZE];
+    std::atomic<size_t> tail;
+
+    /// The producer's latest look at head, so that it only reads the
+    /// drain thread's cache line when the ring seems full.
+    size_t cached_head;
+
+    std::atomic<ACE_UINT64> dropped;
+    char pad1_[ECHO_CACHE_LINE_SIZE];
+    Record records[RING_SIZE];
+  };
+
+  void store(ACE_Log_Priority, const char *format, const Arg args[], int n)
+  {
+    int error = errno;
+    Ring *ring = rings_.get();
+    if (ring == 0)
+      return;
+
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->cached_head >= RING_SIZE)
+      {
+	ring->cached_head = ring->head.load(std::memory_order_acquire);
+	if (tail - ring->cached_head >= RING_SIZE)
+	  {
+	    ring->dropped.store(
+	      ring->dropped.load(std::memory_order_relaxed) + 1,
+	      std::memory_order_relaxed);
+	    return;
+	  }
+      }
+
+    Record &record = ring->records[tail & (RING_SIZE - 1)];
+    record.format = format;
+    record.thread = ACE_OS::thr_self();
+    record.error = error;
+    record.nargs = static_cast<unsigned char> (n);
+    size_t used = 0;
+    for (int i = 0; i < n; ++i)
+      {
+	record.kinds[i] = static_cast<unsigned char> (args[i].kind_);
+	if (args[i].kind_ != Arg::TEXT)
+	  {
+	    record.values[i] = args[i].value_.u;
+	    continue;
+	  }
+	size_t length = args[i].length_;
+	if (length > TEXT_SIZE - used)
+	  length = TEXT_SIZE - used;
+	ACE_OS::memcpy(record.text + used, args[i].text_, length);
+	record.values[i] = (static_cast<ACE_UINT64> (used) << 32) | length;
+	used += length;
+      }
+
+    ring->tail.store(tail + 1, std::memory_order_release);
+  }
+
+  /// Formats and writes every record in the rings; returns their number.
+  size_t drain(void)
+  {
+    size_t count = 0;
+    for (const Per_Thread < Ring >::Node *node = rings_.head();
+	 node != 0;
+	 node = node->next)
+      {
+	Ring &ring = const_cast<Ring &> (node->value);
+	size_t head = ring.head.load(std::memory_order_relaxed);
+	size_t tail = ring.tail.load(std::memory_order_acquire);
+	for (; head != tail; ++head, ++count)
+	  {
+	    this->format(ring.records[head & (RING_SIZE - 1)]);
+	    // Frees the record only once it has been formatted
+	    ring.head.store(head + 1, std::memory_order_release);
+	  }
+      }
+    this->flush();
+    return count;
+  }
+
+  void format(const Record &record)
+  {
+    int arg = 0;
+    for (const char *f = record.format; *f != '\0'; )
+      {
+	if (*f != '%')
+	  {
+	    this->put(f++, 1);
+	    continue;
+	  }
+
+	// The flags, width and precision of the conversion, a * taking
+	// the next argument
+	char flags[8];
+	size_t n_flags = 0;
+	for (++f; *f != '\0' && ACE_OS::strchr("-+ #0", *f) != 0; ++f)
+	  if (n_flags < sizeof flags - 1)
+	    flags[n_flags++] = *f;
+	flags[n_flags] = '\0';
+	long width = this->field(f, record, arg);
+	long precision = -1;
+	if (*f == '.')
+	  {
+	    ++f;
+	    precision = this->field(f, record, arg);
+	  }
+	while (*f != '\0' && ACE_OS::strchr("hlLqjz", *f) != 0)
+	  ++f;
+	char conversion = *f;
+	if (conversion == '\0')
+	  break;
+	++f;
+
+	// A negative * width left-justifies, a negative precision is none
+	bool left = ACE_OS::strchr(flags, '-') != 0;
+	if (width < 0)
+	  {
+	    left = true;
+	    width = -width;
+	  }
+	char spec[48];
+	size_t spec_length =
+	  ACE_OS::snprintf(spec, sizeof spec - 4, "%%%s%s",
+			   flags,
+			   left && ACE_OS::strchr(flags, '-') == 0 ? "-" : "");
+	if (width > 0)
+	  spec_length += ACE_OS::snprintf(spec + spec_length,
+					  sizeof spec - 4 - spec_length,
+					  "%ld", width);
+	if (precision >= 0)
+	  spec_length += ACE_OS::snprintf(spec + spec_length,
+					  sizeof spec - 4 - spec_length,
+					  ".%ld", precision);
+
+	char text[64];
+	int length = 0;
+	if (conversion == '%')
+	  length = ACE_OS::snprintf(text, sizeof text, "%%");
+	else if (conversion == 't')
+	  length = ACE_OS::snprintf(text, sizeof text, "%lu",
+				    (unsigned long) record.thread);
+	else if (arg < record.nargs)
+	  {
+	    ACE_UINT64 value = record.values[arg];
+	    switch (record.kinds[arg++])
+	      {
+	      case Arg::TEXT:
+		{
+		  size_t n = static_cast<size_t> (value & 0xffffffff);
+		  if (precision >= 0 && n > static_cast<size_t> (precision))
+		    n = static_cast<size_t> (precision);
+		  size_t pad = static_cast<size_t> (width) > n
+		    ? static_cast<size_t> (width) - n
+		    : 0;
+		  if (!left)
+		    this->pad(pad);
+		  this->put(record.text + (value >> 32), n);
+		  if (left)
+		    this->pad(pad);
+		  if (conversion == 'p')
+		    {
+		      const char *error = ACE_OS::strerror(record.error);
+		      this->put(": ", 2);
+		      this->put(error, ACE_OS::strlen(error));
+		    }
+		}
+		continue;
+	      case Arg::DOUBLE:
+		{
+		  double d;
+		  ACE_OS::memcpy(&d, &value, sizeof d);
+		  spec[spec_length++] = 'f';
+		  if (ACE_OS::strchr("eEgG", conversion) != 0)
+		    spec[spec_length - 1] = conversion;
+		  spec[spec_length] = '\0';
+		  length = ACE_OS::snprintf(text, sizeof text, spec, d);
+		}
+		break;
+	      default:
+		{
+		  bool is_signed = conversion == 'd' || conversion == 'i';
+		  spec[spec_length++] = 'l';
+		  spec[spec_length++] = 'l';
+		  spec[spec_length++] =
+		    ACE_OS::strchr("diuxXoc", conversion) != 0
+		    ? conversion : 'd';
+		  spec[spec_length] = '\0';
+		  if (conversion == 'c')
+		    length = ACE_OS::snprintf(text, sizeof text, "%c",
+					      static_cast<int> (value));
+		  else if (is_signed)
+		    length = ACE_OS::snprintf(text, sizeof text, spec,
+					      static_cast<long long> (value));
+		  else
+		    length = ACE_OS::snprintf(
+		      text, sizeof text, spec,
+		      static_cast<unsigned long long> (value));
+		}
+		break;
+	      }
+	  }
+
+	if (length > 0)
+	  this->put(text, length < (int) sizeof text
+			  ? length
+			  : (int) sizeof text - 1);
+      }
+  }
+
+  /// Parses a width or precision at f: digits, or * for the next
+  /// argument (0 if there is none).
+  static long field(const char *&f, const Record &record, int &arg)
+  {
+    if (*f == '*')
+      {
+	++f;
+	if (arg >= record.nargs)
+	  return 0;
+	return static_cast<long> (
+	  static_cast<ACE_INT64> (record.values[arg++]));
+      }
+    long n = 0;
+    for (; *f >= '0' && *f <= '9'; ++f)
+      n = n * 10 + (*f - '0');
+    return n;
+  }
+
+  void pad(size_t length)
+  {
+    static const char spaces[] = "                ";
+    for (; length > 0; )
+      {
+	size_t n = length < sizeof spaces - 1 ? length : sizeof spaces - 1;
+	this->put(spaces, n);
+	length -= n;
+      }
+  }
+
+  void put(const char *data, size_t length)
+  {
+    if (length_ + length > BUFFER_SIZE)
+      this->flush();
+    if (length > BUFFER_SIZE)
+      length = BUFFER_SIZE;
+    ACE_OS::memcpy(buffer_ + length_, data, length);
+    length_ += length;
+  }
+
+  void flush(void)
+  {
+    if (length_ > 0)
+      ACE::write_n(ACE_STDERR, buffer_, length_);
+    length_ = 0;
+  }
+
+  /// Runs the drain thread, which is not one of the server's own threads
+  /// that ACE_Thread_Manager::instance() waits for.
+  ACE_Thread_Manager thr_mgr_;
+
+  std::atomic<int> threshold_;
+  std::atomic<bool> stop_;
+
+  Per_Thread < Ring > rings_;
+
+  /// Drain thread's output.
+  char buffer_[BUFFER_SIZE];
+  size_t length_;
+};
+
+/// Logs as ACE_DEBUG does, through Binary_Log::instance(): for instance
+/// ECHO_LOG((LM_DEBUG, "(%t) %d bytes\n", length)).
+#define ECHO_LOG(X) Binary_Log::instance()->log X
+
+#endif /* BINARY_LOG_H */
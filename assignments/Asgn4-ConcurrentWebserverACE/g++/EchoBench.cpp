@@ -0,0 +1,905 @@
+// $Id$
+
+/**
+ * @file EchoBench.cpp
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Load generator for the webservers of assignments 3 and 4. It opens N
+ * connections, keeps one request outstanding on each, checks every reply
+ * and reports the throughput and the latency percentiles, as text and
+ * optionally as JSON.
+ *
+ * By default a connection sends its next request as soon as the reply to
+ * the previous one is in (closed loop). With -r requests are issued at a
+ * fixed total rate instead (open loop): a request that finds every
+ * connection busy waits for one, and its latency is counted from the time
+ * it was due, so a server that stalls cannot hide it by slowing the
+ * client down. The requests still unanswered or not even sent when the
+ * run ends are reported as missed, and their latency counts up to the end.
+ *
+ * Replies are checked against what the server is expected to send back:
+ * "Thread id: <N>" followed by the request (ConcurrentWebserver, raw or
+ * -p http), the request alone (ReactiveWebserver's echo mode), or with
+ * -v any, for -p http only, any 200 response (ReactiveWebserver -d).
+ *
+ * To compare the I/O engines, run the same server once with -r epoll and
+ * once with -r uring (built with make io_uring=1), with the same options
+ * otherwise, and load both alike in open loop, e.g.
+ *
+ *   EchoBench -c 64 -d 30 -r 50000 -j uring.json localhost:8080
+ *
+ * at a few rates up to saturation. Compare the percentiles and the missed
+ * requests at each rate, and the syscalls_per_message the admin port of
+ * ConcurrentWebserver reports (-a) after each run.
+ */
+
+#define ACE_NTRACE 1
+#include "ace/Log_Msg.h"
+
+#include "ace/Svc_Handler.h"
+#include "ace/Connector.h"
+#include "ace/SOCK_Connector.h"
+#include "ace/SOCK_Stream.h"
+#include "ace/INET_Addr.h"
+#include "ace/Reactor.h"
+#include "ace/Containers_T.h"
+#include "ace/High_Res_Timer.h"
+#include "ace/Get_Opt.h"
+#include "ace/OS_NS_stdio.h"
+#include "ace/OS_NS_stdlib.h"
+#include "ace/OS_NS_string.h"
+#include "ace/OS_NS_strings.h"
+#include "ace/OS_NS_ctype.h"
+#include "ace/OS_NS_errno.h"
+#include "ace/os_include/netinet/os_tcp.h"
+
+#include "Latency_Histogram.h"
+
+
+/**
+ * @struct Bench_Options
+ * @brief Command line of the benchmark
+ */
+struct Bench_Options
+{
+  enum Check
+  {
+    /// "Thread id: <N>" followed by the request.
+    THREAD_ID,
+
+    /// The request alone.
+    ECHO,
+
+    /// Any 200 response (-p http only).
+    ANY
+  };
+
+  Bench_Options();
+
+  int parse_args(int argc, ACE_TCHAR *argv[]);
+
+  const ACE_TCHAR *host;
+  u_short port;
+  int connections;
+
+  /// Requests to complete; 0 runs for duration seconds instead.
+  ACE_UINT64 requests;
+  int duration;
+
+  /// Requests per second over all connections; 0 is a closed loop.
+  double rate;
+
+  /// Size of a raw request, newline included.
+  size_t payload;
+
+  bool http;
+  const char *target;
+  Check check;
+
+  /// File the JSON report is written to ("-" for stdout), or 0.
+  const ACE_TCHAR *json;
+};
+
+
+class Echo_Bench;
+
+/**
+ * @class Bench_Handler
+ * @brief One client connection, with at most one request outstanding
+ */
+class Bench_Handler : public ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >
+{
+public:
+  typedef ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH > super;
+
+  enum
+  {
+    /// Room for a response header or the thread-id banner.
+    HEADER_ROOM = 1024
+  };
+
+  Bench_Handler(Echo_Bench *bench = 0, int id = 0);
+
+  virtual ~Bench_Handler();
+
+  virtual int open(void *connector = 0);
+
+  virtual int handle_input(ACE_HANDLE = ACE_INVALID_HANDLE);
+
+  virtual int handle_close(ACE_HANDLE = ACE_INVALID_HANDLE,
+			   ACE_Reactor_Mask = ACE_Event_Handler::ALL_EVENTS_MASK);
+
+  /// Sends the next request, whose latency counts from start (usecs).
+  /// A connection that fails here is closed by the reactor once it reports
+  /// the socket readable.
+  int send_request(ACE_UINT64 start);
+
+  int id(void) const
+  {
+    return id_;
+  }
+
+  /// True while a request is outstanding, which started at start().
+  bool waiting(void) const
+  {
+    return waiting_;
+  }
+
+  ACE_UINT64 start(void) const
+  {
+    return start_;
+  }
+
+private:
+  /// Returns 1 when the reply is complete and correct, 0 while more is
+  /// expected, or -1 if it is wrong.
+  int check_reply(void);
+
+  /// Checks the first length bytes of an echo: the thread-id banner if
+  /// expected, then the request. Returns like check_reply().
+  int check_echo(const char *data, size_t length) const;
+
+  Echo_Bench *bench_;
+  int id_;
+  ACE_UINT64 sequence_;
+
+  /// When the request outstanding started (usecs), if waiting_.
+  ACE_UINT64 start_;
+  bool waiting_;
+
+  char *request_;
+  size_t request_length_;
+
+  char *reply_;
+  size_t reply_capacity_;
+  size_t reply_length_;
+
+  /// Where the body of an HTTP reply starts in reply_, once its header is
+  /// in, and how many of its bytes are still to come with -v any.
+  size_t body_offset_;
+  size_t body_length_;
+};
+
+typedef ACE_Connector < Bench_Handler, ACE_SOCK_CONNECTOR > Bench_Connector;
+
+
+/**
+ * @class Echo_Bench
+ * @brief Hands requests to the connections and gathers the results
+ *
+ * Runs in the thread of the reactor, like the handlers, so it needs no
+ * locking. Its timer issues the open-loop requests that are due and ends
+ * a timed run.
+ */
+class Echo_Bench : public ACE_Event_Handler
+{
+public:
+  Echo_Bench(const Bench_Options &options);
+
+  virtual ~Echo_Bench();
+
+  /// Opens every connection; returns how many are up.
+  int connect(ACE_Reactor *reactor, const ACE_INET_Addr &addr);
+
+  /// Starts the clock and the first requests.
+  void start(void);
+
+  /// Closes the connections still open.
+  void disconnect(void);
+
+  void report(void) const;
+
+  const Bench_Options &options(void) const
+  {
+    return options_;
+  }
+
+  // = Called by the handlers.
+  void opened(Bench_Handler *handler);
+  void closed(Bench_Handler *handler, bool waiting);
+  void completed(Bench_Handler *handler, ACE_UINT64 start);
+  void failed(void);
+
+  virtual int handle_timeout(const ACE_Time_Value &, const void *act);
+
+  /// Microseconds from the high-resolution clock.
+  static ACE_UINT64 now(void);
+
+private:
+  /// Gives handler its next request, or parks it until one is due.
+  void next(Bench_Handler *handler);
+
+  /// Issues an open-loop request due at due (usecs).
+  void issue(ACE_UINT64 due);
+
+  /// Open loop: how many requests are due by time (usecs), and when the
+  /// request i is due.
+  ACE_UINT64 due_count(ACE_UINT64 time) const;
+  ACE_UINT64 due_time(ACE_UINT64 i) const;
+
+  /// Open loop: records the requests outstanding at the end as missed,
+  /// their latency counting up to the end.
+  void miss_outstanding(void);
+
+  void finished(void);
+  void stop(void);
+
+  void print_json(FILE *out) const;
+
+  const Bench_Options &options_;
+  ACE_Reactor *reactor_;
+
+  /// Open connections by id, 0 once closed.
+  ACE_Array < Bench_Handler * > handlers_;
+  int open_;
+
+  /// Ids of open-loop connections without a request.
+  ACE_Unbounded_Queue < int > idle_;
+
+  /// Start times of open-loop requests waiting for a connection.
+  ACE_Unbounded_Queue < ACE_UINT64 > backlog_;
+
+  ACE_UINT64 issued_;
+  ACE_UINT64 completed_;
+  ACE_UINT64 errors_;
+  ACE_UINT64 missed_;
+
+  ACE_UINT64 start_;
+  ACE_UINT64 end_;
+  bool stopped_;
+
+  Latency_Histogram latency_;
+};
+
+
+Bench_Options::Bench_Options()
+  : host(ACE_TEXT("localhost")),
+    port(ACE_DEFAULT_SERVER_PORT),
+    connections(8),
+    requests(0),
+    duration(10),
+    rate(0),
+    payload(64),
+    http(false),
+    target("/"),
+    check(THREAD_ID),
+    json(0)
+{
+}
+
+int Bench_Options::parse_args(int argc, ACE_TCHAR *argv[])
+{
+  ACE_Get_Opt get_opt(argc, argv, ACE_TEXT("c:n:d:r:b:p:u:v:j:"));
+
+  for (int c; (c = get_opt()) != -1; )
+    switch (c)
+      {
+      case 'c':
+	connections = ACE_OS::atoi(get_opt.opt_arg());
+	break;
+      case 'n':
+	requests = ACE_OS::strtoull(get_opt.opt_arg(), 0, 10);
+	break;
+      case 'd':
+	duration = ACE_OS::atoi(get_opt.opt_arg());
+	break;
+      case 'r':
+	rate = ACE_OS::strtod(get_opt.opt_arg(), 0);
+	break;
+      case 'b':
+	payload = ACE_OS::atoi(get_opt.opt_arg());
+	break;
+      case 'p':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("http")) == 0)
+	  http = true;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("raw")) == 0)
+	  http = false;
+	else
+	  return -1;
+	break;
+      case 'u':
+	target = get_opt.opt_arg();
+	break;
+      case 'v':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("thread")) == 0)
+	  check = THREAD_ID;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("echo")) == 0)
+	  check = ECHO;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("any")) == 0)
+	  check = ANY;
+	else
+	  return -1;
+	break;
+      case 'j':
+	json = get_opt.opt_arg();
+	break;
+      default:
+	return -1;
+      }
+
+  // [host:]port
+  if (get_opt.opt_ind() < argc)
+    {
+      ACE_TCHAR *address = argv[get_opt.opt_ind()];
+      ACE_TCHAR *colon = ACE_OS::strrchr(address, ACE_TEXT(':'));
+      if (colon != 0)
+	{
+	  *colon = 0;
+	  host = address;
+	  address = colon + 1;
+	}
+      port = static_cast<u_short> (ACE_OS::atoi(address));
+    }
+
+  if (connections < 1 || rate < 0 || (requests == 0 && duration < 1)
+      || (check == ANY && !http))
+    return -1;
+  return 0;
+}
+
+
+Bench_Handler::Bench_Handler(Echo_Bench *bench, int id)
+  : bench_(bench),
+    id_(id),
+    sequence_(0),
+    start_(0),
+    waiting_(false),
+    request_(0),
+    request_length_(0),
+    reply_(0),
+    reply_capacity_(0),
+    reply_length_(0),
+    body_offset_(0),
+    body_length_(0)
+{
+}
+
+Bench_Handler::~Bench_Handler()
+{
+  delete [] request_;
+  delete [] reply_;
+}
+
+int Bench_Handler::open(void *connector)
+{
+  const Bench_Options &options = bench_->options();
+
+  // An HTTP request is its header, whatever the payload size
+  size_t request_size = options.http
+    ? ACE_OS::strlen(options.target) + 128
+    : options.payload;
+  if (request_size < 64)
+    request_size = 64;
+  reply_capacity_ = HEADER_ROOM + request_size;
+  ACE_NEW_RETURN(request_, char[request_size], -1);
+  ACE_NEW_RETURN(reply_, char[reply_capacity_], -1);
+
+  // Requests are small and each waits for its reply: send them at once
+  int nodelay = 1;
+  this->peer().set_option(ACE_IPPROTO_TCP,
+			  TCP_NODELAY,
+			  &nodelay,
+			  sizeof nodelay);
+
+  if (super::open(connector) == -1)
+    return -1;
+  bench_->opened(this);
+  return 0;
+}
+
+int Bench_Handler::send_request(ACE_UINT64 start)
+{
+  const Bench_Options &options = bench_->options();
+
+  // Every request is unique, so a reply cannot be mistaken for another's
+  ++sequence_;
+  if (options.http)
+    request_length_ =
+      ACE_OS::sprintf(request_,
+		      "GET %s HTTP/1.1\r\n"
+		      "Host: localhost\r\n"
+		      "X-Request: %d:%lu\r\n"
+		      "\r\n",
+		      options.target,
+		      id_,
+		      (unsigned long) sequence_);
+  else
+    {
+      // id:sequence: padded to the payload size, and ended by a newline
+      // as the reactive server echoes lines
+      size_t length = ACE_OS::sprintf(request_,
+				      "%d:%lu:",
+				      id_,
+				      (unsigned long) sequence_);
+      request_length_ = length < options.payload ? options.payload : length + 1;
+      ACE_OS::memset(request_ + length, 'x', request_length_ - length - 1);
+      request_[request_length_ - 1] = '\n';
+    }
+
+  start_ = start;
+  waiting_ = true;
+  reply_length_ = 0;
+  body_offset_ = 0;
+  if (this->peer().send_n(request_, request_length_) != (ssize_t) request_length_)
+    {
+      ACE_ERROR((LM_ERROR, "(%t) connection %d: %p\n", id_, "send"));
+      waiting_ = false;
+      bench_->failed();
+      return -1;
+    }
+  return 0;
+}
+
+int Bench_Handler::handle_input(ACE_HANDLE)
+{
+  ssize_t recv_cnt = this->peer().recv(reply_ + reply_length_,
+				       reply_capacity_ - reply_length_);
+  if (recv_cnt <= 0)
+    return -1;
+  if (!waiting_)
+    ACE_ERROR_RETURN((LM_ERROR,
+		      "(%t) connection %d: unexpected data\n",
+		      id_),
+		     -1);
+
+  reply_length_ += recv_cnt;
+  switch (this->check_reply())
+    {
+    case 1:
+      waiting_ = false;
+      bench_->completed(this, start_);
+      return 0;
+    case 0:
+      if (reply_length_ < reply_capacity_)
+	return 0;
+      // The reply does not fit: it cannot be the one expected
+    default:
+      ACE_ERROR((LM_ERROR,
+		 "(%t) connection %d: wrong reply: %.*s\n",
+		 id_,
+		 (int) (reply_length_ < 80 ? reply_length_ : 80),
+		 reply_));
+      waiting_ = false;
+      bench_->failed();
+      return -1;
+    }
+}
+
+int Bench_Handler::handle_close(ACE_HANDLE handle, ACE_Reactor_Mask mask)
+{
+  bench_->closed(this, waiting_);
+  return super::handle_close(handle, mask);
+}
+
+int Bench_Handler::check_reply(void)
+{
+  if (!bench_->options().http)
+    return this->check_echo(reply_, reply_length_);
+
+  if (body_offset_ == 0)
+    {
+      const char *end = 0;
+      for (size_t i = 3; i < reply_length_ && end == 0; ++i)
+	if (ACE_OS::memcmp(reply_ + i - 3, "\r\n\r\n", 4) == 0)
+	  end = reply_ + i + 1;
+      if (end == 0)
+	return reply_length_ < HEADER_ROOM ? 0 : -1;
+
+      if (ACE_OS::strncmp(reply_, "HTTP/1.", 7) != 0
+	  || ACE_OS::strncmp(reply_ + 8, " 200 ", 5) != 0)
+	return -1;
+
+      // Content-Length is the only framing the servers use
+      const char *field = 0;
+      for (const char *p = reply_; p + 16 < end && field == 0; ++p)
+	if (*p == '\n'
+	    && ACE_OS::strncasecmp(p + 1, "Content-Length:", 15) == 0)
+	  field = p + 16;
+      if (field == 0)
+	return -1;
+      body_offset_ = end - reply_;
+      body_length_ = ACE_OS::strtoul(field, 0, 10);
+    }
+
+  size_t received = reply_length_ - body_offset_;
+  if (bench_->options().check == Bench_Options::ANY)
+    {
+      // The body only needs counting: its bytes are dropped as they come
+      if (received > body_length_)
+	return -1;
+      body_length_ -= received;
+      reply_length_ = body_offset_;
+      return body_length_ == 0 ? 1 : 0;
+    }
+
+  if (received < body_length_)
+    return 0;
+  if (received > body_length_)
+    return -1;
+  return this->check_echo(reply_ + body_offset_, body_length_) == 1 ? 1 : -1;
+}
+
+int Bench_Handler::check_echo(const char *data, size_t length) const
+{
+  size_t offset = 0;
+  if (bench_->options().check == Bench_Options::THREAD_ID)
+    {
+      static const char banner[] = "Thread id: <";
+      size_t banner_length = sizeof banner - 1;
+      if (ACE_OS::memcmp(data,
+			 banner,
+			 length < banner_length ? length : banner_length) != 0)
+	return -1;
+      if (length <= banner_length)
+	return 0;
+
+      const char *end = data + length;
+      const char *digit = data + banner_length;
+      while (digit < end && ACE_OS::ace_isdigit(*digit))
+	++digit;
+      if (digit == end)
+	return digit - data - banner_length < 24 ? 0 : -1;
+      if (*digit != '>' || digit == data + banner_length)
+	return -1;
+      offset = digit + 1 - data;
+    }
+
+  size_t echoed = length - offset;
+  if (echoed > request_length_
+      || ACE_OS::memcmp(data + offset, request_, echoed) != 0)
+    return -1;
+  return echoed == request_length_ ? 1 : 0;
+}
+
+
+Echo_Bench::Echo_Bench(const Bench_Options &options)
+  : options_(options),
+    reactor_(0),
+    handlers_(options.connections),
+    open_(0),
+    issued_(0),
+    completed_(0),
+    errors_(0),
+    missed_(0),
+    start_(0),
+    end_(0),
+    stopped_(false)
+{
+  for (int i = 0; i < options.connections; ++i)
+    handlers_[i] = 0;
+}
+
+Echo_Bench::~Echo_Bench()
+{
+  this->disconnect();
+}
+
+int Echo_Bench::connect(ACE_Reactor *reactor, const ACE_INET_Addr &addr)
+{
+  reactor_ = reactor;
+
+  Bench_Connector connector(reactor);
+  for (int i = 0; i < options_.connections; ++i)
+    {
+      Bench_Handler *handler = 0;
+      ACE_NEW_RETURN(handler, Bench_Handler(this, i), open_);
+
+      // On failure the connector closes the handler
+      if (connector.connect(handler, addr) == -1)
+	ACE_ERROR_RETURN((LM_ERROR,
+			  "(%t) connection %d: %p\n",
+			  i,
+			  "connect"),
+			 open_);
+    }
+  return open_;
+}
+
+void Echo_Bench::start(void)
+{
+  start_ = now();
+
+  // A timed run ends at its deadline; the open loop also ticks every
+  // millisecond to issue the requests that are due
+  if (options_.requests == 0)
+    reactor_->schedule_timer(this, this, ACE_Time_Value(options_.duration));
+  if (options_.rate > 0)
+    {
+      ACE_Time_Value tick(0, 1000);
+      reactor_->schedule_timer(this, 0, tick, tick);
+    }
+
+  for (size_t i = 0; i < handlers_.size(); ++i)
+    if (handlers_[i] != 0)
+      this->next(handlers_[i]);
+}
+
+void Echo_Bench::disconnect(void)
+{
+  for (size_t i = 0; i < handlers_.size(); ++i)
+    if (handlers_[i] != 0)
+      handlers_[i]->close();
+}
+
+void Echo_Bench::opened(Bench_Handler *handler)
+{
+  handlers_[handler->id()] = handler;
+  ++open_;
+}
+
+void Echo_Bench::closed(Bench_Handler *handler, bool waiting)
+{
+  // The connector closes the handlers it failed to connect
+  if (handlers_[handler->id()] != handler)
+    return;
+  handlers_[handler->id()] = 0;
+  --open_;
+
+  if (stopped_)
+    return;
+  if (waiting)
+    {
+      ACE_ERROR((LM_ERROR,
+		 "(%t) connection %d closed by the server\n",
+		 handler->id()));
+      ++errors_;
+    }
+  if (open_ == 0)
+    this->stop();
+  else
+    this->finished();
+}
+
+void Echo_Bench::completed(Bench_Handler *handler, ACE_UINT64 start)
+{
+  if (stopped_)
+    return;
+  latency_.record(now() - start);
+  ++completed_;
+  this->finished();
+  if (!stopped_)
+    this->next(handler);
+}
+
+void Echo_Bench::failed(void)
+{
+  if (stopped_)
+    return;
+  ++errors_;
+  this->finished();
+}
+
+void Echo_Bench::finished(void)
+{
+  if (options_.requests != 0 && completed_ + errors_ >= options_.requests)
+    this->stop();
+}
+
+void Echo_Bench::next(Bench_Handler *handler)
+{
+  ACE_UINT64 due = 0;
+  if (options_.rate > 0)
+    {
+      if (backlog_.dequeue_head(due) == -1)
+	{
+	  idle_.enqueue_tail(handler->id());
+	  return;
+	}
+    }
+  else if (options_.requests != 0 && issued_ >= options_.requests)
+    return;
+  else
+    due = now();
+
+  ++issued_;
+  handler->send_request(due);
+}
+
+void Echo_Bench::issue(ACE_UINT64 due)
+{
+  for (int id; idle_.dequeue_head(id) == 0; )
+    if (handlers_[id] != 0)
+      {
+	++issued_;
+	handlers_[id]->send_request(due);
+	return;
+      }
+  backlog_.enqueue_tail(due);
+}
+
+int Echo_Bench::handle_timeout(const ACE_Time_Value &, const void *act)
+{
+  if (act == this)
+    {
+      this->stop();
+      return 0;
+    }
+
+  ACE_UINT64 due = this->due_count(now());
+  for (ACE_UINT64 i = issued_ + backlog_.size(); i < due && !stopped_; ++i)
+    this->issue(this->due_time(i));
+  return 0;
+}
+
+ACE_UINT64 Echo_Bench::due_count(ACE_UINT64 time) const
+{
+  // At 1/rate second intervals from the start
+  ACE_UINT64 due =
+    static_cast<ACE_UINT64> ((time - start_) * options_.rate / 1000000.0);
+  if (options_.requests != 0 && due > options_.requests)
+    due = options_.requests;
+  return due;
+}
+
+ACE_UINT64 Echo_Bench::due_time(ACE_UINT64 i) const
+{
+  return start_ + static_cast<ACE_UINT64> (i * 1000000.0 / options_.rate);
+}
+
+void Echo_Bench::miss_outstanding(void)
+{
+  // Those due since the last tick were never issued
+  ACE_UINT64 due = this->due_count(end_);
+  for (ACE_UINT64 i = issued_ + backlog_.size(); i < due; ++i)
+    {
+      latency_.record(end_ - this->due_time(i));
+      ++missed_;
+    }
+
+  for (ACE_UINT64 start; backlog_.dequeue_head(start) == 0; )
+    {
+      latency_.record(end_ - start);
+      ++missed_;
+    }
+
+  for (size_t i = 0; i < handlers_.size(); ++i)
+    if (handlers_[i] != 0 && handlers_[i]->waiting())
+      {
+	latency_.record(end_ - handlers_[i]->start());
+	++missed_;
+      }
+}
+
+void Echo_Bench::stop(void)
+{
+  if (stopped_)
+    return;
+  end_ = now();
+  stopped_ = true;
+  reactor_->cancel_timer(this);
+  reactor_->end_reactor_event_loop();
+  if (options_.rate > 0)
+    this->miss_outstanding();
+}
+
+ACE_UINT64 Echo_Bench::now(void)
+{
+  ACE_UINT64 usecs;
+  ACE_High_Res_Timer::gettimeofday_hr().to_usec(usecs);
+  return usecs;
+}
+
+static const double PERCENTILES[] = { 50, 75, 90, 99, 99.9, 99.99 };
+static const int N_PERCENTILES = sizeof PERCENTILES / sizeof PERCENTILES[0];
+
+void Echo_Bench::report(void) const
+{
+  double seconds = (end_ - start_) / 1000000.0;
+
+  ACE_OS::printf("%d connections, %s, %s requests",
+		 options_.connections,
+		 options_.rate > 0 ? "open loop" : "closed loop",
+		 options_.http ? "http" : "raw");
+  if (options_.rate > 0)
+    ACE_OS::printf(" at %.1f/s", options_.rate);
+  ACE_OS::printf("\n%lu completed, %lu errors, %lu missed in %.3f s:"
+		 " %.1f requests/s\n",
+		 (unsigned long) completed_,
+		 (unsigned long) errors_,
+		 (unsigned long) missed_,
+		 seconds,
+		 seconds > 0 ? completed_ / seconds : 0.0);
+  ACE_OS::printf("latency (usecs): min %lu, mean %.1f, max %lu\n",
+		 (unsigned long) latency_.min(),
+		 latency_.mean(),
+		 (unsigned long) latency_.max());
+  for (int i = 0; i < N_PERCENTILES; ++i)
+    ACE_OS::printf("%10.2f%% %10lu\n",
+		   PERCENTILES[i],
+		   (unsigned long) latency_.percentile(PERCENTILES[i]));
+
+  if (options_.json == 0)
+    return;
+  if (ACE_OS::strcmp(options_.json, ACE_TEXT("-")) == 0)
+    this->print_json(stdout);
+  else
+    {
+      FILE *out = ACE_OS::fopen(options_.json, ACE_TEXT("w"));
+      if (out == 0)
+	ACE_ERROR((LM_ERROR, "%p\n", options_.json));
+      else
+	{
+	  this->print_json(out);
+	  ACE_OS::fclose(out);
+	}
+    }
+}
+
+void Echo_Bench::print_json(FILE *out) const
+{
+  double seconds = (end_ - start_) / 1000000.0;
+
+  ACE_OS::fprintf(out,
+		  "{\"connections\": %d, \"protocol\": \"%s\", \"rate\": %.1f,"
+		  " \"completed\": %lu, \"errors\": %lu, \"missed\": %lu,"
+		  " \"seconds\": %.3f, \"throughput\": %.1f,"
+		  " \"latency_usecs\": {\"min\": %lu, \"mean\": %.1f, \"max\": %lu",
+		  options_.connections,
+		  options_.http ? "http" : "raw",
+		  options_.rate,
+		  (unsigned long) completed_,
+		  (unsigned long) errors_,
+		  (unsigned long) missed_,
+		  seconds,
+		  seconds > 0 ? completed_ / seconds : 0.0,
+		  (unsigned long) latency_.min(),
+		  latency_.mean(),
+		  (unsigned long) latency_.max());
+  for (int i = 0; i < N_PERCENTILES; ++i)
+    ACE_OS::fprintf(out,
+		    ", \"p%g\": %lu",
+		    PERCENTILES[i],
+		    (unsigned long) latency_.percentile(PERCENTILES[i]));
+  ACE_OS::fprintf(out, "}}\n");
+}
+
+
+int ACE_TMAIN(int argc, ACE_TCHAR *argv[])
+{
+  Bench_Options options;
+  if (options.parse_args(argc, argv) == -1)
+    ACE_ERROR_RETURN((LM_ERROR,
+		      ACE_TEXT("Usage: %s [-c connections] [-n requests | -d seconds]")
+		      ACE_TEXT(" [-r requests-per-second] [-b payload-bytes]")
+		      ACE_TEXT(" [-p raw|http] [-u target] [-v thread|echo|any]")
+		      ACE_TEXT(" [-j json-file] [[host:]port]\n"),
+		      argv[0]),
+		     1);
+
+  ACE_INET_Addr addr;
+  if (addr.set(options.port, options.host) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "%p\n", options.host), 1);
+
+  ACE_Reactor *reactor = ACE_Reactor::instance();
+  Echo_Bench bench(options);
+  if (bench.connect(reactor, addr) < options.connections)
+    return 1;
+
+  bench.start();
+  reactor->run_reactor_event_loop();
+  bench.report();
+  return 0;
+}
@@ -0,0 +1,286 @@
+// $Id$
+
+/**
+ * @file HTTP_Parser.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Resumable, allocation-free parser of HTTP/1.x requests.
+ */
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include "ace/OS_NS_string.h"
+#include "ace/OS_NS_strings.h"
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define HTTP_PARSER_HAS_SSE2
+# if defined (_MSC_VER)
+#  include <intrin.h>
+# endif /* _MSC_VER */
+#endif /* SSE2 */
+
+/**
+ * @struct HTTP_Request
+ * @brief What HTTP_Parser extracts from a request
+ *
+ * Positions are offsets from the start of the request, so they stay valid
+ * when the request bytes are moved.
+ */
+struct HTTP_Request
+{
+  size_t method_length;
+  size_t target_offset;
+  size_t target_length;
+
+  /// 0 for HTTP/1.0, 1 for HTTP/1.1.
+  int minor_version;
+
+  /// Whether the connection stays open after the response.
+  bool keep_alive;
+
+  /// Bytes up to and including the empty line ending the header.
+  size_t header_length;
+
+  /// Header plus Content-Length bytes of body.
+  size_t length;
+};
+
+
+/**
+ * @class HTTP_Parser
+ * @brief Finds and parses one request at a time in a buffer filled by reads
+ *
+ * parse() is called with the bytes received so far of the current request,
+ * after each read. It resumes the search for the end of the header where
+ * the previous call stopped, so every byte is scanned once however the
+ * request is split into reads; with SSE2 the scan compares 16 bytes at a
+ * time. Once the header is complete it is parsed in place, and parse()
+ * reports COMPLETE as soon as the body (Content-Length) is in too. Nothing
+ * is allocated or copied.
+ *
+ * next() moves on to the request that follows, as pipelining clients send
+ * several requests without waiting for the responses.
+ */
+class HTTP_Parser
+{
+public:
+  enum Result
+  {
+    INCOMPLETE,
+    COMPLETE,
+
+    /// Malformed, or using a feature not supported (chunked bodies).
+    INVALID
+  };
+
+  HTTP_Parser()
+  {
+    this->next();
+  }
+
+  /// Parses the request at the start of the n bytes at data. data must
+  /// start with the same request on every call until next().
+  Result parse(const char *data, size_t n)
+  {
+    if (request_.header_length == 0)
+      {
+	const char *end = this->find_header_end(data, n);
+	if (end == 0)
+	  return INCOMPLETE;
+	request_.header_length = end - data;
+	if (this->parse_header(data) == -1)
+	  return INVALID;
+      }
+    return n >= request_.length ? COMPLETE : INCOMPLETE;
+  }
+
+  /// The request parse() reported COMPLETE (or the header of the one it
+  /// reported INCOMPLETE once header_length is set).
+  const HTTP_Request &request(void) const
+  {
+    return request_;
+  }
+
+  /// Starts on the next request.
+  void next(void)
+  {
+    ACE_OS::memset(&request_, 0, sizeof request_);
+    scanned_ = 0;
+  }
+
+private:
+  /// Whether the '\n' at data[i] ends the header: an empty line, ended by
+  /// "\r\n" or by a bare '\n'.
+  static bool ends_header(const char *data, size_t i)
+  {
+    return (i >= 1 && data[i - 1] == '\n')
+      || (i >= 2 && data[i - 1] == '\r' && data[i - 2] == '\n');
+  }
+
+#if defined (HTTP_PARSER_HAS_SSE2)
+  static int lowest_bit(unsigned int mask)
+  {
+# if defined (_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int> (index);
+# else
+    return __builtin_ctz(mask);
+# endif /* _MSC_VER */
+  }
+#endif /* HTTP_PARSER_HAS_SSE2 */
+
+  /// Returns the end of the header in [data, data + n), or 0. The bytes
+  /// before scanned_ have already been searched.
+  const char *find_header_end(const char *data, size_t n)
+  {
+    size_t i = scanned_;
+
+#if defined (HTTP_PARSER_HAS_SSE2)
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16)
+      {
+	__m128i chunk =
+	  _mm_loadu_si128(reinterpret_cast<const __m128i *> (data + i));
+	unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+	for (; mask != 0; mask &= mask - 1)
+	  {
+	    size_t at = i + lowest_bit(mask);
+	    if (ends_header(data, at))
+	      return data + at + 1;
+	  }
+      }
+#endif /* HTTP_PARSER_HAS_SSE2 */
+
+    for (; i < n; ++i)
+      if (data[i] == '\n' && ends_header(data, i))
+	return data + i + 1;
+
+    scanned_ = n;
+    return 0;
+  }
+
+  /// Returns the end of the line starting at p (its '\n'), trimming the
+  /// '\r' before it off the line through line_end.
+  static const char *line(const char *p, const char *end,
+			  const char *&line_end)
+  {
+    const char *lf =
+      static_cast<const char *> (ACE_OS::memchr(p, '\n', end - p));
+    line_end = lf > p && lf[-1] == '\r' ? lf - 1 : lf;
+    return lf;
+  }
+
+  /// Whether the comma-separated list [p, end) contains token.
+  static bool has_token(const char *p, const char *end, const char *token)
+  {
+    size_t length = ACE_OS::strlen(token);
+    while (p < end)
+      {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+	  ++p;
+	const char *q = p;
+	while (q < end && *q != ',' && *q != ' ' && *q != '\t')
+	  ++q;
+	if (static_cast<size_t> (q - p) == length
+	    && ACE_OS::strncasecmp(p, token, length) == 0)
+	  return true;
+	p = q;
+      }
+    return false;
+  }
+
+  /// Parses the request line and the header fields the server uses.
+  int parse_header(const char *data)
+  {
+    const char *end = data + request_.header_length;
+    const char *line_end = 0;
+    const char *lf = line(data, end, line_end);
+
+    // method SP request-target SP HTTP/1.x
+    const char *sp1 =
+      static_cast<const char *> (ACE_OS::memchr(data, ' ', line_end - data));
+    if (sp1 == 0 || sp1 == data)
+      return -1;
+    const char *target = sp1 + 1;
+    const char *sp2 =
+      static_cast<const char *> (ACE_OS::memchr(target, ' ', line_end - target));
+    if (sp2 == 0 || sp2 == target
+	|| line_end - sp2 != 9
+	|| ACE_OS::strncmp(sp2 + 1, "HTTP/1.", 7) != 0
+	|| (sp2[8] != '0' && sp2[8] != '1'))
+      return -1;
+
+    request_.method_length = sp1 - data;
+    request_.target_offset = target - data;
+    request_.target_length = sp2 - target;
+    request_.minor_version = sp2[8] - '0';
+    request_.keep_alive = request_.minor_version >= 1;
+
+    size_t content_length = 0;
+    bool has_length = false;
+    for (const char *p = lf + 1; p < end; p = lf + 1)
+      {
+	lf = line(p, end, line_end);
+	if (line_end == p)
+	  break;
+
+	const char *colon =
+	  static_cast<const char *> (ACE_OS::memchr(p, ':', line_end - p));
+	if (colon == 0)
+	  return -1;
+	size_t name_length = colon - p;
+	const char *value = colon + 1;
+	while (value < line_end && (*value == ' ' || *value == '\t'))
+	  ++value;
+
+	if (name_length == 10 && ACE_OS::strncasecmp(p, "Connection", 10) == 0)
+	  {
+	    if (has_token(value, line_end, "close"))
+	      request_.keep_alive = false;
+	    else if (has_token(value, line_end, "keep-alive"))
+	      request_.keep_alive = true;
+	  }
+	else if (name_length == 14
+		 && ACE_OS::strncasecmp(p, "Content-Length", 14) == 0)
+	  {
+	    if (value == line_end)
+	      return -1;
+	    size_t length = 0;
+	    for (; value < line_end && *value >= '0' && *value <= '9'; ++value)
+	      {
+		length = length * 10 + (*value - '0');
+		if (length > 0x7fffffff)
+		  return -1;
+	      }
+	    if (value != line_end && *value != ' ' && *value != '\t')
+	      return -1;
+
+	    // Two different lengths leave the end of the body, and so the
+	    // start of the next pipelined request, in doubt (RFC 9112, 6.3)
+	    if (has_length && length != content_length)
+	      return -1;
+	    content_length = length;
+	    has_length = true;
+	  }
+	else if (name_length == 17
+		 && ACE_OS::strncasecmp(p, "Transfer-Encoding", 17) == 0)
+	  return -1;
+      }
+
+    request_.length = request_.header_length + content_length;
+    return 0;
+  }
+
+  HTTP_Request request_;
+
+  /// Bytes of the current request already searched for the header end.
+  size_t scanned_;
+};
+
+#endif /* HTTP_PARSER_H */
@@ -0,0 +1,193 @@
+// $Id$
+
+/**
+ * @file Latency_Histogram.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Fixed-size log-linear histogram of latencies, for percentiles.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include "ace/Basic_Types.h"
+
+#include <atomic>
+
+/**
+ * @class Latency_Histogram
+ * @brief Records values in buckets whose width grows with the value
+ *
+ * Every power of two is split into SUB_BUCKETS equal buckets (as in an HDR
+ * histogram), so a value is counted with a relative error below 1/32
+ * whatever its magnitude, and recording is a few shifts and an increment.
+ * The unit is the caller's.
+ *
+ * One thread records into a histogram, while any other may read it or
+ * merge it into its own. The counters are atomics that the recording
+ * thread updates with relaxed loads and stores, which compile to plain
+ * moves on common hardware: recording costs no more than with ordinary
+ * integers, and a reader never sees a torn count.
+ */
+class Latency_Histogram
+{
+public:
+  enum
+  {
+    SUB_BUCKET_BITS = 5,
+    SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+
+    /// Enough buckets for any 64-bit value.
+    BUCKETS = SUB_BUCKETS * (64 - SUB_BUCKET_BITS + 1)
+  };
+
+  Latency_Histogram()
+  {
+    this->reset();
+  }
+
+  /// Only called by the thread that owns the histogram.
+  void record(ACE_UINT64 value)
+  {
+    add(counts_[index(value)], 1);
+    add(count_, 1);
+    add(sum_, value);
+    if (value < get(min_))
+      set(min_, value);
+    if (value > get(max_))
+      set(max_, value);
+  }
+
+  /// Adds the values recorded by other, which may be recording meanwhile.
+  void merge(const Latency_Histogram &other)
+  {
+    for (int i = 0; i < BUCKETS; ++i)
+      add(counts_[i], get(other.counts_[i]));
+    add(count_, get(other.count_));
+    add(sum_, get(other.sum_));
+    if (get(other.min_) < get(min_))
+      set(min_, get(other.min_));
+    if (get(other.max_) > get(max_))
+      set(max_, get(other.max_));
+  }
+
+  void reset(void)
+  {
+    for (int i = 0; i < BUCKETS; ++i)
+      set(counts_[i], 0);
+    set(count_, 0);
+    set(sum_, 0);
+    set(min_, ~static_cast<ACE_UINT64> (0));
+    set(max_, 0);
+  }
+
+  ACE_UINT64 count(void) const
+  {
+    return get(count_);
+  }
+
+  ACE_UINT64 min(void) const
+  {
+    return get(count_) == 0 ? 0 : get(min_);
+  }
+
+  ACE_UINT64 max(void) const
+  {
+    return get(max_);
+  }
+
+  double mean(void) const
+  {
+    ACE_UINT64 count = get(count_);
+    return count == 0 ? 0.0 : static_cast<double> (get(sum_)) / count;
+  }
+
+  /// Smallest value that percent of the recorded values do not exceed,
+  /// rounded up to the end of its bucket (never above max()).
+  ACE_UINT64 percentile(double percent) const
+  {
+    ACE_UINT64 count = get(count_);
+    ACE_UINT64 max = get(max_);
+    if (count == 0)
+      return 0;
+    ACE_UINT64 rank = static_cast<ACE_UINT64> (percent / 100.0 * count + 0.5);
+    if (rank < 1)
+      rank = 1;
+    ACE_UINT64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+      {
+	seen += get(counts_[i]);
+	if (seen >= rank)
+	  {
+	    ACE_UINT64 highest = highest_value(i);
+	    return highest < max ? highest : max;
+	  }
+      }
+    return max;
+  }
+
+private:
+  typedef std::atomic<ACE_UINT64> Counter;
+
+  static ACE_UINT64 get(const Counter &counter)
+  {
+    return counter.load(std::memory_order_relaxed);
+  }
+
+  static void set(Counter &counter, ACE_UINT64 value)
+  {
+    counter.store(value, std::memory_order_relaxed);
+  }
+
+  /// Not an atomic read-modify-write: only the owner writes.
+  static void add(Counter &counter, ACE_UINT64 value)
+  {
+    set(counter, get(counter) + value);
+  }
+
+  static int highest_bit(ACE_UINT64 value)
+  {
+#if defined (__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1)
+      ++bit;
+    return bit;
+#endif /* __GNUC__ */
+  }
+
+  /// Values below 2 * SUB_BUCKETS have a bucket each; above that the
+  /// bucket holds 2^shift values.
+  static int index(ACE_UINT64 value)
+  {
+    if (value < 2 * SUB_BUCKETS)
+      return static_cast<int> (value);
+    int shift = highest_bit(value) - SUB_BUCKET_BITS;
+    return SUB_BUCKETS * shift + static_cast<int> (value >> shift);
+  }
+
+  static ACE_UINT64 highest_value(int index)
+  {
+    if (index < 2 * SUB_BUCKETS)
+      return index;
+    int shift = index / SUB_BUCKETS - 1;
+    ACE_UINT64 sub_bucket = index - SUB_BUCKETS * shift;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+  Counter counts_[BUCKETS];
+  Counter count_;
+  Counter sum_;
+  Counter min_;
+  Counter max_;
+
+  // = Disallow copying.
+  Latency_Histogram(const Latency_Histogram &);
+  Latency_Histogram &operator=(const Latency_Histogram &);
+};
+
+#endif /* LATENCY_HISTOGRAM_H */
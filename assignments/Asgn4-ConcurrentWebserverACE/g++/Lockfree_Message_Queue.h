@@ -0,0 +1,425 @@
+// $Id$
+
+/**
+ * @file Lockfree_Message_Queue.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Bounded lock-free multi-producer/multi-consumer request queue that can be
+ * plugged into an ACE_Task in place of its default ACE_Message_Queue.
+ */
+
+#ifndef LOCKFREE_MESSAGE_QUEUE_H
+#define LOCKFREE_MESSAGE_QUEUE_H
+
+#include "ace/Message_Queue_T.h"
+#include "ace/Message_Block.h"
+#include "ace/Time_Value.h"
+#include "ace/OS_NS_sys_time.h"
+#include "ace/OS_NS_errno.h"
+#include "ace/OS_NS_Thread.h"
+#include "ace/Thread_Mutex.h"
+#include "ace/Condition_Thread_Mutex.h"
+#include "ace/Guard_T.h"
+
+#include "Batch_Message_Queue.h"
+
+#include <atomic>
+#include <climits>
+#include <stdint.h>
+
+#if defined (__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <time.h>
+#endif /* __linux__ */
+
+#if !defined (ECHO_CACHE_LINE_SIZE)
+# define ECHO_CACHE_LINE_SIZE 64
+#endif /* ECHO_CACHE_LINE_SIZE */
+
+/**
+ * @class MPMC_Queue
+ * @brief Bounded lock-free multi-producer/multi-consumer queue
+ *
+ * Array-based queue where every cell carries a sequence number telling
+ * producers and consumers whose turn it is (Dmitry Vyukov's design).
+ * Enqueue and dequeue are a single CAS on their own position counter in
+ * the common case; the two counters live on separate cache lines so that
+ * producers and consumers do not false-share. The capacity is rounded up
+ * to a power of two.
+ */
+template <class T>
+class MPMC_Queue
+{
+public:
+  explicit MPMC_Queue(size_t capacity)
+    : mask_(round_up(capacity) - 1),
+      buffer_(new Cell[mask_ + 1])
+  {
+    for (size_t i = 0; i <= mask_; ++i)
+      buffer_[i].sequence_.store(i, std::memory_order_relaxed);
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  ~MPMC_Queue()
+  {
+    delete [] buffer_;
+  }
+
+  /// Returns false if the queue is full.
+  bool enqueue(const T &item)
+  {
+    Cell *cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;)
+      {
+	cell = &buffer_[pos & mask_];
+	size_t seq = cell->sequence_.load(std::memory_order_acquire);
+	intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+	if (dif == 0)
+	  {
+	    if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+						   std::memory_order_relaxed))
+	      break;
+	  }
+	else if (dif < 0)
+	  return false;
+	else
+	  pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+
+    cell->data_ = item;
+    cell->sequence_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Returns false if the queue is empty.
+  bool dequeue(T &item)
+  {
+    Cell *cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;)
+      {
+	cell = &buffer_[pos & mask_];
+	size_t seq = cell->sequence_.load(std::memory_order_acquire);
+	intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+	if (dif == 0)
+	  {
+	    if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+						   std::memory_order_relaxed))
+	      break;
+	  }
+	else if (dif < 0)
+	  return false;
+	else
+	  pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+
+    item = cell->data_;
+    cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Approximate number of queued items (exact when quiescent).
+  size_t size() const
+  {
+    size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  size_t capacity() const
+  {
+    return mask_ + 1;
+  }
+
+private:
+  /// The smallest power of two not below n, or the largest power of two
+  /// a size_t holds if n is above it.
+  static size_t round_up(size_t n)
+  {
+    const size_t top = ~(~static_cast<size_t> (0) >> 1);
+    size_t c = 2;
+    while (c < n && c < top)
+      c <<= 1;
+    return c;
+  }
+
+  struct Cell
+  {
+    std::atomic<size_t> sequence_;
+    T data_;
+  };
+
+  char pad0_[ECHO_CACHE_LINE_SIZE];
+  const size_t mask_;
+  Cell * const buffer_;
+  char pad1_[ECHO_CACHE_LINE_SIZE];
+  std::atomic<size_t> enqueue_pos_;
+  char pad2_[ECHO_CACHE_LINE_SIZE];
+  std::atomic<size_t> dequeue_pos_;
+  char pad3_[ECHO_CACHE_LINE_SIZE];
+
+  // = Disallow copying.
+  MPMC_Queue(const MPMC_Queue &);
+  MPMC_Queue &operator=(const MPMC_Queue &);
+};
+
+
+/**
+ * @class Lockfree_Message_Queue
+ * @brief Drop-in ACE_Message_Queue strategy backed by an MPMC_Queue
+ *
+ * Overrides the enqueue_tail()/dequeue_head() hooks used by
+ * ACE_Task::putq() and ACE_Task::getq(), so an Echo_Task can switch to it
+ * through ACE_Task::msg_queue() without further changes. Only FIFO
+ * operations are supported (no priorities, no enqueue_head()).
+ *
+ * Consumers that find the queue empty spin for a short while and then park
+ * on a futex (a mutex/condition pair where futexes are not available).
+ * Producers only issue a wake-up system call when somebody is parked.
+ * dequeue_batch() waits for the first message in the same way and takes
+ * the others without waiting.
+ */
+class Lockfree_Message_Queue : public Batch_Message_Queue
+{
+public:
+  enum
+  {
+    /// Default number of slots.
+    DEFAULT_CAPACITY = 64 * 1024,
+
+    /// Most slots a queue may be given.
+    MAX_CAPACITY = 1 << 30,
+
+    /// Dequeue attempts made before a consumer parks.
+    SPIN_COUNT = 1000
+  };
+
+  explicit Lockfree_Message_Queue(size_t capacity = DEFAULT_CAPACITY)
+    : queue_(capacity),
+      sleepers_(0),
+      wakeups_(0),
+      shutdown_(false)
+#if !defined (__linux__)
+    , park_cond_(park_lock_)
+#endif /* !__linux__ */
+  {
+  }
+
+  virtual ~Lockfree_Message_Queue()
+  {
+    this->flush();
+  }
+
+  /// Appends new_item; if the queue is full retries until timeout
+  /// (absolute time, 0 waits forever) expires.
+  virtual int enqueue_tail(ACE_Message_Block *new_item,
+			   ACE_Time_Value *timeout = 0)
+  {
+    while (!queue_.enqueue(new_item))
+      {
+	if (shutdown_.load(std::memory_order_acquire))
+	  {
+	    errno = ESHUTDOWN;
+	    return -1;
+	  }
+	if (timeout != 0 && ACE_OS::gettimeofday() >= *timeout)
+	  {
+	    errno = EWOULDBLOCK;
+	    return -1;
+	  }
+	ACE_OS::thr_yield();
+      }
+
+    // Pairs with the fence in park(): either the consumer sees the new
+    // item on its last attempt, or we see it registered as a sleeper.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) > 0)
+      wake(1);
+
+    return static_cast<int> (queue_.size());
+  }
+
+  /// Removes the oldest item, spinning and then parking while the queue is
+  /// empty, until timeout (absolute time, 0 waits forever) expires.
+  virtual int dequeue_head(ACE_Message_Block *&first_item,
+			   ACE_Time_Value *timeout = 0)
+  {
+    for (;;)
+      {
+	for (int i = 0; i < SPIN_COUNT; ++i)
+	  {
+	    if (shutdown_.load(std::memory_order_acquire))
+	      {
+		errno = ESHUTDOWN;
+		return -1;
+	      }
+	    if (queue_.dequeue(first_item))
+	      return static_cast<int> (queue_.size());
+	  }
+
+	int result = park(first_item, timeout);
+	if (result == 0)
+	  return static_cast<int> (queue_.size());
+	if (result == -1)
+	  return -1;
+      }
+  }
+
+  virtual int dequeue_batch(ACE_Message_Block *batch[],
+			    size_t max,
+			    size_t sharers,
+			    ACE_Time_Value *timeout = 0)
+  {
+    if (this->dequeue_head(batch[0], timeout) == -1)
+      return -1;
+
+    size_t n = share(queue_.size() + 1, max, sharers);
+    size_t i = 1;
+    while (i < n && queue_.dequeue(batch[i]))
+      ++i;
+    return static_cast<int> (i);
+  }
+
+  virtual bool is_full(void)
+  {
+    return queue_.size() >= queue_.capacity();
+  }
+
+  virtual bool is_empty(void)
+  {
+    return queue_.size() == 0;
+  }
+
+  virtual size_t message_count(void)
+  {
+    return queue_.size();
+  }
+
+  /// Wakes up all parked consumers; later operations fail with ESHUTDOWN.
+  virtual int deactivate(void)
+  {
+    bool was_shutdown = shutdown_.exchange(true);
+    wake(-1);
+    return was_shutdown ? ACE_Message_Queue_Base::DEACTIVATED
+			: ACE_Message_Queue_Base::ACTIVATED;
+  }
+
+  virtual int activate(void)
+  {
+    bool was_shutdown = shutdown_.exchange(false);
+    return was_shutdown ? ACE_Message_Queue_Base::DEACTIVATED
+			: ACE_Message_Queue_Base::ACTIVATED;
+  }
+
+  virtual int close(void)
+  {
+    this->deactivate();
+    return this->flush();
+  }
+
+  /// Releases every message still queued.
+  virtual int flush(void)
+  {
+    int count = 0;
+    ACE_Message_Block *mb = 0;
+    while (queue_.dequeue(mb))
+      {
+	mb->release();
+	++count;
+      }
+    return count;
+  }
+
+private:
+  /// Registers as a sleeper, makes a last dequeue attempt and blocks.
+  /// Returns 0 with an item, 1 after a wake-up (try again), or -1 with
+  /// errno set to EWOULDBLOCK (timed out) or ESHUTDOWN.
+  int park(ACE_Message_Block *&first_item, ACE_Time_Value *timeout)
+  {
+    sleepers_.fetch_add(1, std::memory_order_relaxed);
+    int seq = wakeups_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    int result = -1;
+    if (queue_.dequeue(first_item))
+      result = 0;
+    else if (shutdown_.load(std::memory_order_acquire))
+      errno = ESHUTDOWN;
+    else if (timeout != 0 && ACE_OS::gettimeofday() >= *timeout)
+      errno = EWOULDBLOCK;
+    else
+      {
+	wait(seq, timeout);
+	result = 1;
+      }
+
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    return result;
+  }
+
+#if defined (__linux__)
+  void wait(int seq, ACE_Time_Value *timeout)
+  {
+    struct timespec ts;
+    struct timespec *pts = 0;
+    if (timeout != 0)
+      {
+	ACE_Time_Value rel = *timeout - ACE_OS::gettimeofday();
+	if (rel < ACE_Time_Value::zero)
+	  rel = ACE_Time_Value::zero;
+	ts = rel;
+	pts = &ts;
+      }
+    ::syscall(SYS_futex, reinterpret_cast<int *> (&wakeups_),
+	      FUTEX_WAIT_PRIVATE, seq, pts, 0, 0);
+  }
+
+  void wake(int count)
+  {
+    wakeups_.fetch_add(1, std::memory_order_release);
+    ::syscall(SYS_futex, reinterpret_cast<int *> (&wakeups_),
+	      FUTEX_WAKE_PRIVATE, count < 0 ? INT_MAX : count, 0, 0, 0);
+  }
+#else
+  void wait(int seq, ACE_Time_Value *timeout)
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, park_lock_);
+    if (wakeups_.load(std::memory_order_acquire) == seq)
+      park_cond_.wait(timeout);
+  }
+
+  void wake(int count)
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, park_lock_);
+    wakeups_.fetch_add(1, std::memory_order_release);
+    if (count < 0)
+      park_cond_.broadcast();
+    else
+      park_cond_.signal();
+  }
+#endif /* __linux__ */
+
+  MPMC_Queue<ACE_Message_Block *> queue_;
+
+  /// Number of consumers parked or about to park.
+  std::atomic<int> sleepers_;
+
+  /// Futex word, bumped on every wake-up.
+  std::atomic<int> wakeups_;
+
+  std::atomic<bool> shutdown_;
+
+#if !defined (__linux__)
+  ACE_Thread_Mutex park_lock_;
+  ACE_Condition_Thread_Mutex park_cond_;
+#endif /* !__linux__ */
+};
+
+#endif /* LOCKFREE_MESSAGE_QUEUE_H */
@@ -0,0 +1,269 @@
+// $Id$
+
+/**
+ * @file Pooled_Allocator.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Fixed-size free-list allocator for the ACE_Message_Block, ACE_Data_Block
+ * and data buffer allocations of the request path.
+ */
+
+#ifndef POOLED_ALLOCATOR_H
+#define POOLED_ALLOCATOR_H
+
+#include "ace/Malloc_Allocator.h"
+#include "ace/Thread_Mutex.h"
+#include "ace/Guard_T.h"
+#include "ace/OS_NS_string.h"
+#include "ace/OS_NS_errno.h"
+
+#include "Per_Thread.h"
+
+/**
+ * @class Pooled_Allocator
+ * @brief ACE_New_Allocator that recycles chunks of one size
+ *
+ * Every chunk handed out is chunk_size bytes, whatever the request (larger
+ * requests fail with ENOMEM), so any freed chunk can serve the next malloc().
+ * Freed chunks are kept for reuse instead of being returned to the heap;
+ * a malloc() that finds none falls back to ACE_New_Allocator. Once the
+ * pool is warm no request touches the heap.
+ *
+ * Every thread keeps up to cache_size freed chunks of its own (Per_Thread),
+ * which it takes and returns without locking. Beyond that it moves half of
+ * them at once to a shared list of up to max_free chunks, under the lock,
+ * and a thread whose cache runs dry takes as many back from there. So the
+ * reactor's thread, which allocates, and the pool threads, which free,
+ * only meet on the lock once every cache_size / 2 chunks.
+ *
+ * Pass it as allocator_strategy, data_block_allocator or
+ * message_block_allocator to ACE_Message_Block; blocks allocated through it
+ * go back to it on release().
+ */
+class Pooled_Allocator : public ACE_New_Allocator
+{
+public:
+  enum
+  {
+    DEFAULT_CACHE_SIZE = 64
+  };
+
+  Pooled_Allocator(size_t chunk_size,
+		   size_t max_free,
+		   size_t cache_size = DEFAULT_CACHE_SIZE)
+    : chunk_size_(chunk_size < sizeof(Free_Chunk) ? sizeof(Free_Chunk) : chunk_size),
+      max_free_(max_free),
+      cache_size_(cache_size < 2 ? 2 : cache_size),
+      free_list_(0),
+      free_count_(0)
+  {
+  }
+
+  virtual ~Pooled_Allocator()
+  {
+    while (free_list_ != 0)
+      {
+	Free_Chunk *chunk = free_list_;
+	free_list_ = chunk->next;
+	ACE_New_Allocator::free(chunk);
+      }
+  }
+
+  virtual void *malloc(size_t nbytes)
+  {
+    if (nbytes > chunk_size_)
+      {
+	errno = ENOMEM;
+	return 0;
+      }
+
+    Cache *cache = caches_.get();
+    if (cache == 0)
+      return ACE_New_Allocator::malloc(chunk_size_);
+
+    if (cache->list == 0)
+      this->refill(cache);
+    if (cache->list == 0)
+      {
+	increment(cache->misses);
+	return ACE_New_Allocator::malloc(chunk_size_);
+      }
+
+    Free_Chunk *chunk = cache->list;
+    cache->list = chunk->next;
+    --cache->count;
+    increment(cache->hits);
+    return chunk;
+  }
+
+  virtual void *calloc(size_t nbytes, char initial_value = '\0')
+  {
+    void *ptr = this->malloc(nbytes);
+    if (ptr != 0)
+      ACE_OS::memset(ptr, initial_value, nbytes);
+    return ptr;
+  }
+
+  virtual void *calloc(size_t n_elem, size_t elem_size, char initial_value = '\0')
+  {
+    return this->calloc(n_elem * elem_size, initial_value);
+  }
+
+  virtual void free(void *ptr)
+  {
+    if (ptr == 0)
+      return;
+
+    Cache *cache = caches_.get();
+    if (cache == 0)
+      {
+	ACE_New_Allocator::free(ptr);
+	return;
+      }
+
+    if (cache->count == cache_size_)
+      this->spill(cache);
+    Free_Chunk *chunk = static_cast<Free_Chunk *> (ptr);
+    chunk->next = cache->list;
+    cache->list = chunk;
+    ++cache->count;
+  }
+
+  /// Allocations served from the free chunks.
+  size_t hits(void) const
+  {
+    return this->sum(&Cache::hits);
+  }
+
+  /// Allocations that had to go to the heap.
+  size_t misses(void) const
+  {
+    return this->sum(&Cache::misses);
+  }
+
+  size_t chunk_size(void) const
+  {
+    return chunk_size_;
+  }
+
+private:
+  struct Free_Chunk
+  {
+    Free_Chunk *next;
+  };
+
+  /// The free chunks of one thread, and its counts.
+  struct Cache
+  {
+    Cache()
+      : list(0),
+	count(0),
+	hits(0),
+	misses(0)
+    {
+    }
+
+    ~Cache()
+    {
+      ACE_New_Allocator heap;
+      while (list != 0)
+	{
+	  Free_Chunk *chunk = list;
+	  list = chunk->next;
+	  heap.free(chunk);
+	}
+    }
+
+    Free_Chunk *list;
+    size_t count;
+
+    /// Written by the owner only, read by any thread.
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+  };
+
+  /// Moves up to half a cache of chunks from the shared list to cache.
+  void refill(Cache *cache)
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+    for (size_t n = cache_size_ / 2; n > 0 && free_list_ != 0; --n)
+      {
+	Free_Chunk *chunk = free_list_;
+	free_list_ = chunk->next;
+	--free_count_;
+	chunk->next = cache->list;
+	cache->list = chunk;
+	++cache->count;
+      }
+  }
+
+  /// Moves half of the full cache to the shared list, or to the heap
+  /// beyond max_free.
+  void spill(Cache *cache)
+  {
+    Free_Chunk *heap = 0;
+    {
+      ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+      for (size_t n = cache_size_ / 2; n > 0; --n)
+	{
+	  Free_Chunk *chunk = cache->list;
+	  cache->list = chunk->next;
+	  --cache->count;
+	  if (free_count_ < max_free_)
+	    {
+	      chunk->next = free_list_;
+	      free_list_ = chunk;
+	      ++free_count_;
+	    }
+	  else
+	    {
+	      chunk->next = heap;
+	      heap = chunk;
+	    }
+	}
+    }
+
+    while (heap != 0)
+      {
+	Free_Chunk *chunk = heap;
+	heap = chunk->next;
+	ACE_New_Allocator::free(chunk);
+      }
+  }
+
+  static void increment(std::atomic<size_t> &counter)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+		  std::memory_order_relaxed);
+  }
+
+  size_t sum(std::atomic<size_t> Cache::*counter) const
+  {
+    size_t sum = 0;
+    for (const Per_Thread < Cache >::Node *node = caches_.head();
+	 node != 0;
+	 node = node->next)
+      sum += (node->value.*counter).load(std::memory_order_relaxed);
+    return sum;
+  }
+
+  const size_t chunk_size_;
+  const size_t max_free_;
+  const size_t cache_size_;
+
+  Per_Thread < Cache > caches_;
+
+  /// The shared list.
+  ACE_Thread_Mutex lock_;
+  Free_Chunk *free_list_;
+  size_t free_count_;
+
+  // = Disallow copying.
+  Pooled_Allocator(const Pooled_Allocator &);
+  Pooled_Allocator &operator=(const Pooled_Allocator &);
+};
+
+#endif /* POOLED_ALLOCATOR_H */
@@ -0,0 +1,209 @@
+// $Id$
+
+/**
+ * @file QueueBench.cpp
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Compares the request queues Echo_Task can use: the stock
+ * ACE_Message_Queue<ACE_MT_SYNCH> and the Lockfree_Message_Queue.
+ * For every thread count N (1, 2, 4, ... up to the maximum) N producers
+ * push messages through the queue to N consumers, and the elapsed time
+ * per message is reported.
+ */
+
+#define ACE_NTRACE 1
+#include "ace/Log_Msg.h"
+
+#include "ace/Message_Queue_T.h"
+#include "ace/Message_Block.h"
+#include "ace/Thread_Manager.h"
+#include "ace/Barrier.h"
+#include "ace/Atomic_Op.h"
+#include "ace/High_Res_Timer.h"
+#include "ace/Get_Opt.h"
+#include "ace/Numeric_Limits.h"
+#include "ace/OS_NS_stdio.h"
+#include "ace/OS_NS_stdlib.h"
+
+#include "Lockfree_Message_Queue.h"
+
+
+/**
+ * @struct Bench_Run
+ * @brief State shared by the producer and consumer threads of one run
+ */
+struct Bench_Run
+{
+  Bench_Run(ACE_Message_Queue < ACE_MT_SYNCH > *q,
+	    ACE_Message_Block *b,
+	    size_t per_producer,
+	    int n_threads)
+    : queue(q),
+      blocks(b),
+      messages_per_producer(per_producer),
+      barrier(2 * n_threads + 1),
+      next_producer(0)
+  {
+  }
+
+  ACE_Message_Queue < ACE_MT_SYNCH > *queue;
+
+  /// Preallocated messages, messages_per_producer for each producer.
+  ACE_Message_Block *blocks;
+
+  size_t messages_per_producer;
+
+  /// Releases all threads at once when the timer starts.
+  ACE_Barrier barrier;
+
+  /// Hands each producer its own slice of blocks.
+  ACE_Atomic_Op < ACE_Thread_Mutex, int > next_producer;
+};
+
+
+static ACE_THR_FUNC_RETURN producer(void *arg)
+{
+  Bench_Run *run = static_cast<Bench_Run *> (arg);
+  int id = run->next_producer++;
+  ACE_Message_Block *slice = run->blocks + id * run->messages_per_producer;
+
+  run->barrier.wait();
+  for (size_t i = 0; i < run->messages_per_producer; ++i)
+    run->queue->enqueue_tail(&slice[i]);
+
+  return 0;
+}
+
+static ACE_THR_FUNC_RETURN consumer(void *arg)
+{
+  Bench_Run *run = static_cast<Bench_Run *> (arg);
+
+  run->barrier.wait();
+  for (ACE_Message_Block *mb = 0; run->queue->dequeue_head(mb) != -1; )
+    if (mb->msg_type() == ACE_Message_Block::MB_STOP)
+      break;
+
+  return 0;
+}
+
+/// Moves messages_per_producer * n_threads messages from n_threads
+/// producers to n_threads consumers and returns the elapsed microseconds.
+static ACE_hrtime_t bench(ACE_Message_Queue < ACE_MT_SYNCH > *queue,
+			  ACE_Message_Block *blocks,
+			  ACE_Message_Block *stops,
+			  size_t messages_per_producer,
+			  int n_threads)
+{
+  Bench_Run run(queue, blocks, messages_per_producer, n_threads);
+  ACE_Thread_Manager *tm = ACE_Thread_Manager::instance();
+
+  int producers = tm->spawn_n(n_threads, producer, &run);
+  int consumers = tm->spawn_n(n_threads, consumer, &run);
+  if (producers == -1 || consumers == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "%p\n", "spawn_n"), 0);
+
+  ACE_High_Res_Timer timer;
+  run.barrier.wait();
+  timer.start();
+
+  tm->wait_grp(producers);
+
+  // One stop message per consumer, queued behind all the data
+  for (int i = 0; i < n_threads; ++i)
+    queue->enqueue_tail(&stops[i]);
+
+  tm->wait_grp(consumers);
+  timer.stop();
+
+  ACE_hrtime_t usecs;
+  timer.elapsed_microseconds(usecs);
+  return usecs;
+}
+
+
+/// Parses a count from 1 to max. Returns -1 if arg is not one.
+static long parse_count(const ACE_TCHAR *arg, long max)
+{
+  ACE_TCHAR *end = 0;
+  long value = ACE_OS::strtol(arg, &end, 10);
+  return end == arg || *end != 0 || value < 1 || value > max ? -1 : value;
+}
+
+
+int ACE_TMAIN(int argc, ACE_TCHAR *argv[])
+{
+  size_t messages = 1000000;
+  int max_threads = 64;
+
+  ACE_Get_Opt get_opt(argc, argv, ACE_TEXT("n:t:"));
+  for (int c; (c = get_opt()) != -1; )
+    {
+      long value = -1;
+      if (c == 'n')
+	value = parse_count(get_opt.opt_arg(),
+			    ACE_Numeric_Limits<long>::max());
+      else if (c == 't')
+	value = parse_count(get_opt.opt_arg(),
+			    ACE_Numeric_Limits<int>::max());
+      if (value == -1)
+	ACE_ERROR_RETURN((LM_ERROR,
+			  ACE_TEXT("Usage: %s [-n messages] [-t max-threads]\n"),
+			  argv[0]),
+			 1);
+      if (c == 'n')
+	messages = value;
+      else
+	max_threads = static_cast<int> (value);
+    }
+
+  ACE_Message_Block *blocks = 0;
+  ACE_Message_Block *stops = 0;
+  ACE_NEW_RETURN(blocks, ACE_Message_Block[messages], 1);
+  ACE_NEW_RETURN(stops, ACE_Message_Block[max_threads], 1);
+  for (int i = 0; i < max_threads; ++i)
+    stops[i].msg_type(ACE_Message_Block::MB_STOP);
+
+  ACE_OS::printf("%-10s %8s %12s %12s %10s\n",
+		 "queue", "threads", "messages", "usecs", "ns/msg");
+
+  for (int n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+    {
+      size_t per_producer = messages / n_threads;
+      size_t total = per_producer * n_threads;
+
+      for (int lockfree = 0; lockfree <= 1; ++lockfree)
+	{
+	  ACE_Message_Queue < ACE_MT_SYNCH > *queue = 0;
+	  if (lockfree)
+	    ACE_NEW_RETURN(queue, Lockfree_Message_Queue, 1);
+	  else
+	    // The blocks carry no data, so the byte-based water marks of the
+	    // stock queue never make producers wait
+	    ACE_NEW_RETURN(queue, ACE_Message_Queue < ACE_MT_SYNCH >, 1);
+
+	  ACE_hrtime_t usecs = bench(queue, blocks, stops, per_producer, n_threads);
+
+	  ACE_OS::printf("%-10s %8d %12lu %12lu %10.1f\n",
+			 lockfree ? "lockfree" : "mt",
+			 n_threads,
+			 (unsigned long) total,
+			 (unsigned long) usecs,
+			 total ? usecs * 1000.0 / total : 0.0);
+
+	  // The blocks are owned by this program, not by the queue
+	  while (!queue->is_empty())
+	    {
+	      ACE_Message_Block *mb = 0;
+	      queue->dequeue_head(mb);
+	    }
+	  delete queue;
+	}
+    }
+
+  delete [] stops;
+  delete [] blocks;
+  return 0;
+}
@@ -0,0 +1,375 @@
+// $Id$
+
+/**
+ * @file Uring.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Thin io_uring wrapper over the raw system calls, for the completion-based
+ * I/O engine. Only compiled with ECHO_HAS_IO_URING defined (make
+ * io_uring=1), which needs Linux 6.0 or later and its headers.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#if defined (ECHO_HAS_IO_URING)
+
+#include "ace/Basic_Types.h"
+#include "ace/OS_Memory.h"
+#include "ace/OS_NS_errno.h"
+#include "ace/OS_NS_string.h"
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @class Uring
+ * @brief An io_uring instance and its provided buffers, owned by one thread
+ *
+ * open() sets the instance up with io_uring_setup() and maps its rings.
+ * The caller fills in the submission slots sqe() hands out, and enter()
+ * submits all of them with a single io_uring_enter(), waiting for
+ * completions if asked to; peek() and advance() then walk the completion
+ * queue, which the kernel fills in place, without any system call.
+ *
+ * buffers() registers a provided buffer ring: the kernel picks a buffer
+ * for each completion of a multishot receive by itself and reports its ID
+ * in the completion's flags, and recycle() hands the buffer back once its
+ * data has been consumed.
+ *
+ * The user_data of an operation is a pointer tagged with the kind of the
+ * operation in its low bits (see tag()). Nothing is locked: only the
+ * thread that runs the ring may call it.
+ */
+class Uring
+{
+public:
+  enum
+  {
+    /// Kinds of operations tag() can tell apart.
+    TAGS = 8
+  };
+
+  Uring()
+    : fd_(-1),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(static_cast<io_uring_sqe *> (MAP_FAILED)),
+      sqes_size_(0),
+      sq_tail_(0),
+      sq_submitted_(0),
+      buf_ring_(static_cast<io_uring_buf_ring *> (MAP_FAILED)),
+      buf_ring_size_(0),
+      buffers_(0),
+      buffer_size_(0),
+      buf_mask_(0),
+      buf_tail_(0),
+      buf_group_(0),
+      enters_(0)
+  {
+  }
+
+  ~Uring()
+  {
+    this->close();
+  }
+
+  /// Sets up a ring with room for entries submissions (a power of two)
+  /// and four times as many completions. Returns -1 with errno set.
+  int open(unsigned entries)
+  {
+    io_uring_params params;
+    ACE_OS::memset(&params, 0, sizeof params);
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = 4 * entries;
+    fd_ = static_cast<int> (::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ == -1)
+      return -1;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes
+      + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring_ = ::mmap(0, sq_ring_size_, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = ::mmap(0, cq_ring_size_, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe *> (
+      ::mmap(0, sqes_size_, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (sq_ring_ == MAP_FAILED
+	|| cq_ring_ == MAP_FAILED
+	|| sqes_ == MAP_FAILED)
+      {
+	int error = errno;
+	this->close();
+	errno = error;
+	return -1;
+      }
+
+    char *sq = static_cast<char *> (sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *> (sq + params.sq_off.head);
+    sq_tail_p_ = reinterpret_cast<unsigned *> (sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *> (sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_tail_ = sq_submitted_ = *sq_tail_p_;
+
+    // Slot i of the submission queue always holds entry i
+    unsigned *array = reinterpret_cast<unsigned *> (sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i)
+      array[i] = i;
+
+    char *cq = static_cast<char *> (cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *> (cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *> (cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *> (cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *> (cq + params.cq_off.cqes);
+    return 0;
+  }
+
+  /// Closes the ring, which cancels whatever is still in progress, and
+  /// frees the provided buffers.
+  void close(void)
+  {
+    if (sqes_ != MAP_FAILED)
+      ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED)
+      ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED)
+      ::munmap(sq_ring_, sq_ring_size_);
+    if (fd_ != -1)
+      ::close(fd_);
+    if (buf_ring_ != MAP_FAILED)
+      ::munmap(buf_ring_, buf_ring_size_);
+    delete [] buffers_;
+
+    fd_ = -1;
+    sq_ring_ = cq_ring_ = MAP_FAILED;
+    sqes_ = static_cast<io_uring_sqe *> (MAP_FAILED);
+    buf_ring_ = static_cast<io_uring_buf_ring *> (MAP_FAILED);
+    buffers_ = 0;
+  }
+
+  /// Makes sure that the next n calls to sqe() succeed, submitting what
+  /// is pending if need be, so that a chain of linked operations is not
+  /// cut in two. Returns -1 with errno set.
+  int reserve(unsigned n)
+  {
+    if (sq_entries_ - (sq_tail_ - acquire(sq_head_)) >= n)
+      return 0;
+    if (this->enter(0) == -1)
+      return -1;
+    if (sq_entries_ - (sq_tail_ - acquire(sq_head_)) >= n)
+      return 0;
+    errno = EBUSY;
+    return -1;
+  }
+
+  /// The next submission slot, cleared, or 0 if the queue is still full
+  /// after submitting what is pending.
+  io_uring_sqe *sqe(void)
+  {
+    if (this->reserve(1) == -1)
+      return 0;
+    io_uring_sqe *sqe = &sqes_[sq_tail_++ & sq_mask_];
+    ACE_OS::memset(sqe, 0, sizeof *sqe);
+    return sqe;
+  }
+
+  /// Fills in sqe for opcode on fd, the common case.
+  static void prep(io_uring_sqe *sqe,
+		   int opcode,
+		   int fd,
+		   const void *addr,
+		   unsigned len,
+		   __u64 user_data)
+  {
+    sqe->opcode = static_cast<__u8> (opcode);
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<__u64> (addr);
+    sqe->len = len;
+    sqe->user_data = user_data;
+  }
+
+  /// Submits the pending entries and, unless wait_nr is 0, waits until
+  /// that many completions are available. Makes no system call when there
+  /// is neither anything to submit nor to wait for. Returns -1 with errno
+  /// set (EINTR when a signal interrupted the wait).
+  int enter(unsigned wait_nr)
+  {
+    unsigned to_submit = sq_tail_ - sq_submitted_;
+    if (to_submit == 0 && wait_nr == 0)
+      return 0;
+
+    release(sq_tail_p_, sq_tail_);
+    ++enters_;
+    int submitted = static_cast<int> (
+      ::syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr,
+		wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, 0, _NSIG / 8));
+    if (submitted == -1)
+      return -1;
+    sq_submitted_ += submitted;
+    return 0;
+  }
+
+  /// The oldest completion not consumed yet, or 0.
+  io_uring_cqe *peek(void)
+  {
+    unsigned head = *cq_head_;
+    if (head == acquire(cq_tail_))
+      return 0;
+    return &cqes_[head & cq_mask_];
+  }
+
+  /// Consumes the completion peek() returned, whose slot the kernel may
+  /// then reuse.
+  void advance(void)
+  {
+    release(cq_head_, *cq_head_ + 1);
+  }
+
+  /// Registers count buffers (a power of two, at most 32768) of size bytes
+  /// each as buffer group group. Returns -1 with errno set.
+  int buffers(unsigned short group, unsigned count, size_t size)
+  {
+    // The ring must be page-aligned, which mmap() guarantees
+    buf_ring_size_ = count * sizeof(io_uring_buf);
+    buf_ring_ = static_cast<io_uring_buf_ring *> (
+      ::mmap(0, buf_ring_size_, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buf_ring_ == MAP_FAILED)
+      return -1;
+    ACE_NEW_RETURN(buffers_, char[count * size], -1);
+    buffer_size_ = size;
+    buf_mask_ = count - 1;
+    buf_tail_ = 0;
+    buf_group_ = group;
+
+    io_uring_buf_reg reg;
+    ACE_OS::memset(&reg, 0, sizeof reg);
+    reg.ring_addr = reinterpret_cast<__u64> (buf_ring_);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (::syscall(__NR_io_uring_register, fd_,
+		  IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+      return -1;
+
+    for (unsigned i = 0; i < count; ++i)
+      this->recycle(static_cast<unsigned short> (i));
+    return 0;
+  }
+
+  /// The group the provided buffers were registered as.
+  unsigned short buffer_group(void) const
+  {
+    return buf_group_;
+  }
+
+  /// The provided buffer bid, of buffer_size() bytes.
+  char *buffer(unsigned short bid) const
+  {
+    return buffers_ + bid * buffer_size_;
+  }
+
+  size_t buffer_size(void) const
+  {
+    return buffer_size_;
+  }
+
+  /// Hands the provided buffer bid back to the kernel.
+  void recycle(unsigned short bid)
+  {
+    // Not through io_uring_buf_ring::bufs, which C++ compilers may place
+    // after a padding byte; the tail overlays the first buffer's resv
+    io_uring_buf *buf =
+      reinterpret_cast<io_uring_buf *> (buf_ring_) + (buf_tail_ & buf_mask_);
+    buf->addr = reinterpret_cast<__u64> (this->buffer(bid));
+    buf->len = static_cast<__u32> (buffer_size_);
+    buf->bid = bid;
+    ++buf_tail_;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  }
+
+  /// io_uring_enter() calls made so far.
+  ACE_UINT64 enters(void) const
+  {
+    return enters_;
+  }
+
+  /// The user_data of an operation of kind tag (below TAGS) on p, which
+  /// must be aligned on at least TAGS bytes.
+  static __u64 tag(const void *p, unsigned tag)
+  {
+    return reinterpret_cast<__u64> (p) | tag;
+  }
+
+  static void *pointer(__u64 user_data)
+  {
+    return reinterpret_cast<void *> (user_data & ~(__u64) (TAGS - 1));
+  }
+
+  static unsigned tag_of(__u64 user_data)
+  {
+    return static_cast<unsigned> (user_data & (TAGS - 1));
+  }
+
+private:
+  static unsigned acquire(const unsigned *p)
+  {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+
+  static void release(unsigned *p, unsigned value)
+  {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+  }
+
+  int fd_;
+
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe *sqes_;
+  size_t sqes_size_;
+
+  /// Submission queue: the kernel's head and tail, and ours. Entries up to
+  /// sq_tail_ are filled in, those up to sq_submitted_ submitted.
+  unsigned *sq_head_;
+  unsigned *sq_tail_p_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned sq_tail_;
+  unsigned sq_submitted_;
+
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe *cqes_;
+
+  io_uring_buf_ring *buf_ring_;
+  size_t buf_ring_size_;
+  char *buffers_;
+  size_t buffer_size_;
+  unsigned buf_mask_;
+  unsigned short buf_tail_;
+  unsigned short buf_group_;
+
+  ACE_UINT64 enters_;
+
+  // = Disallow copying.
+  Uring(const Uring &);
+  Uring &operator=(const Uring &);
+};
+
+#endif /* ECHO_HAS_IO_URING */
+
+#endif /* URING_H */
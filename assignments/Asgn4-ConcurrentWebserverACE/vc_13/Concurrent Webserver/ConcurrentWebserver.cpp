@@ -26,17 +26,78 @@
 #include "ace/Svc_Handler.h"
 #include "ace/Acceptor.h"
 #include "ace/Reactor.h"
+#include "ace/TP_Reactor.h"
+#include "ace/Dev_Poll_Reactor.h"
 #include "ace/INET_Addr.h"
 #include "ace/SOCK_Stream.h"
 #include "ace/SOCK_Acceptor.h"
 #include "ace/Task_T.h"
 #include "ace/Message_Block.h"
 #include "ace/OS_NS_Thread.h"
+#include "ace/Thread_Mutex.h"
+#include "ace/Guard_T.h"
+#include "ace/Get_Opt.h"
+#include "ace/OS_NS_string.h"
+#include "ace/Atomic_Op.h"
+#include "ace/OS_NS_sys_time.h"
+#include "ace/ACE.h"
+#include "ace/OS_NS_errno.h"
+#include "ace/Numeric_Limits.h"
+#include "ace/TSS_T.h"
+#include "ace/Timer_Wheel.h"
+#include "ace/Timer_Queue_Adapters.h"
+#include "ace/OS_NS_stdlib.h"
+#include "ace/OS_NS_time.h"
+#include "ace/OS_NS_sys_socket.h"
+#include "ace/Recursive_Thread_Mutex.h"
+#include "ace/Containers_T.h"
+#include "ace/High_Res_Timer.h"
+#include "ace/os_include/sys/os_uio.h"
+#include "ace/OS_NS_unistd.h"
+#include "ace/Barrier.h"
 
+#include <atomic>
+#include <cmath>
 
-// Number of threads
+#include "Batch_Message_Queue.h"
+#include "Lockfree_Message_Queue.h"
+#include "Pooled_Allocator.h"
+#include "HTTP_Parser.h"
+#include "Latency_Histogram.h"
+#include "Per_Thread.h"
+#include "Binary_Log.h"
+#include "Handler_Pool.h"
+#include "Timeout_Wheel.h"
+#include "Thread_Placement.h"
+#include "Uring.h"
+
+#if defined (ECHO_HAS_IO_URING)
+#include <sys/eventfd.h>
+#endif /* ECHO_HAS_IO_URING */
+
+
+// Default number of threads
 #define POOL_SIZE 5
 
+/// What a connection turned away by admission control gets instead of an
+/// echo (see Admission_Control).
+static const char OVERLOAD_REPLY[] = "Server overloaded, try again later\n";
+static const char HTTP_OVERLOAD_REPLY[] =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Content-Length: 0\r\n"
+  "Retry-After: 1\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+/// What a malformed HTTP request gets, after which the connection closes.
+static const char HTTP_BAD_REQUEST_REPLY[] =
+  "HTTP/1.1 400 Bad Request\r\n"
+  "Content-Type: text/plain\r\n"
+  "Content-Length: 16\r\n"
+  "Connection: close\r\n"
+  "\r\n"
+  "400 Bad Request\n";
+
 /* Stores a string version of the current thread id into buffer and
  * returns the size of this thread id in bytes.
  */
@@ -55,260 +116,4493 @@ ssize_t ACE_OS_thr_id(char buffer[])
 #endif /* WIN32 */
 }
 
+/**
+ * @struct Reply_Header
+ * @brief Thread-id banner that starts every reply of one thread
+ *
+ * Rendered once, when a thread first uses its ACE_TSS instance.
+ */
+struct Reply_Header
+{
+  Reply_Header()
+    : length(ACE_OS_thr_id(text))
+  {
+  }
 
-// Forward declaration
-class Echo_Svc_Handler;
+  char text[256];
+  ssize_t length;
+};
 
 /**
- * @class Echo_Task
- * @brief Echo task worker
- *
- * Create an Echo_Task that inherits from ACE_Task 
- * (configured with the ACE_MT_SYNCH traits class to obtain a synchronized request queue)
+ * @struct HTTP_Reply
+ * @brief A thread's scratch space for the responses to a batch of requests
  */
-class Echo_Task : public ACE_Task < ACE_MT_SYNCH >
+struct HTTP_Reply
 {
-public:
-  Echo_Task();
-  void echo_svc_handler(Echo_Svc_Handler *);
-  virtual int svc(void);
-  void process_message(ACE_Message_Block *);
+  enum
+  {
+    /// Most pipelined requests queued as one message.
+    MAX_BATCH = 64,
 
-private:
-  Echo_Svc_Handler *echo_svc_handler_;
+    MAX_HEADER = 128
+  };
+
+  char headers[MAX_BATCH][MAX_HEADER];
+
+  /// Header, thread-id banner and echoed request of each response.
+  iovec iov[3 * MAX_BATCH];
 };
 
 
 /**
- * @class Echo_Svc_Handler
- * @brief Service handler using TCP sockets stream (using a wrapper facade SOCK_STREAM)
+ * @class Latency_Model
+ * @brief Distribution of the simulated processing time of a request
  *
- * Create an Echo_Svc_Handler that inherits from ACE_Svc_Handler
- * (configured with the ACE_SOCK_STREAM class and ACE_NULL_SYNCH traits class)
+ * Specified as fixed:MSEC, uniform:MIN:MAX or exp:MEAN, all in
+ * milliseconds. The default, fixed:3000, is the original three-second
+ * operation.
  */
-class Echo_Svc_Handler : public ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >
+class Latency_Model
 {
-
 public:
-  void echo_task(Echo_Task *);
-  virtual int handle_input(ACE_HANDLE);
+  Latency_Model();
+
+  /// Returns -1 if spec is malformed.
+  int parse(const ACE_TCHAR *spec);
+
+  /// Draws one processing time. Safe to call from any number of threads.
+  ACE_Time_Value sample(void);
 
 private:
-  Echo_Task *echo_task_;
+  enum Distribution
+  {
+    FIXED,
+    UNIFORM,
+    EXPONENTIAL
+  };
+
+  /// True if the length characters at spec are exactly name.
+  static bool is_name(const ACE_TCHAR *spec,
+		      size_t length,
+		      const ACE_TCHAR *name);
+
+  /// Per-thread state of ACE_OS::rand_r().
+  struct Seed
+  {
+    Seed();
+    unsigned int value;
+  };
+
+  Distribution distribution_;
+
+  /// Fixed value, uniform bounds or exponential mean, in milliseconds.
+  double a_;
+  double b_;
+
+  ACE_TSS < Seed > seed_;
 };
 
 
 /**
- * @class Echo_Acceptor
- * @brief Acceptor using TCP sockets stream
+ * @struct Pool_Sizing
+ * @brief Bounds of the worker pool, and when it grows or shrinks
  *
- * Create an Echo_Acceptor that inherits from ACE_Acceptor (or uses a simple typedef)
- * and uses an Internet domain ''passive-mode'' stream socket to listen a designated
- * port number [ACE_Acceptor, ACE_SOCK_Acceptor, ACE_INET_Addr, etc.].
+ * The pool starts with min_threads workers. While the request queue holds
+ * more than grow_depth messages, or they waited more than grow_wait_usecs
+ * on average, it doubles (up to max_threads) at most once every
+ * Echo_Task::GROW_INTERVAL; a worker left without work for idle_timeout
+ * retires, as long as the pool stays at least min_threads strong, one
+ * worker every Echo_Task::SHRINK_INTERVAL and not within idle_timeout of
+ * the latest growth, so that a burst does not make the pool oscillate.
  */
-class Echo_Acceptor : public  ACE_Acceptor <Echo_Svc_Handler, ACE_SOCK_ACCEPTOR > {
-public:
-  void echo_task(Echo_Task *);
-  virtual int make_svc_handler(Echo_Svc_Handler *&);
+struct Pool_Sizing
+{
+  Pool_Sizing();
 
-private:
-  Echo_Task *echo_task_;
+  /// Parses MIN[:MAX] (-t). Returns -1 if spec is malformed.
+  int parse_threads(const ACE_TCHAR *spec);
+
+  /// Parses DEPTH:WAIT-USECS:IDLE-SECONDS (-g). Returns -1 if spec is
+  /// malformed.
+  int parse_policy(const ACE_TCHAR *spec);
+
+  /// True when the pool may change size.
+  bool adaptive(void) const;
+
+  size_t min_threads;
+  size_t max_threads;
+  size_t grow_depth;
+  double grow_wait_usecs;
+  ACE_Time_Value idle_timeout;
 };
 
 
+/// Idle and read timeouts of the connections. Handlers re-arm theirs from
+/// the reactor's threads and the worker threads cancel them, so it locks.
+typedef Timeout_Wheel < ACE_Recursive_Thread_Mutex > Echo_Timeout_Wheel;
 
-Echo_Task::Echo_Task()
+/**
+ * @struct Connection_Timeouts
+ * @brief How long a connection may stay silent
+ *
+ * A connection is closed once it has read nothing for idle_timeout while
+ * none of its requests is being answered, or once read_timeout has passed
+ * since the first byte of a request that is still incomplete, however
+ * slowly the rest trickles in. Its handler is then recycled like any
+ * other.
+ */
+struct Connection_Timeouts
 {
-  ACE_DEBUG((LM_INFO,
-	     ACE_TEXT("(%t) Echo_task::Constructor\n")));
-}
-	
-void Echo_Task::echo_svc_handler( Echo_Svc_Handler *svc)
+  Connection_Timeouts();
+
+  /// Parses IDLE-SECONDS[:READ-SECONDS] (-i). Returns -1 if spec is
+  /// malformed.
+  int parse(const ACE_TCHAR *spec);
+
+  /// 0 disables both timeouts.
+  ACE_Time_Value idle_timeout;
+
+  /// 0 leaves incomplete requests to idle_timeout.
+  ACE_Time_Value read_timeout;
+
+  /// The reactor's wheel, set by main() unless the timeouts are disabled.
+  Echo_Timeout_Wheel *wheel;
+};
+
+
+/**
+ * @struct Admission_Control
+ * @brief When the server stops taking in requests
+ *
+ * Once high_water messages wait for a worker the server is overloaded,
+ * until the backlog falls back to low_water. Meanwhile a connection that
+ * queues a request while an earlier one of its own is still waiting (one
+ * of the noisiest, pipelining ahead of its replies) stops being read. With
+ * shed set, a request from a connection with nothing in progress is not
+ * queued at all but answered at once with an overload reply (an HTTP 503
+ * that closes the connection). Leader/Followers queues nothing and is not
+ * concerned.
+ */
+struct Admission_Control
 {
-  echo_svc_handler_ = svc;
-}
+  Admission_Control();
 
-/// Implement its svc() hook method to perform the "half-sync"
-int Echo_Task::svc(void)
+  /// Parses HIGH[:LOW] (-b). Returns -1 if spec is malformed.
+  int parse(const ACE_TCHAR *spec);
+
+  /// 0 (default) admits every request.
+  size_t high_water;
+
+  /// Half of high_water unless given.
+  size_t low_water;
+
+  /// Set with -o shed; -o suspend (default) only stops reading.
+  bool shed;
+};
+
+
+/**
+ * @struct Server_Options
+ * @brief Startup configuration taken from the command line
+ */
+struct Server_Options
 {
-  ACE_DEBUG((LM_INFO,
-	     ACE_TEXT("(%t) Echo_task::svc\n")));
+  Server_Options();
 
-  while (1)
-    {
-      // Dequeueing messages (ACE_Message_Blocks obtained via ACE_Task::getq()) 
-      // containing the client input that was put into its synchronized request queue
-      ACE_Message_Block *mb = NULL;
-      if (this->getq(mb) == -1)
-	{
-	  ACE_DEBUG((LM_INFO,
-		     ACE_TEXT("(%t) Shutting down\n")));
-	  break;
-	}
+  /// Parses [-m hsha|steal|lf] [-q mt|lockfree] [-c capacity]
+  /// [-r select|epoll|uring] [-s seconds] [-w sleep|timer] [-l latency]
+  /// [-p raw|http] [-a admin-port] [-t min[:max]]
+  /// [-g depth:wait-usecs:idle-seconds] [-d log-level] [-k handlers]
+  /// [-i idle-seconds[:read-seconds]] [-b high[:low]] [-o suspend|shed]
+  /// [-n max-batch] [-x cpu-list|numa] [port-number].
+  /// Returns -1 on a malformed command line.
+  int parse_args(int argc, ACE_TCHAR *argv[]);
 
-      ACE_DEBUG((LM_INFO, 
-		 ACE_TEXT("(%t) Call process_message\n")));
+  enum Concurrency_Model
+  {
+    /// The reactor thread reads, pool threads process from a shared queue.
+    HALF_SYNC_HALF_ASYNC,
 
-      process_message(mb);
-    }
+    /// As above, but with one deque per pool thread and work stealing.
+    WORK_STEALING,
 
-  return 0;
-}
+    /// Pool threads take turns running the reactor and process the events
+    /// they detect themselves.
+    LEADER_FOLLOWERS
+  };
 
-/// Process the message (sends back the thread_id and original message)
-void Echo_Task::process_message(ACE_Message_Block *mb)
+  enum Reactor_Type
+  {
+    /// ACE_Select_Reactor, or ACE_TP_Reactor in Leader/Followers mode.
+    SELECT_REACTOR,
+
+    /// ACE_Dev_Poll_Reactor (epoll on Linux), with non-blocking connections
+    /// whose handlers read until the socket is drained.
+    DEV_POLL_REACTOR,
+
+#if defined (ECHO_HAS_IO_URING)
+    /// No reactor for the connections: a Uring_Engine thread runs their
+    /// I/O on io_uring. The reactor keeps the admin port and the timers.
+    URING
+#endif /* ECHO_HAS_IO_URING */
+  };
+
+  u_short port;
+
+  /// Selected with -m hsha (default), -m steal or -m lf.
+  Concurrency_Model model;
+
+  /// Shared request queue of the "hsha" pool: the stock
+  /// ACE_Message_Queue ("mt") or the Lockfree_Message_Queue ("lockfree").
+  bool lockfree_queue;
+
+  /// Number of slots of the lock-free queue, set with -c (at most
+  /// Lockfree_Message_Queue::MAX_CAPACITY).
+  size_t queue_capacity;
+
+  /// Selected with -r select (default), -r epoll or -r uring.
+  Reactor_Type reactor_type;
+
+  /// Interval between statistics reports; 0 (default) disables them.
+  int stats_interval;
+
+  /// Simulates the processing time with timers (-w timer) rather than by
+  /// blocking a worker thread (-w sleep, default).
+  bool timer_workload;
+
+  /// Simulated processing time, set with -l.
+  Latency_Model latency;
+
+  /// Speaks HTTP/1.1 (-p http) rather than echoing raw bytes (-p raw,
+  /// default).
+  bool http;
+
+  /// Port answering with a snapshot of the server's counters, set with
+  /// -a; 0 (default) disables it.
+  u_short admin_port;
+
+  /// Size of the worker pool (-t), and when it changes (-g). Only the
+  /// "hsha" pool adapts; the others keep min_threads workers.
+  Pool_Sizing pool;
+
+  /// Lowest priority logged on the request path, set with -d trace,
+  /// debug (default), info, notice, warning, error or off.
+  ACE_Log_Priority log_threshold;
+
+  /// Connection handlers allocated at startup, set with -k (default 0), at
+  /// most one per descriptor the process may open.
+  size_t prewarm_handlers;
+
+  /// Set with -i (default 60:10).
+  Connection_Timeouts timeouts;
+
+  /// Set with -b and -o.
+  Admission_Control admission;
+
+  /// Most messages a worker takes off the queue at a time, set with -n;
+  /// 1 (default) takes them one by one.
+  size_t max_batch;
+
+  /// CPUs of the reactor thread and of the workers, set with -x; by
+  /// default the scheduler places them.
+  Thread_Placement placement;
+};
+
+
+// Forward declaration
+class Echo_Svc_Handler;
+class Uring_Engine;
+
+/// Closed Echo_Svc_Handlers, kept for the next connections.
+typedef Handler_Pool < Echo_Svc_Handler, ACE_Thread_Mutex > Echo_Handler_Pool;
+
+/**
+ * @struct Request_Stamp
+ * @brief What the first block of every queued message holds
+ *
+ * The handler that received the request, and when the message went
+ * through each stage, in ACE_OS::gethrtime() ticks.
+ */
+struct Request_Stamp
 {
-  ACE_DEBUG((LM_INFO,
-	     ACE_TEXT("(%t) Echo_Task::process_message\n")));
+  /// The stamp of the message mb.
+  static Request_Stamp *of(ACE_Message_Block *mb)
+  {
+    return reinterpret_cast<Request_Stamp *> (mb->rd_ptr());
+  }
 
-  char buf[ACE_DEFAULT_MAX_SOCKET_BUFSIZ];
+  Echo_Svc_Handler *handler;
 
-  size_t length = mb->length();
+  /// recv() returned the data.
+  ACE_hrtime_t received;
 
-  ACE_DEBUG((LM_INFO,
-	     "(%t) Message Length %d\n", length));
+  /// Echo_Task::put() queued the message.
+  ACE_hrtime_t queued;
 
-  ACE_OS::memcpy(buf, mb->rd_ptr(), length);
-  mb->release();
+  /// A worker took it off the queue.
+  ACE_hrtime_t dequeued;
+};
 
-  buf[length] = 0;
 
-  ACE_DEBUG((LM_DEBUG,
-	     ACE_TEXT("(%t) Started processing message: %s\n"),
-	     buf));
+/**
+ * @class Stage_Stats
+ * @brief Where the messages spend their time, stage by stage
+ *
+ * The worker that replies to a message records how long it took from
+ * recv() to Echo_Task::put() (RECEIVE; in HTTP mode this includes parsing
+ * and waiting for the connection's previous batch to be answered), in the
+ * queue (QUEUE), until the reply was ready (PROCESS, the simulated
+ * operation), to build and send the reply (SEND) and in all (TOTAL).
+ * Once per connection, the reactor thread records how long it took from
+ * Echo_Acceptor::make_svc_handler(), before the connection is accepted,
+ * to the first data read (FIRST_BYTE).
+ *
+ * Every thread records into histograms of its own (Per_Thread), which are
+ * only merged when a report is due, so recording takes no lock and writes
+ * no cache line that another thread writes. A message costs four clock
+ * reads and five histogram updates, little next to the system calls that
+ * carry it.
+ *
+ * As an event handler it logs the merged percentiles on every timeout.
+ */
+class Stage_Stats : public ACE_Event_Handler
+{
+public:
+  enum Stage
+  {
+    RECEIVE,
+    QUEUE,
+    PROCESS,
+    SEND,
+    TOTAL,
+    FIRST_BYTE,
+    STAGES
+  };
 
-  // Sends back to client the thread-id
-  char tid[256];
-  ssize_t tid_length = ACE_OS_thr_id(tid);
-  echo_svc_handler_->peer().send(tid, tid_length);
+  /// Records the stages of a message whose reply was ready at ready and
+  /// sent at sent.
+  void record(const Request_Stamp &stamp,
+	      ACE_hrtime_t ready,
+	      ACE_hrtime_t sent);
 
-  // Sends back to client the original data
-  echo_svc_handler_->peer().send(buf, length);
+  /// Records ticks spent in stage.
+  void record(Stage stage, ACE_UINT64 ticks);
 
-  ACE_OS::sleep(3); /// This sleep emulates a long operation
+  /// Adds what every thread recorded to merged, one histogram per stage.
+  void merge(Latency_Histogram merged[STAGES]);
 
-  ACE_DEBUG((LM_DEBUG,
-	     ACE_TEXT("(%t) Finished processing message: %s\n"),
-	     buf));
-}
-	       
+  /// Logs the percentiles of each stage.
+  virtual int handle_timeout(const ACE_Time_Value &, const void *);
 
-/// Setter method in order service handler use the thread pool
-void Echo_Svc_Handler::echo_task(Echo_Task *et){
-  echo_task_ = et;
+  static ACE_hrtime_t now(void)
+  {
+    return ACE_OS::gethrtime();
+  }
 
-  // The thread pool also holds a reference this service handler 
-  // in order to send data back to the peer
-  echo_task_->echo_svc_handler(this); 
-}
+  /// Microseconds, to the nanosecond, in ticks of now().
+  static double usecs(ACE_UINT64 ticks);
 
+private:
+  struct Histograms
+  {
+    Latency_Histogram stages[STAGES];
+  };
 
+  Per_Thread < Histograms > histograms_;
+};
 
-//  Implement its handle_input() hook method to perform the "Half-Async" 
-int Echo_Svc_Handler::handle_input(ACE_HANDLE)
+
+/**
+ * @class Server_Counters
+ * @brief Live counters of the server, sharded per thread
+ *
+ * A thread only ever updates its own shard, with plain (relaxed) loads
+ * and stores, so the data plane never contends on a counter nor on its
+ * cache line. value() adds up the shards of all the threads; only the
+ * admin port calls it.
+ */
+class Server_Counters
 {
-  ACE_DEBUG((LM_DEBUG,
-	     "(%t) Echo_Svc_Handler::handle_input\n"));
+public:
+  enum Counter
+  {
+    ACCEPTED,
+    CLOSED,
+    BYTES_IN,
+    BYTES_OUT,
 
+    /// Messages answered (batches of requests in HTTP mode).
+    MESSAGES,
 
-  // Reads the client data [ACE_SOCK_Stream] until the end of a line is reached
-  char buf[ACE_DEFAULT_MAX_SOCKET_BUFSIZ];
-  ssize_t recv_cnt;
+    /// 1 while the thread is processing a message.
+    BUSY,
 
-  recv_cnt = this->peer().recv(buf, sizeof(buf));
-  if (recv_cnt <= 0) {
-    ACE_DEBUG((LM_DEBUG, ACE_TEXT("(%t) connection closed \n")));
-    return -1;
+    /// Messages taken off the request queue, and the time they waited
+    /// there in all, in ticks of ACE_OS::gethrtime().
+    DEQUEUED,
+    QUEUE_WAIT,
+
+    /// Queue operations that took them, one or more at a time.
+    DEQUEUES,
+
+    /// System calls that received requests, by
+    /// Echo_Svc_Handler::handle_input().
+    RECVS,
+
+    /// System calls that sent replies, by the workers and by
+    /// Echo_Svc_Handler::handle_output().
+    SENDS,
+
+    /// System calls of the Uring_Engine (-r uring): io_uring_enter(), and
+    /// the writes to its eventfd that wake it up.
+    RING_CALLS,
+
+    /// Connections closed by their idle or read timeout.
+    TIMED_OUT,
+
+    /// Admission control: requests answered with an overload reply, and
+    /// times a connection stopped being read.
+    SHED,
+    SUSPENDED,
+
+    COUNTERS
+  };
+
+  void add(Counter counter, ACE_UINT64 n = 1)
+  {
+    Shard *shard = shards_.get();
+    if (shard != 0)
+      shard->counts[counter].store(
+	shard->counts[counter].load(std::memory_order_relaxed) + n,
+	std::memory_order_relaxed);
   }
 
-  // Puts the client data into a message [ACE_Message_Block]
-  ACE_Message_Block *mb = 0;
-  ACE_NEW_RETURN(mb,
-		 ACE_Message_Block(recv_cnt),
-		 -1);
+  void set(Counter counter, ACE_UINT64 value)
+  {
+    Shard *shard = shards_.get();
+    if (shard != 0)
+      shard->counts[counter].store(value, std::memory_order_relaxed);
+  }
 
-  mb->copy(buf, recv_cnt);
+  /// The sum over all threads.
+  ACE_UINT64 value(Counter counter) const;
 
-  // Calls Echo_Task::put(), which uses ACE_Task::putq() to enqueue the message 
-  // for subsequent processing by a thread in the pool of threads that are running
-  // the Echo_Task::svc() hook method.  
-  echo_task_->putq(mb);
+private:
+  struct Shard
+  {
+    Shard()
+    {
+      for (int i = 0; i < COUNTERS; ++i)
+	counts[i].store(0, std::memory_order_relaxed);
+    }
 
-  return 0;
-}
+    std::atomic<ACE_UINT64> counts[COUNTERS];
+  };
 
+  Per_Thread < Shard > shards_;
+};
 
 
-	
-// Echo_Task setter
-void Echo_Acceptor::echo_task(Echo_Task *et)
+/**
+ * @class Stats_Report
+ * @brief Named values, rendered as "name value" lines or as a JSON object
+ */
+class Stats_Report
 {
-  echo_task_ = et;
-}
-	
+public:
+  enum
+  {
+    MAX_LENGTH = 4096
+  };
+
+  explicit Stats_Report(bool json);
+
+  void add(const char *name, ACE_UINT64 value);
+  void add(const char *name, double value);
+
+  /// Closes the JSON object, once every value is in.
+  void finish(void);
+
+  bool json(void) const;
+  const char *text(void) const;
+  size_t length(void) const;
+
+private:
+  void append(const char *name, const char *value);
+
+  bool json_;
+  int count_;
+  char text_[MAX_LENGTH];
+  size_t length_;
+};
+
+
 /**
- * Bridge method used to create the new service handler object [Echo_Svc_Handler].
- * Customized to perform Echo_Svc_Handler creation and set a pointer to the Echo_Task
- * Returns -1 on failure, else 0.
+ * @class Message_Pools
+ * @brief Allocators for the messages Echo_Svc_Handler queues on the Echo_Task
+ *
+ * Each request is a chain of two ACE_Message_Blocks, each with its own
+ * ACE_Data_Block: a Request_Stamp and a data buffer; all of them come from
+ * these pools and return to them when the worker thread releases the
+ * chain, so in steady state the request path does no heap allocation. One
+ * set of pools serves a reactor and the pool threads that release its
+ * messages.
+ *
+ * As an event handler it logs the pools' hit rates on every timeout.
  */
-int Echo_Acceptor::make_svc_handler(Echo_Svc_Handler *&sh)
+class Message_Pools : public ACE_Event_Handler
 {
-  ACE_DEBUG((LM_DEBUG,
-	     "(%t) Echo_Acceptor::make_svc_handler\n"));
+public:
+  enum
+  {
+    /// Size of a data buffer, and so the most a request block can carry.
+    BUFFER_SIZE = 16 * 1024,
 
-  if (sh == 0)
-    ACE_NEW_RETURN(sh,
-		   Echo_Svc_Handler,
-		   -1);
+    /// Free chunks each pool keeps for reuse.
+    MAX_FREE_BLOCKS = 4096,
+    MAX_FREE_BUFFERS = 512
+  };
 
-  /// Assign to each new handler the same thread pool
-  sh->echo_task(this->echo_task_);
+  Message_Pools();
 
-  // Set the reactor of the newly created <SVC_HANDLER> to the same
-  // reactor that this <ACE_Acceptor> is using.
-  sh->reactor(this->reactor());
-  return 0;
-}
+  /// Returns a block with room for size bytes, or one that refers to data
+  /// (size 0) when data is given, or 0 if out of memory.
+  ACE_Message_Block *make_block(size_t size, const char *data = 0);
 
+  /// Returns a block holding a Request_Stamp, which the caller fills in,
+  /// or 0 if out of memory.
+  ACE_Message_Block *make_stamp(void);
 
+  /// Logs the hit rate of each pool.
+  virtual int handle_timeout(const ACE_Time_Value &, const void *);
 
-/* Program's entry point */
-int ACE_TMAIN(int argc, ACE_TCHAR *argv[])
+  /// Adds the hits and misses of each pool to report.
+  void report(Stats_Report &report);
+
+private:
+  enum
+  {
+    POOLS = 4
+  };
+
+  ACE_Message_Block *make_block(size_t size,
+				const char *data,
+				Pooled_Allocator *buffers);
+
+  void pools(Pooled_Allocator *pools[POOLS]);
+
+  Pooled_Allocator message_blocks_;
+  Pooled_Allocator data_blocks_;
+  Pooled_Allocator buffers_;
+  Pooled_Allocator stamps_;
+};
+
+/**
+ * @class Echo_Task
+ * @brief Echo task worker
+ *
+ * Create an Echo_Task that inherits from ACE_Task 
+ * (configured with the ACE_MT_SYNCH traits class to obtain a synchronized request queue)
+ *
+ * Each queued message is a chain whose first block holds a Request_Stamp
+ * naming the Echo_Svc_Handler that received the data and whose
+ * continuation holds the data itself, so replies always go back to the
+ * originating connection. The stamp also records when the message went
+ * through each stage, for the Stage_Stats.
+ *
+ * By default all workers share the task's request queue. In work-stealing
+ * mode every worker has its own deque instead: each connection is owned by
+ * one worker, which receives all its messages (keeping the connection's data
+ * in that worker's cache), and a worker with nothing to do takes over the
+ * connection of the oldest message of another worker's deque, as long as
+ * that is the connection's only message in the pool. The owner then has
+ * nothing of the connection in progress, so its messages are still
+ * answered one at a time and in order.
+ *
+ * In Leader/Followers mode nothing is queued: the workers run the event loop
+ * of a thread-pool reactor (ACE_TP_Reactor), which lets one of them at a
+ * time wait for events, and put() processes each message in the thread that
+ * read it.
+ *
+ * In HTTP mode a message holds a batch of complete pipelined requests, and
+ * the reply is one HTTP response per request, echoing it, all sent in a
+ * single gathered write.
+ *
+ * Under admission control the task counts the messages waiting for a
+ * worker and tells the handlers when it is overloaded. The connections
+ * that stopped reading meanwhile are resumed by handle_exception(), which
+ * the worker that brings the backlog down to the low mark triggers with a
+ * reactor notification, so that only the reactor's thread touches them.
+ *
+ * In batch mode a worker takes up to max_batch messages in one queue
+ * operation, its share of the queue depth (see Batch_Message_Queue), and
+ * answers all the messages of a connection in the batch with a single
+ * gathered write. The operations of a batch run side by side: the worker
+ * waits for the longest of them, then sends all the replies. A single
+ * message is answered the same way, once its operation is over, so
+ * batching only saves queue operations and writes.
+ *
+ * Under a Thread_Placement every worker is pinned to its CPUs as it
+ * starts. In work-stealing mode it then allocates its deque itself, so
+ * that the deque lives on the worker's NUMA node, and it steals from the
+ * workers of its own node before going to another one.
+ */
+class Echo_Task : public ACE_Task < ACE_MT_SYNCH >
 {
-  ACE_OS::printf("Usage: %s [port-number]\n", argv[0]);
-  u_short port = argc < 2 ? ACE_DEFAULT_SERVER_PORT : ACE_OS::atoi(argv[1]);
-  ACE_INET_Addr addr(port);
+public:
+  enum
+  {
+    /// Most messages in a batch.
+    MAX_BATCH = 64
+  };
 
-  ACE_DEBUG((LM_DEBUG,
-	     "(%t) Program's entry point\n"));
+  /// Uses mq as request queue, or a Batch_Message_Queue of its own if mq
+  /// is 0.
+  Echo_Task(Batch_Message_Queue *mq = 0);
+  virtual ~Echo_Task();
 
-  ACE_OS::printf("listening at port %d\n", port);
+  /// Switches to work-stealing mode with one deque per worker. Must be
+  /// called before activate() with the number of threads to spawn.
+  int work_stealing(size_t n_workers);
 
-  // Implement a main() function that:
+  /// Pins the workers as placement says. Must be called before
+  /// work_stealing() and activate().
+  void placement(const Thread_Placement *placement);
 
-  //1. Creates an Echo_Task instance and have it spawn a pool of N threads
-  // (where N > 1) within itself (Echo_Task::activate()).
-  Echo_Task echo_task;
-  Echo_Task *ptask = &echo_task;
-  //Create POOL_SIZE kernel-level threads and allow the new threads to be joined with.
-  echo_task.activate(THR_NEW_LWP | THR_JOINABLE, POOL_SIZE);  
+  /// Thread placement, or 0 when the scheduler places the threads.
+  const Thread_Placement *placement(void) const;
 
-  ///2. Creates an Echo_Acceptor instance and associate it with the Echo_Task.
-  Echo_Acceptor acceptor;
-  acceptor.echo_task(ptask); // Using a setter method defined in Echo_Acceptor
+  /// Work-stealing mode under a placement: waits until every worker has
+  /// allocated its deque on its node. Must be called after activate() and
+  /// before the first put().
+  int placed(void);
 
-  //3. Creates an  ACE_Reactor(or use the singleton instance of the ACE_Reactor)
-  ACE_Reactor *reactor = ACE_Reactor::instance();
-	
-  //4. Registers the Echo_Acceptor instance with the reactor
-  acceptor.open(addr, reactor);
+  /// Switches to Leader/Followers mode: the workers run the event loop of
+  /// reactor, which must be backed by an ACE_TP_Reactor.
+  void leader_followers(ACE_Reactor *reactor);
+
+  /// Switches to batch mode: a worker takes up to max_batch (at most
+  /// MAX_BATCH) messages at a time. Leader/Followers mode queues nothing
+  /// and is not concerned.
+  void batching(size_t max_batch);
+
+  /// Enables admission control on the request queue. Suspended
+  /// connections are resumed from the event loop of reactor.
+  void admission(const Admission_Control *admission, ACE_Reactor *reactor);
+
+  /// Admission control, or 0.
+  const Admission_Control *admission(void) const;
+
+  /// True from the time high_water messages are waiting until they are
+  /// down to low_water.
+  bool overloaded(void) const;
+
+  /// Reactor thread: keeps sh, which stopped reading because of the
+  /// overload, for readmit(). sh must hold a reference meanwhile.
+  void suspend(Echo_Svc_Handler *sh);
+
+  /// Reactor thread: resumes the connections suspended so far.
+  void readmit(void);
+
+  /// Notified once the overload is over: calls readmit().
+  virtual int handle_exception(ACE_HANDLE);
+
+  /// Lets the pool grow and shrink within sizing, which must be adaptive.
+  /// Must be called before activate(), which starts sizing->min_threads
+  /// detached workers, and only with the shared request queue. The caller
+  /// then schedules the pool check, a reactor timer with no act that
+  /// fires every GROW_INTERVAL.
+  void pool_sizing(const Pool_Sizing *sizing);
+
+  /// Returns the worker that owns a new connection (round-robin).
+  size_t next_worker(void);
+
+  /// Sets the distribution of the simulated processing time.
+  void latency(Latency_Model *);
+
+  /// Switches to HTTP mode.
+  void http(void);
+  bool is_http(void) const;
+
+  /// Simulates the processing time with a timer instead of by blocking the
+  /// worker, which moves on to the next message at once: a timer thread
+  /// sends the reply when the timer expires, so thousands of requests can
+  /// be in progress at the same time. Starts that thread.
+  int timer_workload(void);
+
+  /// Timer workload: the processing of the message in act is over. With
+  /// no act, checks whether the pool must grow.
+  virtual int handle_timeout(const ACE_Time_Value &, const void *act);
+
+  /// Queues a message, on the deque of the worker owning its connection in
+  /// work-stealing mode, else on the shared request queue. In
+  /// Leader/Followers mode processes it at once instead.
+  virtual int put(ACE_Message_Block *, ACE_Time_Value * = 0);
+
+  virtual int svc(void);
+  void process_message(ACE_Message_Block *);
+
+  /// Time spent by the messages in each stage.
+  Stage_Stats *stage_stats(void);
+
+  Server_Counters *counters(void);
+
+  /// Messages waiting for a worker.
+  size_t queue_depth(void);
+
+  /// Period at which an idle worker looks for messages to steal.
+  static const ACE_Time_Value STEAL_INTERVAL;
+
+  /// Shortest time between two growths, and between two retirements, of
+  /// an adaptive pool.
+  static const ACE_Time_Value GROW_INTERVAL;
+  static const ACE_Time_Value SHRINK_INTERVAL;
+
+private:
+  /// Takes the next message for worker self: its own oldest message,
+  /// else one stolen from another worker, else waits for either.
+  int take(size_t self, ACE_Message_Block *&);
+
+  /// Takes the next messages for worker self, at most max_batch_ of them,
+  /// into batch. Returns their number, or -1.
+  int take_batch(size_t self, ACE_Message_Block *batch[]);
+
+  /// Performs the operations of count messages and answers them.
+  void process_batch(ACE_Message_Block *batch[], size_t count);
+
+  /// Sends the reply to the message and releases it.
+  void complete(ACE_Message_Block *);
+
+  /// As complete(), for count messages: those of one connection are
+  /// answered by a single write. Clears batch.
+  void complete_batch(ACE_Message_Block *batch[], size_t count);
+
+  /// Adaptive pool: spawns more workers if the queue is too deep or
+  /// messages wait too long in it.
+  void grow(void);
+
+  /// Adaptive pool: true if an idle worker may exit.
+  bool retire(void);
+
+  /// Work-stealing mode: whether worker *thief may take mb, and with it
+  /// its connection, off another worker's deque.
+  static bool stealable(ACE_Message_Block *mb, void *thief);
+
+  /// Pins worker self, which then moves its deque to its node.
+  void place(size_t self);
+
+  /// The NUMA node of worker.
+  size_t node(size_t worker) const;
+
+  /// HTTP mode: fills in the responses to the requests in data, or the
+  /// 400 response to a malformed one, returning the number of iovecs, and
+  /// whether the last one closes the connection.
+  int http_reply(ACE_Message_Block *data, const iovec *&iov, bool &last);
+
+  /// True when the workers run the reactor's event loop.
+  bool leader_followers_;
+
+  /// The shared request queue, msg_queue().
+  Batch_Message_Queue *queue_;
+
+  /// Per-worker deques; 0 when all workers share the request queue.
+  Batch_Message_Queue **deques_;
+  size_t n_deques_;
+
+  /// Most messages a worker takes at a time.
+  size_t max_batch_;
+
+  /// Index handed to the next worker thread that enters svc().
+  ACE_Atomic_Op < ACE_Thread_Mutex, size_t > next_svc_;
+
+  /// Worker that will own the next accepted connection.
+  ACE_Atomic_Op < ACE_Thread_Mutex, size_t > next_owner_;
+
+  /// Each processing thread's reply header.
+  ACE_TSS < Reply_Header > reply_header_;
+
+  /// Each processing thread's HTTP responses.
+  ACE_TSS < HTTP_Reply > http_reply_;
+
+  /// Simulated processing time; 0 means the original three seconds.
+  Latency_Model *latency_;
+
+  /// Timer thread of the timer workload, 0 when the workers sleep. A
+  /// timer wheel keeps scheduling and expiry O(1) with many timers.
+  ACE_Thread_Timer_Queue_Adapter < ACE_Timer_Wheel > *timers_;
+
+  /// Set in HTTP mode.
+  bool http_;
+
+  Stage_Stats stage_stats_;
+
+  Server_Counters counters_;
+
+  /// Adaptive pool: its policy (0 when the pool is fixed) and, under
+  /// pool_lock_, its current size and when it last grew and shrank.
+  const Pool_Sizing *sizing_;
+  ACE_Thread_Mutex pool_lock_;
+  size_t workers_;
+  ACE_Time_Value last_grow_;
+  ACE_Time_Value last_shrink_;
+
+  /// Adaptive pool, only touched by grow(): the DEQUEUED and QUEUE_WAIT
+  /// counters at the previous check.
+  ACE_UINT64 last_dequeued_;
+  ACE_UINT64 last_queue_wait_;
+
+  /// Admission control: its marks (0 when disabled), the messages put and
+  /// not yet taken, and whether the backlog is above the marks. The
+  /// suspended connections are only touched by the reactor's thread.
+  const Admission_Control *admission_;
+  std::atomic<size_t> backlog_;
+  std::atomic<bool> overloaded_;
+  ACE_Unbounded_Queue < Echo_Svc_Handler * > suspended_;
+
+  /// CPUs of the workers (0 when unpinned) and, in work-stealing mode, the
+  /// workers' meeting point with placed() once their deques have moved.
+  const Thread_Placement *placement_;
+  ACE_Barrier *placed_;
+};
+
+
+/**
+ * @class Echo_Svc_Handler
+ * @brief Service handler using TCP sockets stream (using a wrapper facade SOCK_STREAM)
+ *
+ * Create an Echo_Svc_Handler that inherits from ACE_Svc_Handler
+ * (configured with the ACE_SOCK_STREAM class and ACE_MT_SYNCH traits class,
+ * since its message queue is filled by the pool threads)
+ *
+ * The handler counts the messages it has queued on the Echo_Task. When the
+ * connection closes while some of them are still being processed, its
+ * destruction is deferred until the last worker thread releases it, so a
+ * worker never sends on a closed (or reused) socket.
+ *
+ * Replies are sent without blocking. What the socket does not take at once
+ * waits in the handler's message queue and is flushed by handle_output()
+ * in the reactor's thread, so a client that does not read its replies
+ * never holds up a worker thread. While more than OUTPUT_HIGH_WATER bytes
+ * wait for such a client the handler stops reading from it, until the
+ * backlog falls to OUTPUT_LOW_WATER. Queued output holds a reference on
+ * the handler, like a queued message, until handle_output() has sent it.
+ *
+ * A client that closes its side of the connection still gets its replies:
+ * the handler stops reading and stays registered, and handle_output()
+ * closes the connection in the reactor's thread once the last reply is out.
+ *
+ * In HTTP mode the input is parsed as it arrives, and every read queues the
+ * complete requests it finished as one batch, referring to the receive
+ * buffer rather than copying it; the incomplete request that may follow
+ * waits in that buffer for more data. The connection has at most one batch
+ * in the pool at a time, the next ones being held back until it has been
+ * answered, so responses go out in the order of the requests. A request
+ * that does not keep the connection alive is the last one read.
+ *
+ * A handler taken from an Echo_Handler_Pool goes back to it when the
+ * connection closes, reset for the next one, instead of being deleted.
+ *
+ * Every read re-arms the connection's timer on the Echo_Timeout_Wheel
+ * (see Connection_Timeouts).
+ */
+class Echo_Svc_Handler : public ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_MT_SYNCH >
+{
+
+public:
+  enum
+  {
+    /// Queued output above which reading from the client is suspended.
+    OUTPUT_HIGH_WATER = 64 * 1024,
+
+    /// Queued output at which reading resumes.
+    OUTPUT_LOW_WATER = 16 * 1024,
+
+    /// -r uring: most sends linked in one submission.
+    URING_CHAIN = 16
+  };
+
+  Echo_Svc_Handler();
+  virtual ~Echo_Svc_Handler();
+  void echo_task(Echo_Task *);
+  void message_pools(Message_Pools *);
+
+  /// Pool the handler returns to when closed; 0 to delete it instead.
+  void handler_pool(Echo_Handler_Pool *);
+
+  /// When the acceptor started on the connection, for FIRST_BYTE.
+  void accept_time(ACE_hrtime_t);
+
+  void timeouts(const Connection_Timeouts *);
+
+  /// Shuts the connection down and returns the handler to its pool, or
+  /// deletes it if it has none.
+  virtual void destroy(void);
+
+  /// Registers with the reactor; notes whether the acceptor made the
+  /// connection non-blocking.
+  virtual int open(void * = 0);
+
+  /// Reads one chunk, or every chunk available on a non-blocking connection.
+  virtual int handle_input(ACE_HANDLE);
+
+  /// Flushes queued output when the socket becomes writable. Returns -1,
+  /// so that the reactor closes the connection, once the client's input is
+  /// over and nothing is left to send or in progress.
+  virtual int handle_output(ACE_HANDLE);
+
+  /// Called by the Echo_Timeout_Wheel when the connection timed out: shuts
+  /// the socket down, so that the reactor closes the connection as if the
+  /// client had, unless one of its requests is still being answered.
+  virtual int handle_timeout(const ACE_Time_Value &, const void *);
+
+  /// Called by a worker thread to send a reply without blocking; output
+  /// the socket does not take is queued for handle_output(). When last is
+  /// set the connection is shut down for writing once the reply is out.
+  int send_reply(const iovec iov[], int iovcnt, bool last = false);
+
+  /// HTTP mode: called by a worker thread once it has answered a batch,
+  /// to put the next batch held back, if any, on the Echo_Task.
+  void next_batch(void);
+
+  /// Called from the reactor's thread once the overload that suspended
+  /// the connection is over: resumes reading and drops the reference
+  /// held meanwhile.
+  void readmit(void);
+
+  /// Work-stealing mode: counts one more message of the connection in
+  /// the pool, and returns the worker that owns the connection.
+  size_t enter_pool(void);
+
+  /// Work-stealing mode: a message of the connection has been answered.
+  void leave_pool(void);
+
+  /// Work-stealing mode: makes worker thief the owner if the connection
+  /// has a single message in the pool, which thief is about to take.
+  /// Returns false if the owner may be processing another one.
+  bool hand_over(size_t thief);
+
+#if defined (ECHO_HAS_IO_URING)
+  // = Completion-based I/O (-r uring), from the Uring_Engine's thread.
+
+  /// Sets an accepted connection up to be run by engine, with no reactor.
+  void uring_open(Uring_Engine *engine);
+
+  /// Arms the multishot receive. Returns -1 if the ring is full.
+  int uring_receive(Uring &ring);
+
+  /// Queues the length bytes the receive placed in buf, and cancels the
+  /// receive once the output backlog is too large.
+  int uring_input(Uring &ring, const char *buf, size_t length);
+
+  /// The multishot receive ended with res: re-arms it unless the client's
+  /// input is over, or the output backlog holds it back.
+  void uring_rearm(Uring &ring, int res);
+
+  /// Submits the queued output as a chain of linked sends, followed by
+  /// the shutdown for writing if the connection closes after it. With
+  /// nothing to submit, drops the reference the output held, which may
+  /// destroy the handler.
+  void uring_flush(Uring &ring);
+
+  /// An operation of the chain completed with res: a send when data is
+  /// set, else the shutdown. Returns the operations still in flight.
+  int uring_sent(int res, bool data);
+
+  /// Set until the client's input is over.
+  bool uring_receiving(void) const;
+
+  /// Set once the input is over and no operation is in flight: the engine
+  /// then closes the connection, whose output still goes out.
+  bool uring_idle(void) const;
+
+  /// Releases the output in flight or queued, when the engine closes its
+  /// ring.
+  void uring_abort(void);
+#endif /* ECHO_HAS_IO_URING */
+
+  /// Called by the reactor with a valid handle when the connection closes,
+  /// and by a worker thread with ACE_INVALID_HANDLE when it has finished
+  /// with a queued message.
+  virtual int handle_close(ACE_HANDLE = ACE_INVALID_HANDLE,
+			   ACE_Reactor_Mask = ACE_Event_Handler::ALL_EVENTS_MASK);
+
+private:
+  friend class Uring_Engine;
+
+  /// Accounts for the length bytes just received into data, and queues
+  /// the requests they complete.
+  int received(ACE_Message_Block *data, size_t length);
+
+  /// The client closed its side: stops reading. Returns -1 if nothing is
+  /// left to send or in progress, so that the connection closes at once.
+  int input_over(void);
+
+  /// Queues the client data received into data on the Echo_Task, which
+  /// takes ownership of it (it is released on failure).
+  int queue_request(ACE_Message_Block *data);
+
+  /// HTTP mode: returns the block to receive into, which starts with the
+  /// incomplete request received so far, or 0 if that request does not
+  /// fit in a buffer.
+  ACE_Message_Block *request_block(void);
+
+  /// HTTP mode: queues the requests completed by the latest read.
+  int queue_requests(void);
+
+  /// Admission control: answers data with the overload reply instead of
+  /// queuing it, and releases it.
+  int shed(ACE_Message_Block *data);
+
+  /// Admission control: stops reading a connection that has more than one
+  /// message waiting while the Echo_Task is overloaded.
+  void check_admission(void);
+
+  /// Releases what the connection left behind and restores the state of
+  /// a new handler.
+  void reset(void);
+
+  /// Re-arms the timer after a read: for the read timeout once a request
+  /// is incomplete, else for the idle timeout.
+  void touch(void);
+
+  /// Disarms the timer, if armed.
+  void cancel_timeout(void);
+
+#if defined (ECHO_HAS_IO_URING)
+  /// Stops sending after a failed operation, and shuts the connection
+  /// down so that its receive ends as well.
+  void uring_fail(int error, const char *what);
+#endif /* ECHO_HAS_IO_URING */
+
+  Echo_Task *echo_task_;
+
+  Message_Pools *message_pools_;
+
+  /// Work-stealing mode: the worker owning the connection, and the
+  /// messages of the connection queued or in progress, under lock_.
+  size_t worker_;
+  size_t in_pool_;
+
+  /// Set on non-blocking connections, which handle_input() reads until
+  /// recv() would block: a reactor that reports readiness only once per
+  /// arrival, like ACE_Dev_Poll_Reactor, gives no second notice for data
+  /// left in the socket.
+  bool drain_;
+
+  /// Serializes queued_count_, deferred_close_ and the connection's
+  /// ownership between the reactor thread and the pool threads.
+  ACE_Thread_Mutex lock_;
+
+  /// Number of messages from this handler not yet released by the pool.
+  int queued_count_;
+
+  /// Set when the connection closed while messages were still queued.
+  bool deferred_close_;
+
+  /// HTTP mode, under lock_: set while a batch is in the pool, and the
+  /// batches held back meanwhile, oldest first.
+  bool batch_in_flight_;
+  ACE_Message_Block *held_head_;
+  ACE_Message_Block *held_tail_;
+
+  /// When the latest read returned, for the messages it queues.
+  ACE_hrtime_t received_;
+
+  /// HTTP mode: the request being received, and the block holding it from
+  /// its rd_ptr() on.
+  HTTP_Parser parser_;
+  ACE_Message_Block *pending_;
+
+  /// HTTP mode: set once a request closing the connection has been read;
+  /// anything that follows it is discarded.
+  bool input_closed_;
+
+  /// Set, under lock_, once the client has closed its side of the
+  /// connection: READ_MASK is cancelled and the connection closes as soon
+  /// as its replies are out.
+  bool input_over_;
+
+  /// Serializes the output queue and the socket writes. Nobody calls the
+  /// reactor from a pool thread while holding it, so the reactor's thread
+  /// can take it inside handle_output() without risking a deadlock.
+  ACE_Thread_Mutex output_lock_;
+
+  /// Set while WRITE_MASK is scheduled (or about to be) for queued output,
+  /// which then holds a reference on the handler (queued_count_).
+  bool write_scheduled_;
+
+  /// Set, under output_lock_, when the connection is shut down for writing
+  /// as soon as the queued output is out.
+  bool close_after_output_;
+
+  /// Set while READ_MASK is cancelled because of the output backlog. Only
+  /// touched from reactor upcalls, which never run concurrently for a
+  /// handler.
+  bool input_suspended_;
+
+  /// Set, like input_suspended_, while READ_MASK is cancelled because the
+  /// Echo_Task is overloaded; the connection is on its suspended list.
+  bool overload_suspended_;
+
+  /// Set once open() has counted the connection, which the destructor
+  /// (or reset()) then counts as closed.
+  bool accepted_;
+
+  Echo_Handler_Pool *handler_pool_;
+
+  /// Set by the acceptor, cleared once the first byte is read.
+  ACE_hrtime_t accept_time_;
+
+  const Connection_Timeouts *timeouts_;
+  Echo_Timeout_Wheel::Timer timer_;
+
+  /// Set while the timer runs for the read timeout.
+  bool reading_;
+
+  /// -r uring: the engine running the connection; 0 under a reactor.
+  Uring_Engine *uring_;
+
+  /// -r uring, only touched from the engine's thread: set until the
+  /// client's input is over, set while a receive is armed, set once an
+  /// operation failed, and set once the engine closed the connection.
+  bool uring_receiving_;
+  bool uring_armed_;
+  bool uring_failed_;
+  bool uring_closed_;
+
+  /// -r uring: the blocks of the sends submitted, oldest first, and the
+  /// operations of the chain still in flight.
+  ACE_Message_Block *uring_sending_;
+  ACE_Message_Block *uring_sending_tail_;
+  int uring_in_flight_;
+
+  /// Links of the engine's list of connections, and of its list of those
+  /// with output to send.
+  Echo_Svc_Handler *uring_prev_;
+  Echo_Svc_Handler *uring_next_;
+  Echo_Svc_Handler *uring_posted_;
+};
+
+
+/**
+ * @class Echo_Acceptor
+ * @brief Acceptor using TCP sockets stream
+ *
+ * Create an Echo_Acceptor that inherits from ACE_Acceptor (or uses a simple typedef)
+ * and uses an Internet domain ''passive-mode'' stream socket to listen a designated
+ * port number [ACE_Acceptor, ACE_SOCK_Acceptor, ACE_INET_Addr, etc.].
+ */
+class Echo_Acceptor : public  ACE_Acceptor <Echo_Svc_Handler, ACE_SOCK_ACCEPTOR > {
+public:
+  Echo_Acceptor();
+  void echo_task(Echo_Task *);
+  void message_pools(Message_Pools *);
+
+  /// Takes the handlers from hp rather than allocating each one.
+  void handler_pool(Echo_Handler_Pool *hp);
+
+  void timeouts(const Connection_Timeouts *);
+
+  virtual int make_svc_handler(Echo_Svc_Handler *&);
+
+private:
+  Echo_Task *echo_task_;
+  Message_Pools *message_pools_;
+  Echo_Handler_Pool *handler_pool_;
+  const Connection_Timeouts *timeouts_;
+};
+
+
+#if defined (ECHO_HAS_IO_URING)
+/**
+ * @class Uring_Engine
+ * @brief Completion-based I/O for the echo connections (-r uring)
+ *
+ * One thread runs the connections on an io_uring instead of a reactor: a
+ * multishot accept on the listening socket, one multishot receive per
+ * connection drawing on a ring of provided buffers, and the replies the
+ * workers queue submitted as chains of linked sends. Each pass through
+ * the loop submits all it prepared in a single io_uring_enter(), which
+ * also waits for completions when there is nothing else to do, and none
+ * at all while completions keep coming in, so the system calls per
+ * request fall as the load rises.
+ *
+ * A worker hands a connection with output to send over through post(),
+ * and writes the eventfd the engine waits on only if it is asleep. The
+ * engine takes over the reactor's reference on the handlers: it closes a
+ * connection once its input is over and no operation is in flight, and
+ * the handler goes once its messages are answered and the replies sent.
+ * The reactor still runs the admin port, the statistics and the timeout
+ * wheel, whose timeouts shut the socket down to end the receive.
+ */
+class Uring_Engine : public ACE_Task_Base
+{
+public:
+  /// Kinds of operations, told apart by the tag of their user_data.
+  enum Operation
+  {
+    ACCEPT,
+    WAKE,
+    RECV,
+    SEND,
+    SHUTDOWN,
+    CANCEL
+  };
+
+  enum
+  {
+    /// Submission queue entries.
+    ENTRIES = 1024,
+
+    /// Buffer group the receives draw on, its number of buffers and
+    /// their size.
+    BUFFER_GROUP = 0,
+    BUFFERS = 1024,
+    BUFFER_SIZE = 4096
+  };
+
+  /// Configures the handlers it accepts through acceptor, which is not
+  /// opened, and counts on et's counters.
+  Uring_Engine(Echo_Acceptor &acceptor, Echo_Task *et);
+  virtual ~Uring_Engine();
+
+  /// Sets the ring up and starts accepting connections at addr, to be run
+  /// by the thread activate() starts. Returns -1 on failure.
+  int listen(const ACE_INET_Addr &addr);
+
+  /// Called by a worker that queued output for sh while none was pending:
+  /// the engine's thread submits it.
+  void post(Echo_Svc_Handler *sh);
+
+  /// Makes svc() return.
+  void stop(void);
+
+  /// Called once svc() has returned: closes the ring, which cancels what
+  /// is in flight, and the connections left.
+  void finish(void);
+
+  /// Runs the ring until stop().
+  virtual int svc(void);
+
+private:
+  void dispatch(const io_uring_cqe &cqe);
+  void accepted(const io_uring_cqe &cqe);
+  void received(Echo_Svc_Handler *sh, const io_uring_cqe &cqe);
+
+  /// Submits the output of the connections posted. Returns false if none
+  /// was.
+  bool flush_posted(void);
+
+  /// Arm the multishot accept, and the read of the eventfd.
+  int arm_accept(void);
+  int arm_wake(void);
+
+  void wake(void);
+
+  void add_connection(Echo_Svc_Handler *sh);
+
+  /// Takes sh off the list and closes it, as the reactor would.
+  void close_connection(Echo_Svc_Handler *sh);
+
+  Uring ring_;
+  ACE_SOCK_Acceptor listener_;
+  Echo_Acceptor &acceptor_;
+  Echo_Task *echo_task_;
+
+  int wake_fd_;
+  ACE_UINT64 wake_count_;
+
+  /// Connections whose input is not over, or with operations in flight.
+  Echo_Svc_Handler *connections_;
+
+  /// Connections posted, newest first.
+  std::atomic<Echo_Svc_Handler *> posted_;
+
+  /// Set while svc() waits in io_uring_enter() with nothing else to do.
+  std::atomic<bool> sleeping_;
+
+  std::atomic<bool> done_;
+
+  /// io_uring_enter() calls already counted.
+  ACE_UINT64 enters_;
+};
+#endif /* ECHO_HAS_IO_URING */
+
+
+class Admin_Acceptor;
+
+/**
+ * @class Admin_Handler
+ * @brief Answers a connection to the admin port with a stats snapshot
+ *
+ * Waits for the first line of the request: if it mentions "json" the
+ * snapshot is a JSON object, otherwise one "name value" line per counter,
+ * and a request starting with "GET " gets it as an HTTP/1.0 response, so
+ * that curl, a browser or nc can read it. A line "log LEVEL" instead sets
+ * the threshold of the request path's Binary_Log. The connection is shut down for
+ * writing after the reply and closed when the client closes its end.
+ *
+ * Runs in the reactor's thread, as Echo_Svc_Handler's input does, and only
+ * reads the counters, so it never slows the data plane down.
+ */
+class Admin_Handler : public ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_NULL_SYNCH >
+{
+public:
+  Admin_Handler();
+  void acceptor(Admin_Acceptor *);
+
+  virtual int handle_input(ACE_HANDLE);
+
+private:
+  /// Answers a "log LEVEL" request.
+  int set_log_level(void);
+
+  Admin_Acceptor *acceptor_;
+  char request_[256];
+  size_t length_;
+  bool replied_;
+};
+
+
+/**
+ * @class Admin_Acceptor
+ * @brief Acceptor of the admin port, which builds the snapshots
+ */
+class Admin_Acceptor : public ACE_Acceptor < Admin_Handler, ACE_SOCK_ACCEPTOR >
+{
+public:
+  Admin_Acceptor(Echo_Task *, Message_Pools *, Echo_Handler_Pool *);
+  virtual int make_svc_handler(Admin_Handler *&);
+
+  /// Adds the current value of every counter to report.
+  void report(Stats_Report &report);
+
+private:
+  Echo_Task *echo_task_;
+  Message_Pools *message_pools_;
+  Echo_Handler_Pool *handler_pool_;
+  ACE_Time_Value start_time_;
+
+  /// Serializes the previous snapshot's time and accepted connections,
+  /// from which the accept rate is worked out, between the reactor's
+  /// threads in Leader/Followers mode.
+  ACE_Thread_Mutex lock_;
+  ACE_Time_Value last_time_;
+  ACE_UINT64 last_accepted_;
+};
+
+
+
+const ACE_Time_Value Echo_Task::STEAL_INTERVAL(0, 10000);
+const ACE_Time_Value Echo_Task::GROW_INTERVAL(0, 200000);
+const ACE_Time_Value Echo_Task::SHRINK_INTERVAL(1);
+
+Echo_Task::Echo_Task(Batch_Message_Queue *mq)
+  : ACE_Task < ACE_MT_SYNCH > (0, mq),
+    leader_followers_(false),
+    queue_(mq),
+    deques_(0),
+    n_deques_(0),
+    max_batch_(1),
+    next_svc_(0),
+    next_owner_(0),
+    latency_(0),
+    timers_(0),
+    http_(false),
+    sizing_(0),
+    workers_(0),
+    last_dequeued_(0),
+    last_queue_wait_(0),
+    admission_(0),
+    backlog_(0),
+    overloaded_(false),
+    placement_(0),
+    placed_(0)
+{
+  ACE_DEBUG((LM_INFO,
+	     ACE_TEXT("(%t) Echo_task::Constructor\n")));
+
+  // Like the default queue it replaces, a queue of its own goes away with
+  // the task
+  if (queue_ == 0)
+    {
+      ACE_NEW(queue_, Batch_Message_Queue);
+      this->msg_queue(queue_);
+      this->delete_msg_queue_ = true;
+    }
+}
+
+Echo_Task::~Echo_Task()
+{
+  if (timers_ != 0)
+    {
+      timers_->deactivate();
+      timers_->wait();
+      delete timers_;
+    }
+
+  for (size_t i = 0; i < n_deques_; ++i)
+    delete deques_[i];
+  delete [] deques_;
+  delete placed_;
+}
+
+int Echo_Task::work_stealing(size_t n_workers)
+{
+  ACE_NEW_RETURN(deques_,
+		 Batch_Message_Queue *[n_workers],
+		 -1);
+  for (n_deques_ = 0; n_deques_ < n_workers; ++n_deques_)
+    ACE_NEW_RETURN(deques_[n_deques_],
+		   Batch_Message_Queue,
+		   -1);
+  if (placement_ != 0)
+    ACE_NEW_RETURN(placed_,
+		   ACE_Barrier(static_cast<unsigned int> (n_workers + 1)),
+		   -1);
+  return 0;
+}
+
+void Echo_Task::placement(const Thread_Placement *placement)
+{
+  placement_ = placement;
+}
+
+const Thread_Placement *Echo_Task::placement(void) const
+{
+  return placement_;
+}
+
+int Echo_Task::placed(void)
+{
+  return placed_ == 0 ? 0 : placed_->wait();
+}
+
+void Echo_Task::place(size_t self)
+{
+  if (placement_->pin_worker(self) == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "pin worker"));
+  else
+    ACE_DEBUG((LM_DEBUG,
+	       ACE_TEXT("(%t) Worker %d runs on node %d\n"),
+	       static_cast<int> (self),
+	       static_cast<int> (placement_->node(self))));
+
+  if (placed_ == 0)
+    return;
+
+  // The deque main() allocated is still empty: its replacement is first
+  // touched from here, on the worker's node. The old one stays if there
+  // is no memory for it.
+  Batch_Message_Queue *deque = 0;
+  ACE_NEW_NORETURN(deque, Batch_Message_Queue);
+  if (deque != 0)
+    {
+      delete deques_[self];
+      deques_[self] = deque;
+    }
+  placed_->wait();
+}
+
+size_t Echo_Task::node(size_t worker) const
+{
+  return placement_ == 0 ? 0 : placement_->node(worker);
+}
+
+void Echo_Task::leader_followers(ACE_Reactor *reactor)
+{
+  this->reactor(reactor);
+  leader_followers_ = true;
+}
+
+void Echo_Task::batching(size_t max_batch)
+{
+  max_batch_ = max_batch < 1 ? 1
+    : max_batch > MAX_BATCH ? static_cast<size_t> (MAX_BATCH)
+    : max_batch;
+}
+
+void Echo_Task::admission(const Admission_Control *admission,
+			  ACE_Reactor *reactor)
+{
+  this->reactor(reactor);
+  admission_ = admission;
+}
+
+const Admission_Control *Echo_Task::admission(void) const
+{
+  return admission_;
+}
+
+bool Echo_Task::overloaded(void) const
+{
+  return overloaded_.load(std::memory_order_relaxed);
+}
+
+void Echo_Task::suspend(Echo_Svc_Handler *sh)
+{
+  if (suspended_.enqueue_tail(sh) == -1)
+    {
+      ACE_ERROR((LM_ERROR, "(%t) %p\n", "suspend"));
+      sh->readmit();
+    }
+}
+
+void Echo_Task::readmit(void)
+{
+  Echo_Svc_Handler *sh = 0;
+  while (suspended_.dequeue_head(sh) == 0)
+    sh->readmit();
+}
+
+int Echo_Task::handle_exception(ACE_HANDLE)
+{
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) overload over, resuming %lu connections\n",
+	    (unsigned long) suspended_.size()));
+  this->readmit();
+  return 0;
+}
+
+void Echo_Task::pool_sizing(const Pool_Sizing *sizing)
+{
+  sizing_ = sizing;
+  workers_ = sizing->min_threads;
+  last_grow_ = ACE_OS::gettimeofday();
+  last_shrink_ = last_grow_;
+}
+
+void Echo_Task::grow(void)
+{
+  // Mean time in the queue of the messages taken since the last check
+  ACE_UINT64 dequeued = counters_.value(Server_Counters::DEQUEUED);
+  ACE_UINT64 queue_wait = counters_.value(Server_Counters::QUEUE_WAIT);
+  ACE_UINT64 taken = dequeued - last_dequeued_;
+  double wait_usecs = taken == 0
+    ? 0.0
+    : Stage_Stats::usecs((queue_wait - last_queue_wait_) / taken);
+  last_dequeued_ = dequeued;
+  last_queue_wait_ = queue_wait;
+
+  size_t depth = this->queue_depth();
+  if (depth <= sizing_->grow_depth && wait_usecs <= sizing_->grow_wait_usecs)
+    return;
+
+  ACE_GUARD(ACE_Thread_Mutex, guard, pool_lock_);
+  ACE_Time_Value now = ACE_OS::gettimeofday();
+  if (workers_ >= sizing_->max_threads || now - last_grow_ < GROW_INTERVAL)
+    return;
+
+  // Doubles the pool, so that a burst is caught up with in a few steps
+  size_t spawn = sizing_->max_threads - workers_;
+  if (spawn > workers_)
+    spawn = workers_;
+  if (this->activate(THR_NEW_LWP | THR_DETACHED,
+		     static_cast<int> (spawn),
+		     1) == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "activate"));
+  else
+    {
+      workers_ += spawn;
+      last_grow_ = now;
+      ACE_DEBUG((LM_INFO,
+		 ACE_TEXT("(%t) Pool grows to %d workers")
+		 ACE_TEXT(" (queue depth %d, queue wait %.1f usecs)\n"),
+		 static_cast<int> (workers_),
+		 static_cast<int> (depth),
+		 wait_usecs));
+    }
+}
+
+bool Echo_Task::retire(void)
+{
+  ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, pool_lock_, false);
+  ACE_Time_Value now = ACE_OS::gettimeofday();
+  if (workers_ <= sizing_->min_threads
+      || now - last_shrink_ < SHRINK_INTERVAL
+      || now - last_grow_ < sizing_->idle_timeout)
+    return false;
+
+  --workers_;
+  last_shrink_ = now;
+  ACE_DEBUG((LM_INFO,
+	     ACE_TEXT("(%t) Idle worker retires, %d left\n"),
+	     static_cast<int> (workers_)));
+  return true;
+}
+
+size_t Echo_Task::next_worker(void)
+{
+  return n_deques_ == 0 ? 0 : next_owner_++ % n_deques_;
+}
+
+void Echo_Task::latency(Latency_Model *lm)
+{
+  latency_ = lm;
+}
+
+void Echo_Task::http(void)
+{
+  http_ = true;
+}
+
+bool Echo_Task::is_http(void) const
+{
+  return http_;
+}
+
+Stage_Stats *Echo_Task::stage_stats(void)
+{
+  return &stage_stats_;
+}
+
+Server_Counters *Echo_Task::counters(void)
+{
+  return &counters_;
+}
+
+size_t Echo_Task::queue_depth(void)
+{
+  if (n_deques_ == 0)
+    return this->msg_queue()->message_count();
+
+  size_t depth = 0;
+  for (size_t i = 0; i < n_deques_; ++i)
+    depth += deques_[i]->message_count();
+  return depth;
+}
+
+int Echo_Task::timer_workload(void)
+{
+  ACE_NEW_RETURN(timers_,
+		 ACE_Thread_Timer_Queue_Adapter < ACE_Timer_Wheel >,
+		 -1);
+  return timers_->activate();
+}
+
+int Echo_Task::handle_timeout(const ACE_Time_Value &, const void *act)
+{
+  if (act == 0)
+    {
+      this->grow();
+      return 0;
+    }
+
+  ACE_Message_Block *mb =
+    static_cast<ACE_Message_Block *> (const_cast<void *> (act));
+  int length = static_cast<int> (mb->cont()->length());
+
+  this->complete(mb);
+
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) Finished processing message (%d bytes)\n",
+	    length));
+  return 0;
+}
+
+int Echo_Task::put(ACE_Message_Block *mb, ACE_Time_Value *timeout)
+{
+  Request_Stamp *stamp = Request_Stamp::of(mb);
+  stamp->queued = Stage_Stats::now();
+
+  if (leader_followers_)
+    {
+      stamp->dequeued = stamp->queued;
+      counters_.set(Server_Counters::BUSY, 1);
+      process_message(mb);
+      counters_.set(Server_Counters::BUSY, 0);
+      return 0;
+    }
+
+  if (admission_ != 0
+      && backlog_.fetch_add(1, std::memory_order_relaxed) + 1
+	 >= admission_->high_water)
+    overloaded_.store(true, std::memory_order_relaxed);
+
+  // The count is raised before a thief can see the message, so that the
+  // connection is not handed over while this message stays behind
+  int result = n_deques_ == 0
+    ? this->putq(mb, timeout)
+    : deques_[stamp->handler->enter_pool()]->enqueue_tail(mb, timeout);
+  if (result == -1 && n_deques_ != 0)
+    stamp->handler->leave_pool();
+  if (result == -1 && admission_ != 0)
+    backlog_.fetch_sub(1, std::memory_order_relaxed);
+  return result;
+}
+
+int Echo_Task::take(size_t self, ACE_Message_Block *&mb)
+{
+  if (n_deques_ == 0 && sizing_ == 0)
+    return this->getq(mb);
+
+  // Adaptive pool: returns -1 with errno set to EWOULDBLOCK for a worker
+  // idle long enough to retire
+  while (n_deques_ == 0)
+    {
+      ACE_Time_Value timeout = ACE_OS::gettimeofday() + sizing_->idle_timeout;
+      if (this->getq(mb, &timeout) != -1)
+	return 0;
+      if (errno != EWOULDBLOCK || this->retire())
+	return -1;
+    }
+
+  for (;;)
+    {
+      ACE_Time_Value poll(ACE_Time_Value::zero);
+      if (deques_[self]->dequeue_head(mb, &poll) != -1)
+	return 0;
+
+      // Takes over a connection of a busy worker, with its oldest
+      // message (see stealable()). The workers of the same node come
+      // first, as their deques' cache lines are closer.
+      size_t home = this->node(self);
+      for (int remote = 0; remote < 2; ++remote)
+	for (size_t i = 1; i < n_deques_; ++i)
+	  {
+	    size_t victim = (self + i) % n_deques_;
+	    if ((this->node(victim) != home) != (remote != 0))
+	      continue;
+	    if (!deques_[victim]->is_empty()
+		&& deques_[victim]->dequeue_head_if(mb,
+						    &Echo_Task::stealable,
+						    &self) != -1)
+	      {
+		ECHO_LOG((LM_DEBUG,
+			  "(%t) Took over a connection from worker %d\n",
+			  static_cast<int> (victim)));
+		return 0;
+	      }
+	  }
+
+      ACE_Time_Value timeout = ACE_OS::gettimeofday() + STEAL_INTERVAL;
+      if (deques_[self]->dequeue_head(mb, &timeout) != -1)
+	return 0;
+      if (errno != EWOULDBLOCK)
+	return -1;
+    }
+}
+
+bool Echo_Task::stealable(ACE_Message_Block *mb, void *thief)
+{
+  return Request_Stamp::of(mb)->handler->hand_over(*static_cast<size_t *> (thief));
+}
+
+int Echo_Task::take_batch(size_t self, ACE_Message_Block *batch[])
+{
+  // The workers of a fixed pool take their batch from the shared queue in
+  // one operation
+  if (n_deques_ == 0 && sizing_ == 0)
+    return queue_->dequeue_batch(batch, max_batch_, this->thr_count());
+
+  // Otherwise the first message comes as usual, and the rest of the batch
+  // from the worker's own queue, without waiting
+  if (this->take(self, batch[0]) == -1)
+    return -1;
+  if (max_batch_ == 1)
+    return 1;
+
+  ACE_Time_Value poll(ACE_Time_Value::zero);
+  int count = n_deques_ == 0
+    ? queue_->dequeue_batch(batch + 1, max_batch_ - 1, this->thr_count(), &poll)
+    : deques_[self]->dequeue_batch(batch + 1, max_batch_ - 1, 1, &poll);
+  return count == -1 ? 1 : count + 1;
+}
+
+/// Implement its svc() hook method to perform the "half-sync"
+int Echo_Task::svc(void)
+{
+  ACE_DEBUG((LM_INFO,
+	     ACE_TEXT("(%t) Echo_task::svc\n")));
+
+  size_t self = next_svc_++;
+  if (placement_ != 0)
+    this->place(self);
+
+  if (leader_followers_)
+    {
+      // The ACE_TP_Reactor promotes one of the threads running its event
+      // loop to leader; the leader waits for and dispatches the next event,
+      // and another thread takes over while it runs the handler.
+      this->reactor()->run_reactor_event_loop();
+      ACE_DEBUG((LM_INFO,
+		 ACE_TEXT("(%t) Shutting down\n")));
+      return 0;
+    }
+
+  ACE_Message_Block *batch[MAX_BATCH];
+  while (1)
+    {
+      // Dequeueing messages (ACE_Message_Blocks obtained via ACE_Task::getq()) 
+      // containing the client input that was put into its synchronized request queue
+      int count = this->take_batch(self, batch);
+      if (count == -1)
+	{
+	  ACE_DEBUG((LM_INFO,
+		     ACE_TEXT("(%t) Shutting down\n")));
+	  break;
+	}
+
+      // The worker that brings the backlog down to the low mark ends the
+      // overload; the reactor's thread resumes the suspended connections
+      if (admission_ != 0
+	  && backlog_.fetch_sub(count, std::memory_order_relaxed) - count
+	     <= admission_->low_water
+	  && overloaded_.exchange(false)
+	  && this->reactor()->notify(this) == -1)
+	ACE_ERROR((LM_ERROR, "(%t) %p\n", "notify"));
+
+      ACE_hrtime_t dequeued = Stage_Stats::now();
+      for (int i = 0; i < count; ++i)
+	{
+	  Request_Stamp *stamp = Request_Stamp::of(batch[i]);
+	  stamp->dequeued = dequeued;
+	  counters_.add(Server_Counters::QUEUE_WAIT,
+			stamp->dequeued - stamp->queued);
+	}
+      counters_.add(Server_Counters::DEQUEUED, count);
+      counters_.add(Server_Counters::DEQUEUES);
+
+      ECHO_LOG((LM_INFO,
+		"(%t) Call process_message\n"));
+
+      counters_.set(Server_Counters::BUSY, 1);
+      if (count == 1)
+	process_message(batch[0]);
+      else
+	process_batch(batch, count);
+      counters_.set(Server_Counters::BUSY, 0);
+    }
+
+  return 0;
+}
+
+/// Process the message (sends back the thread_id and original message)
+void Echo_Task::process_message(ACE_Message_Block *mb)
+{
+  ECHO_LOG((LM_INFO,
+	    "(%t) Echo_Task::process_message\n"));
+
+  // The first block carries the originating handler, the next one the data
+  // exactly as it was received
+  ACE_Message_Block *data = mb->cont();
+
+  int length = static_cast<int> (data->length());
+
+  ECHO_LOG((LM_INFO,
+	    "(%t) Message Length %d\n", length));
+
+  // Only the first Binary_Log::TEXT_SIZE bytes are logged
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) Started processing message: %s\n",
+	    Binary_Log::text(data->rd_ptr(), length)));
+
+  ACE_Time_Value latency =
+    latency_ != 0 ? latency_->sample() : ACE_Time_Value(3);
+
+  if (timers_ != 0)
+    {
+      // The worker is done with the message: the timer thread replies
+      // once the simulated operation is over
+      if (timers_->schedule(this,
+			    mb,
+			    timers_->timer_queue()->gettimeofday() + latency) != -1)
+	return;
+      ACE_ERROR((LM_ERROR, "(%t) %p\n", "schedule"));
+    }
+
+  ACE_OS::sleep(latency); /// This sleep emulates a long operation
+
+  // The reply is ready once the operation is over
+  this->complete(mb);
+
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) Finished processing message (%d bytes)\n",
+	    length));
+}
+
+void Echo_Task::process_batch(ACE_Message_Block *batch[], size_t count)
+{
+  // The timer workload gives every message a timer of its own
+  if (timers_ != 0)
+    {
+      for (size_t i = 0; i < count; ++i)
+	this->process_message(batch[i]);
+      return;
+    }
+
+  // Every message draws its own processing time
+  ACE_Time_Value latency(ACE_Time_Value::zero);
+  for (size_t i = 0; i < count; ++i)
+    {
+      ACE_Message_Block *data = batch[i]->cont();
+      ECHO_LOG((LM_DEBUG,
+		"(%t) Started processing message: %s\n",
+		Binary_Log::text(data->rd_ptr(), data->length())));
+      ACE_Time_Value sample =
+	latency_ != 0 ? latency_->sample() : ACE_Time_Value(3);
+      if (sample > latency)
+	latency = sample;
+    }
+
+  ACE_OS::sleep(latency); /// The operations of the batch, side by side
+
+  this->complete_batch(batch, count);
+
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) Finished processing %d messages\n",
+	    static_cast<int> (count)));
+}
+
+void Echo_Task::complete(ACE_Message_Block *mb)
+{
+  ACE_hrtime_t ready = Stage_Stats::now();
+  const Request_Stamp &stamp = *Request_Stamp::of(mb);
+  Echo_Svc_Handler *echo_svc_handler = stamp.handler;
+  ACE_Message_Block *data = mb->cont();
+
+  // Sends back to client the thread-id followed by the original data, in a
+  // single gathered write
+  iovec iov[2];
+  const iovec *reply = iov;
+  int iovcnt = 2;
+  bool last = false;
+  if (http_)
+    iovcnt = this->http_reply(data, reply, last);
+  else
+    {
+      iov[0].iov_base = reply_header_->text;
+      iov[0].iov_len = reply_header_->length;
+      iov[1].iov_base = data->rd_ptr();
+      iov[1].iov_len = data->length();
+    }
+  if (echo_svc_handler->send_reply(reply, iovcnt, last) == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "send_reply"));
+  if (n_deques_ != 0)
+    echo_svc_handler->leave_pool();
+  stage_stats_.record(stamp, ready, Stage_Stats::now());
+  counters_.add(Server_Counters::MESSAGES);
+
+  // send_reply() has copied whatever it could not send, so the blocks go
+  // back to their pools now
+  mb->release();
+
+  if (http_)
+    echo_svc_handler->next_batch();
+
+  // Drops the reference this message held on its handler
+  echo_svc_handler->handle_close(ACE_INVALID_HANDLE, 0);
+}
+
+void Echo_Task::complete_batch(ACE_Message_Block *batch[], size_t count)
+{
+  // An HTTP connection has a single message in the pool at a time, which
+  // already holds all its pipelined requests
+  if (http_)
+    {
+      for (size_t i = 0; i < count; ++i)
+	this->complete(batch[i]);
+      return;
+    }
+
+  Reply_Header *header = reply_header_;
+  ACE_Message_Block *group[MAX_BATCH];
+  iovec iov[2 * MAX_BATCH];
+  for (size_t i = 0; i < count; ++i)
+    {
+      if (batch[i] == 0)
+	continue;
+
+      // Gathers the replies to the messages of this connection, in their
+      // order in the batch
+      ACE_hrtime_t ready = Stage_Stats::now();
+      Echo_Svc_Handler *echo_svc_handler = Request_Stamp::of(batch[i])->handler;
+      size_t n = 0;
+      int iovcnt = 0;
+      for (size_t j = i; j < count; ++j)
+	if (batch[j] != 0
+	    && Request_Stamp::of(batch[j])->handler == echo_svc_handler)
+	  {
+	    ACE_Message_Block *data = batch[j]->cont();
+	    iov[iovcnt].iov_base = header->text;
+	    iov[iovcnt++].iov_len = header->length;
+	    iov[iovcnt].iov_base = data->rd_ptr();
+	    iov[iovcnt++].iov_len = data->length();
+	    group[n++] = batch[j];
+	    batch[j] = 0;
+	  }
+
+      if (echo_svc_handler->send_reply(iov, iovcnt, false) == -1)
+	ACE_ERROR((LM_ERROR, "(%t) %p\n", "send_reply"));
+      ACE_hrtime_t sent = Stage_Stats::now();
+      counters_.add(Server_Counters::MESSAGES, n);
+
+      // Each message held a reference on the handler: the last one may
+      // close it, after which it is not touched again
+      for (size_t j = 0; j < n; ++j)
+	{
+	  stage_stats_.record(*Request_Stamp::of(group[j]), ready, sent);
+	  group[j]->release();
+	  if (n_deques_ != 0)
+	    echo_svc_handler->leave_pool();
+	  echo_svc_handler->handle_close(ACE_INVALID_HANDLE, 0);
+	}
+    }
+}
+
+int Echo_Task::http_reply(ACE_Message_Block *data,
+			  const iovec *&iov,
+			  bool &last)
+{
+  HTTP_Reply *reply = http_reply_;
+  iov = reply->iov;
+
+  // The handler queued complete requests only, so parsing them again is a
+  // single pass over bytes that are still in the cache
+  HTTP_Parser parser;
+  const char *request = data->rd_ptr();
+  size_t remaining = data->length();
+  int iovcnt = 0;
+  HTTP_Parser::Result result = HTTP_Parser::INCOMPLETE;
+  for (int i = 0;
+       i < HTTP_Reply::MAX_BATCH
+	 && (result = parser.parse(request, remaining))
+	    == HTTP_Parser::COMPLETE;
+       ++i)
+    {
+      const HTTP_Request &r = parser.request();
+      last = !r.keep_alive;
+
+      // The body echoes the request after the thread-id
+      int header_length =
+	ACE_OS::snprintf(reply->headers[i],
+			 HTTP_Reply::MAX_HEADER,
+			 "HTTP/1.1 200 OK\r\n"
+			 "Content-Type: text/plain\r\n"
+			 "Content-Length: %lu\r\n"
+			 "%s"
+			 "\r\n",
+			 (unsigned long) (reply_header_->length + r.length),
+			 last ? "Connection: close\r\n"
+			 : r.minor_version == 0 ? "Connection: keep-alive\r\n"
+			 : "");
+
+      reply->iov[iovcnt].iov_base = reply->headers[i];
+      reply->iov[iovcnt++].iov_len = header_length;
+      reply->iov[iovcnt].iov_base = reply_header_->text;
+      reply->iov[iovcnt++].iov_len = reply_header_->length;
+      reply->iov[iovcnt].iov_base = const_cast<char *> (request);
+      reply->iov[iovcnt++].iov_len = r.length;
+
+      request += r.length;
+      remaining -= r.length;
+      parser.next();
+    }
+
+  // The handler queues a malformed request on its own
+  if (result == HTTP_Parser::INVALID)
+    {
+      reply->iov[iovcnt].iov_base = const_cast<char *> (HTTP_BAD_REQUEST_REPLY);
+      reply->iov[iovcnt++].iov_len = sizeof HTTP_BAD_REQUEST_REPLY - 1;
+      last = true;
+    }
+  return iovcnt;
+}
+	       
+
+Echo_Svc_Handler::Echo_Svc_Handler()
+  : echo_task_(0),
+    message_pools_(0),
+    worker_(0),
+    in_pool_(0),
+    drain_(false),
+    queued_count_(0),
+    deferred_close_(false),
+    batch_in_flight_(false),
+    held_head_(0),
+    held_tail_(0),
+    received_(0),
+    pending_(0),
+    input_closed_(false),
+    input_over_(false),
+    write_scheduled_(false),
+    close_after_output_(false),
+    input_suspended_(false),
+    overload_suspended_(false),
+    accepted_(false),
+    handler_pool_(0),
+    accept_time_(0),
+    timeouts_(0),
+    reading_(false),
+    uring_(0),
+    uring_receiving_(false),
+    uring_armed_(false),
+    uring_failed_(false),
+    uring_closed_(false),
+    uring_sending_(0),
+    uring_sending_tail_(0),
+    uring_in_flight_(0),
+    uring_prev_(0),
+    uring_next_(0),
+    uring_posted_(0)
+{
+}
+
+Echo_Svc_Handler::~Echo_Svc_Handler()
+{
+  this->cancel_timeout();
+  if (pending_ != 0)
+    pending_->release();
+  if (accepted_)
+    echo_task_->counters()->add(Server_Counters::CLOSED);
+}
+
+/// Setter method in order service handler use the thread pool
+void Echo_Svc_Handler::echo_task(Echo_Task *et){
+  echo_task_ = et;
+  worker_ = et->next_worker();
+}
+
+void Echo_Svc_Handler::message_pools(Message_Pools *mp)
+{
+  message_pools_ = mp;
+}
+
+void Echo_Svc_Handler::handler_pool(Echo_Handler_Pool *hp)
+{
+  handler_pool_ = hp;
+}
+
+void Echo_Svc_Handler::accept_time(ACE_hrtime_t time)
+{
+  accept_time_ = time;
+}
+
+void Echo_Svc_Handler::timeouts(const Connection_Timeouts *ct)
+{
+  timeouts_ = ct;
+}
+
+void Echo_Svc_Handler::destroy(void)
+{
+  if (handler_pool_ == 0)
+    {
+      ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_MT_SYNCH >::destroy();
+      return;
+    }
+
+  // What the destructor of ACE_Svc_Handler would do: leave the reactor
+  // and close the socket, which the timer must not see reused
+  this->cancel_timeout();
+  this->shutdown();
+  this->reset();
+  handler_pool_->put(this);
+}
+
+void Echo_Svc_Handler::reset(void)
+{
+  if (pending_ != 0)
+    pending_->release();
+  if (accepted_)
+    echo_task_->counters()->add(Server_Counters::CLOSED);
+  this->msg_queue()->flush();
+
+  // So that the pool may delete the handler after the reactor is gone
+  this->reactor(0);
+
+  echo_task_ = 0;
+  message_pools_ = 0;
+  worker_ = 0;
+  in_pool_ = 0;
+  drain_ = false;
+  queued_count_ = 0;
+  deferred_close_ = false;
+  batch_in_flight_ = false;
+  held_head_ = 0;
+  held_tail_ = 0;
+  received_ = 0;
+  parser_.next();
+  pending_ = 0;
+  input_closed_ = false;
+  input_over_ = false;
+  write_scheduled_ = false;
+  close_after_output_ = false;
+  input_suspended_ = false;
+  overload_suspended_ = false;
+  accepted_ = false;
+  accept_time_ = 0;
+  timeouts_ = 0;
+  reading_ = false;
+  uring_ = 0;
+  uring_receiving_ = false;
+  uring_armed_ = false;
+  uring_failed_ = false;
+  uring_closed_ = false;
+  uring_sending_ = 0;
+  uring_sending_tail_ = 0;
+  uring_in_flight_ = 0;
+  uring_prev_ = 0;
+  uring_next_ = 0;
+  uring_posted_ = 0;
+}
+
+void Echo_Svc_Handler::touch(void)
+{
+  if (timeouts_ == 0 || timeouts_->wheel == 0)
+    return;
+
+  bool reading = pending_ != 0
+    && pending_->length() > 0
+    && timeouts_->read_timeout != ACE_Time_Value::zero;
+
+  // The read timeout runs from the first byte of the request
+  if (reading && reading_)
+    return;
+  reading_ = reading;
+  timeouts_->wheel->schedule(&timer_,
+			     this,
+			     reading
+			     ? timeouts_->read_timeout
+			     : timeouts_->idle_timeout);
+}
+
+void Echo_Svc_Handler::cancel_timeout(void)
+{
+  if (timeouts_ != 0 && timeouts_->wheel != 0)
+    timeouts_->wheel->cancel(&timer_);
+}
+
+size_t Echo_Svc_Handler::enter_pool(void)
+{
+  ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, worker_);
+  ++in_pool_;
+  return worker_;
+}
+
+void Echo_Svc_Handler::leave_pool(void)
+{
+  ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+  --in_pool_;
+}
+
+bool Echo_Svc_Handler::hand_over(size_t thief)
+{
+  ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, false);
+  if (in_pool_ != 1)
+    return false;
+  worker_ = thief;
+  return true;
+}
+
+int Echo_Svc_Handler::open(void *arg)
+{
+  echo_task_->counters()->add(Server_Counters::ACCEPTED);
+  accepted_ = true;
+
+  // ACE_Acceptor::activate_svc_handler() has already applied the
+  // acceptor's ACE_NONBLOCK flag to the connection (epoll); replies need
+  // it to be non-blocking in any case
+  drain_ = ACE_BIT_ENABLED(ACE::get_flags(this->get_handle()), ACE_NONBLOCK);
+  if (!drain_ && this->peer().enable(ACE_NONBLOCK) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "enable"), -1);
+
+  // The output backlog is bounded by suspending input, so the queue
+  // itself must never block a worker
+  this->msg_queue()->high_water_mark(ACE_Numeric_Limits<size_t>::max());
+
+  if (ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_MT_SYNCH >::open(arg) == -1)
+    return -1;
+  this->touch();
+  return 0;
+}
+
+
+
+//  Implement its handle_input() hook method to perform the "Half-Async" 
+int Echo_Svc_Handler::handle_input(ACE_HANDLE)
+{
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) Echo_Svc_Handler::handle_input\n"));
+
+
+  // Reads the client data [ACE_SOCK_Stream] until the end of a line is reached,
+  // straight into a pooled buffer that is then handed over to the pool threads
+  ssize_t recv_cnt;
+
+  do
+    {
+      // Stops reading from a client that does not read its replies;
+      // handle_output() resumes once the backlog has drained
+      if (this->msg_queue()->message_bytes() >= OUTPUT_HIGH_WATER)
+	{
+	  input_suspended_ = true;
+	  return this->reactor()->cancel_wakeup(this,
+						ACE_Event_Handler::READ_MASK) == -1 ? -1 : 0;
+	}
+
+      // In HTTP mode the block is kept for the next read
+      bool http = echo_task_->is_http();
+      ACE_Message_Block *data = http
+	? this->request_block()
+	: message_pools_->make_block(Message_Pools::BUFFER_SIZE);
+      if (data == 0)
+	return -1;
+
+      recv_cnt = this->peer().recv(data->wr_ptr(), data->space());
+      echo_task_->counters()->add(Server_Counters::RECVS);
+      if (recv_cnt <= 0) {
+	bool drained = recv_cnt == -1 && errno == EWOULDBLOCK;
+	if (!http)
+	  data->release();
+	if (drained)
+	  return 0; // The reactor reports the next arrival
+	if (recv_cnt == 0)
+	  return this->input_over();
+	ECHO_LOG((LM_DEBUG, "(%t) connection closed \n"));
+	return -1;
+      }
+      data->wr_ptr(recv_cnt);
+      if (this->received(data, recv_cnt) == -1)
+	return -1;
+      this->check_admission();
+    }
+  while (drain_ && !overload_suspended_);
+
+  return 0;
+}
+
+int Echo_Svc_Handler::received(ACE_Message_Block *data, size_t length)
+{
+  received_ = Stage_Stats::now();
+  echo_task_->counters()->add(Server_Counters::BYTES_IN, length);
+  if (accept_time_ != 0)
+    {
+      echo_task_->stage_stats()->record(Stage_Stats::FIRST_BYTE,
+					received_ - accept_time_);
+      accept_time_ = 0;
+    }
+
+  if ((echo_task_->is_http()
+       ? this->queue_requests()
+       : this->queue_request(data)) == -1)
+    return -1;
+  this->touch();
+  return 0;
+}
+
+int Echo_Svc_Handler::input_over(void)
+{
+  ECHO_LOG((LM_DEBUG, "(%t) client closed its side \n"));
+  if (this->reactor()->cancel_wakeup(this,
+				     ACE_Event_Handler::READ_MASK) == -1)
+    return -1;
+
+  // Whoever drops the last reference afterwards has the reactor close
+  // the connection (see handle_close())
+  ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+  input_over_ = true;
+  return queued_count_ == 0 ? -1 : 0;
+}
+
+int Echo_Svc_Handler::queue_request(ACE_Message_Block *data)
+{
+  // Overloaded: a connection with nothing in progress is turned away at
+  // once if shedding, as its reply cannot overtake an earlier one
+  if (echo_task_->overloaded() && echo_task_->admission()->shed)
+    {
+      bool idle = false;
+      {
+	ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+	idle = queued_count_ == 0;
+      }
+      if (idle)
+	return this->shed(data);
+    }
+
+  // Prepends a block that identifies this handler, so the worker thread
+  // that dequeues the message knows where to send the reply
+  ACE_Message_Block *mb = message_pools_->make_stamp();
+  if (mb == 0)
+    {
+      data->release();
+      return -1;
+    }
+  Request_Stamp *stamp = Request_Stamp::of(mb);
+  stamp->handler = this;
+  stamp->received = received_;
+  mb->cont(data);
+
+  // Calls Echo_Task::put(), which uses ACE_Task::putq() to enqueue the message 
+  // for subsequent processing by a thread in the pool of threads that are running
+  // the Echo_Task::svc() hook method.  
+  // The count is raised first, since in Leader/Followers mode put()
+  // processes the message, and releases it, before returning.
+  {
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+    ++queued_count_;
+
+    // In HTTP mode a batch waits for the previous one to be answered;
+    // next_batch() queues it then
+    if (batch_in_flight_)
+      {
+	if (held_tail_ != 0)
+	  held_tail_->next(mb);
+	else
+	  held_head_ = mb;
+	held_tail_ = mb;
+	return 0;
+      }
+    batch_in_flight_ = echo_task_->is_http();
+  }
+
+  if (echo_task_->put(mb) == -1)
+    {
+      mb->release();
+      ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+      --queued_count_;
+      return -1;
+    }
+
+  return 0;
+}
+
+int Echo_Svc_Handler::shed(ACE_Message_Block *data)
+{
+  data->release();
+  echo_task_->counters()->add(Server_Counters::SHED);
+
+  // An HTTP client is told to come back later, on a new connection
+  bool http = echo_task_->is_http();
+  if (http)
+    input_closed_ = true;
+
+  iovec iov;
+  iov.iov_base = const_cast<char *> (http ? HTTP_OVERLOAD_REPLY
+					  : OVERLOAD_REPLY);
+  iov.iov_len = http ? sizeof HTTP_OVERLOAD_REPLY - 1
+		     : sizeof OVERLOAD_REPLY - 1;
+  return this->send_reply(&iov, 1, http);
+}
+
+void Echo_Svc_Handler::check_admission(void)
+{
+  if (overload_suspended_ || !echo_task_->overloaded())
+    return;
+
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+    if (queued_count_ < 2)
+      return;
+
+    // Keeps the handler alive until readmit()
+    ++queued_count_;
+  }
+
+  overload_suspended_ = true;
+  echo_task_->counters()->add(Server_Counters::SUSPENDED);
+  if (!input_suspended_
+      && this->reactor()->cancel_wakeup(this,
+					ACE_Event_Handler::READ_MASK) == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "cancel_wakeup"));
+  echo_task_->suspend(this);
+}
+
+void Echo_Svc_Handler::readmit(void)
+{
+  overload_suspended_ = false;
+  bool closing = false;
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+    closing = deferred_close_;
+  }
+
+  // Reading resumes unless the output backlog keeps it suspended, in
+  // which case handle_output() resumes it later
+  if (!closing
+      && !input_suspended_
+      && this->reactor()->schedule_wakeup(this,
+					  ACE_Event_Handler::READ_MASK) == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "schedule_wakeup"));
+
+  // Drops the reference held while suspended
+  this->handle_close(ACE_INVALID_HANDLE, 0);
+}
+
+ACE_Message_Block *Echo_Svc_Handler::request_block(void)
+{
+  if (pending_ != 0 && pending_->space() > 0)
+    return pending_;
+
+  if (pending_ != 0 && pending_->length() == Message_Pools::BUFFER_SIZE)
+    ACE_ERROR_RETURN((LM_ERROR,
+		      ACE_TEXT("(%t) request larger than %d bytes\n"),
+		      (int) Message_Pools::BUFFER_SIZE),
+		     0);
+
+  ACE_Message_Block *mb =
+    message_pools_->make_block(Message_Pools::BUFFER_SIZE);
+  if (mb == 0)
+    return 0;
+
+  // The incomplete request moves to the new buffer, since queued requests
+  // may still refer to the old one
+  if (pending_ != 0)
+    {
+      mb->copy(pending_->rd_ptr(), pending_->length());
+      pending_->release();
+    }
+  pending_ = mb;
+  return mb;
+}
+
+int Echo_Svc_Handler::queue_requests(void)
+{
+  for (;;)
+    {
+      // The complete requests at the head of pending_, at most MAX_BATCH
+      size_t length = 0;
+      int count = 0;
+      HTTP_Parser::Result result = HTTP_Parser::INCOMPLETE;
+      while (count < HTTP_Reply::MAX_BATCH
+	     && !input_closed_
+	     && (result = parser_.parse(pending_->rd_ptr() + length,
+					pending_->length() - length))
+		== HTTP_Parser::COMPLETE)
+	{
+	  length += parser_.request().length;
+	  input_closed_ = !parser_.request().keep_alive;
+	  ++count;
+	  parser_.next();
+	}
+
+      if (count > 0)
+	{
+	  // The batch shares pending_'s buffer
+	  ACE_Message_Block *batch = pending_->duplicate();
+	  if (batch == 0)
+	    return -1;
+	  batch->wr_ptr(batch->rd_ptr() + length);
+	  pending_->rd_ptr(length);
+
+	  ECHO_LOG((LM_DEBUG,
+		    "(%t) queueing %d requests\n",
+		    count));
+	  if (this->queue_request(batch) == -1)
+	    return -1;
+	}
+
+      // A malformed request is queued like the others, so that its 400
+      // response follows theirs, and ends the connection's input
+      if (result == HTTP_Parser::INVALID)
+	{
+	  ACE_ERROR((LM_ERROR,
+		     ACE_TEXT("(%t) malformed request\n")));
+	  input_closed_ = true;
+	  ACE_Message_Block *bad = pending_->duplicate();
+	  if (bad == 0)
+	    return -1;
+	  pending_->rd_ptr(pending_->wr_ptr());
+	  return this->queue_request(bad);
+	}
+
+      if (input_closed_)
+	{
+	  pending_->rd_ptr(pending_->wr_ptr());
+	  return 0;
+	}
+      if (count < HTTP_Reply::MAX_BATCH)
+	return 0;
+    }
+}
+
+void Echo_Svc_Handler::next_batch(void)
+{
+  for (;;)
+    {
+      ACE_Message_Block *mb = 0;
+      {
+	ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+	mb = held_head_;
+	if (mb == 0)
+	  {
+	    batch_in_flight_ = false;
+	    return;
+	  }
+	held_head_ = mb->next();
+	if (held_head_ == 0)
+	  held_tail_ = 0;
+	mb->next(0);
+      }
+
+      if (echo_task_->put(mb) != -1)
+	return;
+
+      // Shutting down: the batch is dropped, and the next one tried. The
+      // handler is not touched after dropping its last message, which may
+      // destroy it.
+      ACE_ERROR((LM_ERROR, "(%t) %p\n", "put"));
+      mb->release();
+      bool more = false;
+      {
+	ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+	more = held_head_ != 0;
+	if (!more)
+	  batch_in_flight_ = false;
+      }
+      this->handle_close(ACE_INVALID_HANDLE, 0);
+      if (!more)
+	return;
+    }
+}
+
+int Echo_Svc_Handler::handle_output(ACE_HANDLE)
+{
+  ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, output_lock_, -1);
+
+  ACE_Message_Block *mb = 0;
+  while (!this->msg_queue()->is_empty())
+    {
+      this->getq(mb);
+      ssize_t send_cnt = this->peer().send(mb->rd_ptr(), mb->length());
+      echo_task_->counters()->add(Server_Counters::SENDS);
+      if (send_cnt == -1 && errno != EWOULDBLOCK)
+	{
+	  mb->release();
+	  ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "send"), -1);
+	}
+      if (send_cnt > 0)
+	{
+	  mb->rd_ptr(send_cnt);
+	  echo_task_->counters()->add(Server_Counters::BYTES_OUT, send_cnt);
+	}
+      if (mb->length() > 0)
+	{
+	  // The socket is full again
+	  this->ungetq(mb);
+	  break;
+	}
+      mb->release();
+    }
+
+  size_t pending = this->msg_queue()->message_bytes();
+  if (input_suspended_ && pending <= OUTPUT_LOW_WATER)
+    {
+      input_suspended_ = false;
+      if (!overload_suspended_
+	  && this->reactor()->schedule_wakeup(this,
+					   ACE_Event_Handler::READ_MASK) == -1)
+	return -1;
+    }
+
+  if (pending > 0)
+    return 0;
+
+  // Still under output_lock_, so a worker that queues more output after
+  // this sees write_scheduled_ cleared and schedules WRITE_MASK again
+  if (close_after_output_)
+    this->peer().close_writer();
+  if (this->reactor()->cancel_wakeup(this,
+				     ACE_Event_Handler::WRITE_MASK) == -1)
+    return -1;
+  bool drop = write_scheduled_;
+  write_scheduled_ = false;
+  guard.release();
+
+  // Drops the reference the output held. The last one closes the
+  // connection if the client's input is over, from the reactor's thread,
+  // which is the only one that may remove the handler while registered.
+  if (!drop)
+    return 0;
+  ACE_GUARD_RETURN(ACE_Thread_Mutex, count_guard, lock_, -1);
+  --queued_count_;
+  return queued_count_ == 0 && input_over_ ? -1 : 0;
+}
+
+int Echo_Svc_Handler::handle_timeout(const ACE_Time_Value &, const void *)
+{
+  // A client that only leaves its replies unread is not busy
+  bool busy = false;
+  {
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, output_guard, output_lock_, 0);
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, 0);
+    busy = queued_count_ > (write_scheduled_ ? 1 : 0);
+  }
+  if (busy)
+    {
+      timeouts_->wheel->schedule(&timer_, this, timeouts_->idle_timeout);
+      return 0;
+    }
+
+  echo_task_->counters()->add(Server_Counters::TIMED_OUT);
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) connection timed out\n"));
+
+  // Closing the connection here could pull the handler from under an
+  // upcall running on another thread (Leader/Followers); the reactor
+  // delivers the end of the connection to whichever thread may close it
+  ACE_OS::shutdown(this->get_handle(), ACE_SHUTDOWN_BOTH);
+  return 0;
+}
+
+int Echo_Svc_Handler::send_reply(const iovec iov[], int iovcnt, bool last)
+{
+  size_t length = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    length += iov[i].iov_len;
+
+  bool schedule = false;
+  {
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, output_lock_, -1);
+    if (last)
+      close_after_output_ = true;
+
+    // Nothing may overtake output that is already queued. The engine
+    // of -r uring sends everything itself.
+    size_t sent = 0;
+    if (this->msg_queue()->is_empty() && uring_ == 0)
+      {
+	ssize_t send_cnt = this->peer().sendv(iov, iovcnt);
+	echo_task_->counters()->add(Server_Counters::SENDS);
+	if (send_cnt == -1 && errno != EWOULDBLOCK)
+	  return -1;
+	if (send_cnt > 0)
+	  {
+	    sent = send_cnt;
+	    echo_task_->counters()->add(Server_Counters::BYTES_OUT, sent);
+	  }
+	if (sent == length)
+	  {
+	    if (last)
+	      this->peer().close_writer();
+	    return 0;
+	  }
+      }
+
+    ACE_Message_Block *mb = 0;
+    ACE_NEW_RETURN(mb, ACE_Message_Block(length - sent), -1);
+    for (int i = 0; i < iovcnt; ++i)
+      {
+	size_t skip = sent < iov[i].iov_len ? sent : iov[i].iov_len;
+	sent -= skip;
+	mb->copy(static_cast<const char *> (iov[i].iov_base) + skip,
+		 iov[i].iov_len - skip);
+      }
+
+    if (this->putq(mb) == -1)
+      {
+	mb->release();
+	return -1;
+      }
+
+    // The output holds a reference until it has been sent. A connection
+    // that failed has already left the reactor: its output is dropped.
+    schedule = !write_scheduled_;
+    if (schedule)
+      {
+	ACE_GUARD_RETURN(ACE_Thread_Mutex, count_guard, lock_, -1);
+	if (deferred_close_ && uring_ == 0)
+	  {
+	    this->msg_queue()->flush();
+	    return 0;
+	  }
+	++queued_count_;
+      }
+    write_scheduled_ = true;
+  }
+
+#if defined (ECHO_HAS_IO_URING)
+  if (schedule && uring_ != 0)
+    {
+      uring_->post(this);
+      return 0;
+    }
+#endif /* ECHO_HAS_IO_URING */
+
+  // Outside output_lock_: the reactor's thread may be waiting for it
+  // while holding the reactor's own lock
+  if (schedule
+      && this->reactor()->schedule_wakeup(this,
+					  ACE_Event_Handler::WRITE_MASK) == -1)
+    {
+      // Nothing will send the output: it goes, with its reference, unless
+      // handle_close() has dropped them meanwhile
+      int error = errno;
+      bool drop = false;
+      {
+	ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, output_lock_, -1);
+	drop = write_scheduled_;
+	write_scheduled_ = false;
+	this->msg_queue()->flush();
+      }
+      if (drop)
+	this->handle_close(ACE_INVALID_HANDLE, 0);
+      errno = error;
+      return -1;
+    }
+  return 0;
+}
+
+/**
+ * A valid handle means the reactor is closing the connection: the handler is
+ * destroyed at once unless messages are still queued, in which case it is
+ * only marked for a deferred close, and removed from the reactor so that it
+ * gets no further upcalls. Output still queued is dropped, since
+ * handle_output() will not send it. ACE_INVALID_HANDLE means a worker thread
+ * released one message; the last one performs the deferred close.
+ *
+ * Once the client's input is over, the last message released instead
+ * becomes a reference of the output, and WRITE_MASK is scheduled, so that
+ * handle_output() closes the connection from the reactor's thread. With no
+ * event left registered, nothing else may close it meanwhile.
+ */
+int Echo_Svc_Handler::handle_close(ACE_HANDLE handle, ACE_Reactor_Mask mask)
+{
+  bool close_now = false;
+  bool hand_over = false;
+  {
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, output_guard, output_lock_, -1);
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+    if (handle != ACE_INVALID_HANDLE)
+      {
+	if (write_scheduled_ && uring_ == 0)
+	  {
+	    this->msg_queue()->flush();
+	    write_scheduled_ = false;
+	    --queued_count_;
+	  }
+	if (queued_count_ == 0)
+	  close_now = true;
+	else
+	  deferred_close_ = true;
+      }
+    else if (queued_count_ == 1
+	     && input_over_
+	     && !deferred_close_
+	     && uring_ == 0)
+      {
+	write_scheduled_ = true;
+	hand_over = true;
+      }
+    else
+      {
+	--queued_count_;
+	if (queued_count_ == 0)
+	  close_now = deferred_close_;
+      }
+  }
+
+  if (hand_over)
+    {
+      if (this->reactor()->schedule_wakeup(this,
+					  ACE_Event_Handler::WRITE_MASK) != -1)
+	return 0;
+      ACE_ERROR((LM_ERROR, "(%t) %p\n", "schedule_wakeup"));
+      {
+	ACE_GUARD_RETURN(ACE_Thread_Mutex, output_guard, output_lock_, -1);
+	ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+	write_scheduled_ = false;
+	queued_count_ = 0;
+      }
+      close_now = true;
+    }
+
+  if (close_now)
+    return ACE_Svc_Handler < ACE_SOCK_STREAM, ACE_MT_SYNCH >::handle_close(handle, mask);
+
+  // The reactor only unregistered the mask whose upcall failed; queued
+  // output may still have WRITE_MASK (or READ_MASK) registered
+  if (handle != ACE_INVALID_HANDLE && this->reactor() != 0)
+    this->reactor()->remove_handler(this,
+				    ACE_Event_Handler::ALL_EVENTS_MASK
+				    | ACE_Event_Handler::DONT_CALL);
+  return 0;
+}
+
+#if defined (ECHO_HAS_IO_URING)
+void Echo_Svc_Handler::uring_open(Uring_Engine *engine)
+{
+  echo_task_->counters()->add(Server_Counters::ACCEPTED);
+  accepted_ = true;
+  uring_ = engine;
+  uring_receiving_ = true;
+
+  // The engine's thread performs all the I/O of the connection, which
+  // therefore stays blocking, and no reactor ever sees it
+  this->reactor(0);
+  this->msg_queue()->high_water_mark(ACE_Numeric_Limits<size_t>::max());
+  this->touch();
+}
+
+int Echo_Svc_Handler::uring_receive(Uring &ring)
+{
+  io_uring_sqe *sqe = ring.sqe();
+  if (sqe == 0)
+    return -1;
+
+  // Every completion carries one of the engine's buffers, until the
+  // input is over or the receive is cancelled
+  Uring::prep(sqe,
+	      IORING_OP_RECV,
+	      this->get_handle(),
+	      0,
+	      0,
+	      Uring::tag(this, Uring_Engine::RECV));
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = Uring_Engine::BUFFER_GROUP;
+  uring_armed_ = true;
+  return 0;
+}
+
+int Echo_Svc_Handler::uring_input(Uring &ring,
+				  const char *buf,
+				  size_t length)
+{
+  // The buffer goes back to the kernel right away, so the data is copied
+  // into pooled blocks, as handle_input() would have received it
+  bool http = echo_task_->is_http();
+  while (length > 0)
+    {
+      ACE_Message_Block *data = http
+	? this->request_block()
+	: message_pools_->make_block(Message_Pools::BUFFER_SIZE);
+      if (data == 0)
+	return -1;
+      size_t n = length < data->space() ? length : data->space();
+      data->copy(buf, n);
+      buf += n;
+      length -= n;
+      if (this->received(data, n) == -1)
+	return -1;
+    }
+
+  // Stops receiving from a client that does not read its replies;
+  // uring_flush() resumes once the backlog has drained
+  if (!input_suspended_
+      && this->msg_queue()->message_bytes() >= OUTPUT_HIGH_WATER)
+    {
+      io_uring_sqe *sqe = ring.sqe();
+      if (sqe == 0)
+	return -1;
+      Uring::prep(sqe,
+		  IORING_OP_ASYNC_CANCEL,
+		  -1,
+		  0,
+		  0,
+		  Uring::tag(0, Uring_Engine::CANCEL));
+      sqe->addr = Uring::tag(this, Uring_Engine::RECV);
+      input_suspended_ = true;
+    }
+  return 0;
+}
+
+void Echo_Svc_Handler::uring_rearm(Uring &ring, int res)
+{
+  uring_armed_ = false;
+
+  // Cancelled for the output backlog: uring_flush() re-arms it
+  if (res == -ECANCELED && input_suspended_)
+    return;
+
+  // A multishot receive also ends when the buffers ran out, or when it
+  // was cancelled but the backlog has drained meanwhile
+  if ((res > 0 || res == -ENOBUFS || res == -ECANCELED)
+      && this->uring_receive(ring) == 0)
+    return;
+
+  ECHO_LOG((LM_DEBUG, "(%t) connection closed \n"));
+  uring_receiving_ = false;
+}
+
+void Echo_Svc_Handler::uring_flush(Uring &ring)
+{
+  if (input_suspended_
+      && uring_receiving_
+      && this->msg_queue()->message_bytes() <= OUTPUT_LOW_WATER)
+    {
+      // The receive may not have ended yet, in which case uring_rearm()
+      // re-arms it when it does
+      input_suspended_ = false;
+      if (!uring_armed_ && this->uring_receive(ring) == -1)
+	{
+	  input_suspended_ = true;
+	  ACE_ERROR((LM_ERROR, "(%t) %p\n", "uring_receive"));
+	}
+    }
+
+  // Room for a whole chain, so that it is not cut in two
+  if (!uring_failed_ && ring.reserve(URING_CHAIN + 1) == -1)
+    this->uring_fail(errno, "io_uring_enter");
+
+  int count = 0;
+  bool close_writer = false;
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, output_lock_);
+
+    // A client that only closed its side still gets its replies; once an
+    // operation failed nothing more is sent
+    if (uring_failed_)
+      {
+	this->msg_queue()->flush();
+	close_after_output_ = false;
+      }
+
+    ACE_Message_Block *mb = 0;
+    while (count < URING_CHAIN
+	   && !this->msg_queue()->is_empty()
+	   && this->getq(mb) != -1)
+      {
+	if (uring_sending_tail_ != 0)
+	  uring_sending_tail_->next(mb);
+	else
+	  uring_sending_ = mb;
+	uring_sending_tail_ = mb;
+	++count;
+      }
+
+    close_writer = close_after_output_ && this->msg_queue()->is_empty();
+    if (close_writer)
+      close_after_output_ = false;
+
+    // Still under output_lock_, so that a worker that queues more output
+    // after this posts the handler again
+    if (count == 0 && !close_writer)
+      write_scheduled_ = false;
+  }
+
+  if (count == 0 && !close_writer)
+    {
+      // Drops the reference the output held
+      this->handle_close(ACE_INVALID_HANDLE, 0);
+      return;
+    }
+
+  // MSG_WAITALL: a send completes short only if the connection failed,
+  // which cancels the rest of the chain
+  ACE_HANDLE handle = this->get_handle();
+  for (ACE_Message_Block *mb = uring_sending_; mb != 0; mb = mb->next())
+    {
+      io_uring_sqe *sqe = ring.sqe();
+      Uring::prep(sqe,
+		  IORING_OP_SEND,
+		  handle,
+		  mb->rd_ptr(),
+		  static_cast<unsigned> (mb->length()),
+		  Uring::tag(this, Uring_Engine::SEND));
+      sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+      if (mb->next() != 0 || close_writer)
+	sqe->flags = IOSQE_IO_LINK;
+    }
+  if (close_writer)
+    Uring::prep(ring.sqe(),
+		IORING_OP_SHUTDOWN,
+		handle,
+		0,
+		SHUT_WR,
+		Uring::tag(this, Uring_Engine::SHUTDOWN));
+  uring_in_flight_ = count + (close_writer ? 1 : 0);
+}
+
+int Echo_Svc_Handler::uring_sent(int res, bool data)
+{
+  if (data)
+    {
+      ACE_Message_Block *mb = uring_sending_;
+      uring_sending_ = mb->next();
+      if (uring_sending_ == 0)
+	uring_sending_tail_ = 0;
+      mb->next(0);
+      if (res > 0)
+	echo_task_->counters()->add(Server_Counters::BYTES_OUT, res);
+      if (res != static_cast<int> (mb->length()))
+	this->uring_fail(res < 0 ? -res : EPIPE, "send");
+      mb->release();
+    }
+  else if (res < 0)
+    this->uring_fail(-res, "shutdown");
+  return --uring_in_flight_;
+}
+
+bool Echo_Svc_Handler::uring_receiving(void) const
+{
+  return uring_receiving_;
+}
+
+bool Echo_Svc_Handler::uring_idle(void) const
+{
+  return !uring_receiving_ && uring_in_flight_ == 0 && !uring_closed_;
+}
+
+void Echo_Svc_Handler::uring_abort(void)
+{
+  while (uring_sending_ != 0)
+    {
+      ACE_Message_Block *mb = uring_sending_;
+      uring_sending_ = mb->next();
+      mb->release();
+    }
+  uring_sending_tail_ = 0;
+  uring_in_flight_ = 0;
+  uring_receiving_ = false;
+
+  bool drop = false;
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, output_lock_);
+    this->msg_queue()->flush();
+    drop = write_scheduled_;
+    write_scheduled_ = false;
+  }
+  if (drop)
+    this->handle_close(ACE_INVALID_HANDLE, 0);
+}
+
+void Echo_Svc_Handler::uring_fail(int error, const char *what)
+{
+  // The operations linked after the failed one complete with ECANCELED
+  if (uring_failed_)
+    return;
+  uring_failed_ = true;
+  errno = error;
+  ACE_ERROR((LM_ERROR, "(%t) %p\n", what));
+  ACE_OS::shutdown(this->get_handle(), ACE_SHUTDOWN_BOTH);
+}
+#endif /* ECHO_HAS_IO_URING */
+
+
+
+	
+Echo_Acceptor::Echo_Acceptor()
+  : echo_task_(0),
+    message_pools_(0),
+    handler_pool_(0),
+    timeouts_(0)
+{
+}
+
+// Echo_Task setter
+void Echo_Acceptor::echo_task(Echo_Task *et)
+{
+  echo_task_ = et;
+}
+
+// Message_Pools setter
+void Echo_Acceptor::message_pools(Message_Pools *mp)
+{
+  message_pools_ = mp;
+}
+
+void Echo_Acceptor::handler_pool(Echo_Handler_Pool *hp)
+{
+  handler_pool_ = hp;
+}
+
+void Echo_Acceptor::timeouts(const Connection_Timeouts *ct)
+{
+  timeouts_ = ct;
+}
+	
+/**
+ * Bridge method used to create the new service handler object [Echo_Svc_Handler].
+ * Customized to perform Echo_Svc_Handler creation and set a pointer to the Echo_Task
+ * Returns -1 on failure, else 0.
+ */
+int Echo_Acceptor::make_svc_handler(Echo_Svc_Handler *&sh)
+{
+  ECHO_LOG((LM_DEBUG,
+	    "(%t) Echo_Acceptor::make_svc_handler\n"));
+
+  ACE_hrtime_t now = Stage_Stats::now();
+  if (sh == 0 && handler_pool_ != 0 && (sh = handler_pool_->take()) == 0)
+    return -1;
+  if (sh == 0)
+    ACE_NEW_RETURN(sh,
+		   Echo_Svc_Handler,
+		   -1);
+  sh->accept_time(now);
+
+  /// Assign to each new handler the same thread pool
+  sh->echo_task(this->echo_task_);
+  sh->message_pools(this->message_pools_);
+  sh->timeouts(this->timeouts_);
+
+  // Set the reactor of the newly created <SVC_HANDLER> to the same
+  // reactor that this <ACE_Acceptor> is using.
+  sh->reactor(this->reactor());
+  return 0;
+}
+
+
+#if defined (ECHO_HAS_IO_URING)
+Uring_Engine::Uring_Engine(Echo_Acceptor &acceptor, Echo_Task *et)
+  : acceptor_(acceptor),
+    echo_task_(et),
+    wake_fd_(-1),
+    wake_count_(0),
+    connections_(0),
+    posted_(0),
+    sleeping_(false),
+    done_(false),
+    enters_(0)
+{
+}
+
+Uring_Engine::~Uring_Engine()
+{
+  listener_.close();
+  if (wake_fd_ != -1)
+    ACE_OS::close(wake_fd_);
+}
+
+int Uring_Engine::listen(const ACE_INET_Addr &addr)
+{
+  if (ring_.open(ENTRIES) == -1
+      || ring_.buffers(BUFFER_GROUP, BUFFERS, BUFFER_SIZE) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "io_uring"), -1);
+  if (listener_.open(addr, 1) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "listen"), -1);
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "eventfd"), -1);
+
+  if (this->arm_accept() == -1
+      || this->arm_wake() == -1
+      || ring_.enter(0) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "io_uring_enter"), -1);
+  return 0;
+}
+
+void Uring_Engine::post(Echo_Svc_Handler *sh)
+{
+  sh->uring_posted_ = posted_.load(std::memory_order_relaxed);
+  while (!posted_.compare_exchange_weak(sh->uring_posted_, sh))
+    ;
+
+  // Ordered after the push: either the engine sees the handler before it
+  // goes to sleep, or this sees it asleep
+  if (sleeping_.load())
+    this->wake();
+}
+
+void Uring_Engine::stop(void)
+{
+  done_.store(true);
+  this->wake();
+}
+
+void Uring_Engine::finish(void)
+{
+  ring_.close();
+
+  for (Echo_Svc_Handler *sh = posted_.exchange(0); sh != 0; )
+    {
+      Echo_Svc_Handler *next = sh->uring_posted_;
+      sh->uring_posted_ = 0;
+      sh->uring_abort();
+      sh = next;
+    }
+
+  while (connections_ != 0)
+    {
+      Echo_Svc_Handler *sh = connections_;
+      sh->uring_abort();
+      this->close_connection(sh);
+    }
+}
+
+int Uring_Engine::svc(void)
+{
+  // The engine does the reactor thread's job, so it goes where that would
+  const Thread_Placement *placement = echo_task_->placement();
+  if (placement != 0 && placement->pin_reactor() == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "pin engine"));
+
+  Server_Counters *counters = echo_task_->counters();
+  while (!done_.load())
+    {
+      bool busy = this->flush_posted();
+
+      // Each completion is copied out, so that its slot is free for the
+      // kernel again before it is handled
+      for (io_uring_cqe *cqe; (cqe = ring_.peek()) != 0; busy = true)
+	{
+	  io_uring_cqe completion = *cqe;
+	  ring_.advance();
+	  this->dispatch(completion);
+	}
+
+      // Busy, submits what the completions brought about, which takes no
+      // system call if nothing did. Idle, waits for a completion or a
+      // post(), which writes the eventfd once it sees sleeping_ set.
+      int result = 0;
+      if (busy)
+	result = ring_.enter(0);
+      else
+	{
+	  sleeping_.store(true);
+	  if (posted_.load() == 0 && !done_.load())
+	    result = ring_.enter(1);
+	  sleeping_.store(false);
+	}
+      if (result == -1 && errno != EINTR)
+	ACE_ERROR((LM_ERROR, "(%t) %p\n", "io_uring_enter"));
+
+      if (ring_.enters() != enters_)
+	{
+	  counters->add(Server_Counters::RING_CALLS, ring_.enters() - enters_);
+	  enters_ = ring_.enters();
+	}
+    }
+  return 0;
+}
+
+void Uring_Engine::dispatch(const io_uring_cqe &cqe)
+{
+  Echo_Svc_Handler *sh =
+    static_cast<Echo_Svc_Handler *> (Uring::pointer(cqe.user_data));
+  unsigned operation = Uring::tag_of(cqe.user_data);
+  switch (operation)
+    {
+    case ACCEPT:
+      this->accepted(cqe);
+      break;
+    case WAKE:
+      if (this->arm_wake() == -1)
+	ACE_ERROR((LM_ERROR, "(%t) %p\n", "arm_wake"));
+      break;
+    case RECV:
+      this->received(sh, cqe);
+      break;
+    case SEND:
+    case SHUTDOWN:
+      // Once the whole chain is in, the next one goes out
+      if (sh->uring_sent(cqe.res, operation == SEND) == 0)
+	{
+	  sh->uring_flush(ring_);
+	  if (sh->uring_idle())
+	    this->close_connection(sh);
+	}
+      break;
+    default:
+      // A cancellation, whose outcome shows in the receive cancelled
+      break;
+    }
+}
+
+void Uring_Engine::accepted(const io_uring_cqe &cqe)
+{
+  if (cqe.res < 0)
+    {
+      errno = -cqe.res;
+      ACE_ERROR((LM_ERROR, "(%t) %p\n", "accept"));
+    }
+  else
+    {
+      Echo_Svc_Handler *sh = 0;
+      if (acceptor_.make_svc_handler(sh) == -1)
+	{
+	  ACE_ERROR((LM_ERROR, "(%t) %p\n", "make_svc_handler"));
+	  ACE_OS::closesocket(cqe.res);
+	}
+      else
+	{
+	  sh->set_handle(cqe.res);
+	  sh->uring_open(this);
+	  if (sh->uring_receive(ring_) == -1)
+	    sh->handle_close(sh->get_handle(),
+			     ACE_Event_Handler::ALL_EVENTS_MASK);
+	  else
+	    this->add_connection(sh);
+	}
+    }
+
+  // The multishot accept stops on some errors
+  if (ACE_BIT_DISABLED(cqe.flags, IORING_CQE_F_MORE)
+      && this->arm_accept() == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "arm_accept"));
+}
+
+void Uring_Engine::received(Echo_Svc_Handler *sh, const io_uring_cqe &cqe)
+{
+  if (ACE_BIT_ENABLED(cqe.flags, IORING_CQE_F_BUFFER))
+    {
+      unsigned short bid =
+	static_cast<unsigned short> (cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      if (cqe.res > 0
+	  && sh->uring_input(ring_, ring_.buffer(bid), cqe.res) == -1)
+	ACE_OS::shutdown(sh->get_handle(), ACE_SHUTDOWN_BOTH);
+      ring_.recycle(bid);
+    }
+
+  if (ACE_BIT_DISABLED(cqe.flags, IORING_CQE_F_MORE))
+    {
+      sh->uring_rearm(ring_, cqe.res);
+      if (sh->uring_idle())
+	this->close_connection(sh);
+    }
+}
+
+bool Uring_Engine::flush_posted(void)
+{
+  Echo_Svc_Handler *sh = posted_.exchange(0);
+  if (sh == 0)
+    return false;
+
+  // The handler may be gone once flushed
+  while (sh != 0)
+    {
+      Echo_Svc_Handler *next = sh->uring_posted_;
+      sh->uring_posted_ = 0;
+      sh->uring_flush(ring_);
+      sh = next;
+    }
+  return true;
+}
+
+int Uring_Engine::arm_accept(void)
+{
+  io_uring_sqe *sqe = ring_.sqe();
+  if (sqe == 0)
+    return -1;
+  Uring::prep(sqe,
+	      IORING_OP_ACCEPT,
+	      listener_.get_handle(),
+	      0,
+	      0,
+	      Uring::tag(this, ACCEPT));
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  return 0;
+}
+
+int Uring_Engine::arm_wake(void)
+{
+  io_uring_sqe *sqe = ring_.sqe();
+  if (sqe == 0)
+    return -1;
+  Uring::prep(sqe,
+	      IORING_OP_READ,
+	      wake_fd_,
+	      &wake_count_,
+	      sizeof wake_count_,
+	      Uring::tag(this, WAKE));
+  return 0;
+}
+
+void Uring_Engine::wake(void)
+{
+  ACE_UINT64 one = 1;
+  if (ACE_OS::write(wake_fd_, &one, sizeof one) == -1 && errno != EAGAIN)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "eventfd"));
+  echo_task_->counters()->add(Server_Counters::RING_CALLS);
+}
+
+void Uring_Engine::add_connection(Echo_Svc_Handler *sh)
+{
+  sh->uring_prev_ = 0;
+  sh->uring_next_ = connections_;
+  if (connections_ != 0)
+    connections_->uring_prev_ = sh;
+  connections_ = sh;
+}
+
+void Uring_Engine::close_connection(Echo_Svc_Handler *sh)
+{
+  if (sh->uring_prev_ != 0)
+    sh->uring_prev_->uring_next_ = sh->uring_next_;
+  else
+    connections_ = sh->uring_next_;
+  if (sh->uring_next_ != 0)
+    sh->uring_next_->uring_prev_ = sh->uring_prev_;
+  sh->uring_prev_ = sh->uring_next_ = 0;
+  sh->uring_closed_ = true;
+
+  // The handler goes once its messages are answered
+  sh->handle_close(sh->get_handle(), ACE_Event_Handler::ALL_EVENTS_MASK);
+}
+#endif /* ECHO_HAS_IO_URING */
+
+
+Admin_Handler::Admin_Handler()
+  : acceptor_(0),
+    length_(0),
+    replied_(false)
+{
+}
+
+void Admin_Handler::acceptor(Admin_Acceptor *aa)
+{
+  acceptor_ = aa;
+}
+
+int Admin_Handler::handle_input(ACE_HANDLE)
+{
+  ssize_t recv_cnt = this->peer().recv(request_ + length_,
+				       sizeof request_ - 1 - length_);
+  if (recv_cnt <= 0)
+    return -1;
+  if (replied_)
+    return 0; // Discards whatever follows the request
+
+  length_ += recv_cnt;
+  request_[length_] = '\0';
+  if (ACE_OS::strchr(request_, '\n') == 0 && length_ < sizeof request_ - 1)
+    return 0;
+
+  if (ACE_OS::strncmp(request_, "log ", 4) == 0)
+    return this->set_log_level();
+
+  Stats_Report report(ACE_OS::strstr(request_, "json") != 0);
+  acceptor_->report(report);
+  report.finish();
+
+  char header[160];
+  int header_length = 0;
+  if (ACE_OS::strncmp(request_, "GET ", 4) == 0)
+    header_length =
+      ACE_OS::snprintf(header, sizeof header,
+		       "HTTP/1.0 200 OK\r\n"
+		       "Content-Type: %s\r\n"
+		       "Content-Length: %lu\r\n"
+		       "Connection: close\r\n\r\n",
+		       report.json() ? "application/json" : "text/plain",
+		       (unsigned long) report.length());
+
+  iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = header_length;
+  iov[1].iov_base = const_cast<char *> (report.text());
+  iov[1].iov_len = report.length();
+  if (this->peer().sendv_n(iov, 2) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "admin sendv_n"), -1);
+
+  this->peer().close_writer();
+  replied_ = true;
+  return 0;
+}
+
+int Admin_Handler::set_log_level(void)
+{
+  char *level = request_ + 4;
+  level[ACE_OS::strcspn(level, " \r\n")] = '\0';
+
+  ACE_Log_Priority threshold;
+  char reply[64];
+  int reply_length;
+  if (Binary_Log::parse(level, threshold) == -1)
+    reply_length = ACE_OS::snprintf(reply, sizeof reply,
+				    "unknown log level %.32s\n", level);
+  else
+    {
+      Binary_Log::instance()->threshold(threshold);
+      reply_length = ACE_OS::snprintf(reply, sizeof reply,
+				      "log level %s\n", level);
+    }
+
+  if (this->peer().send_n(reply, reply_length) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "admin send_n"), -1);
+
+  this->peer().close_writer();
+  replied_ = true;
+  return 0;
+}
+
+
+Admin_Acceptor::Admin_Acceptor(Echo_Task *et,
+			       Message_Pools *mp,
+			       Echo_Handler_Pool *hp)
+  : echo_task_(et),
+    message_pools_(mp),
+    handler_pool_(hp),
+    start_time_(ACE_OS::gettimeofday()),
+    last_time_(start_time_),
+    last_accepted_(0)
+{
+}
+
+int Admin_Acceptor::make_svc_handler(Admin_Handler *&sh)
+{
+  if (sh == 0)
+    ACE_NEW_RETURN(sh,
+		   Admin_Handler,
+		   -1);
+
+  sh->acceptor(this);
+  sh->reactor(this->reactor());
+  return 0;
+}
+
+void Admin_Acceptor::report(Stats_Report &report)
+{
+  Server_Counters *counters = echo_task_->counters();
+  ACE_Time_Value now = ACE_OS::gettimeofday();
+
+  // Read before the connections accepted, so that active never goes
+  // negative with connections closing meanwhile
+  ACE_UINT64 closed = counters->value(Server_Counters::CLOSED);
+  ACE_UINT64 accepted = counters->value(Server_Counters::ACCEPTED);
+
+  double rate = 0.0;
+  {
+    ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+    ACE_Time_Value elapsed = now - last_time_;
+    if (elapsed > ACE_Time_Value::zero)
+      rate = (accepted - last_accepted_)
+	/ (elapsed.sec() + elapsed.usec() / 1000000.0);
+    last_time_ = now;
+    last_accepted_ = accepted;
+  }
+
+  // Amortization of the queue operations and of the send system calls
+  ACE_UINT64 messages = counters->value(Server_Counters::MESSAGES);
+  ACE_UINT64 dequeued = counters->value(Server_Counters::DEQUEUED);
+  ACE_UINT64 dequeues = counters->value(Server_Counters::DEQUEUES);
+  ACE_UINT64 sends = counters->value(Server_Counters::SENDS);
+
+  // The I/O system calls behind them: receives and sends under a reactor
+  // (not counting its own demultiplexing), the ring's under -r uring
+  ACE_UINT64 recvs = counters->value(Server_Counters::RECVS);
+  ACE_UINT64 ring_calls = counters->value(Server_Counters::RING_CALLS);
+
+  ACE_UINT64 workers = echo_task_->thr_count();
+  ACE_UINT64 busy = counters->value(Server_Counters::BUSY);
+  if (busy > workers)
+    busy = workers;
+
+  report.add("uptime_seconds",
+	     static_cast<ACE_UINT64> ((now - start_time_).sec()));
+  report.add("connections_active", accepted - closed);
+  report.add("connections_accepted", accepted);
+  report.add("connections_timed_out",
+	     counters->value(Server_Counters::TIMED_OUT));
+  report.add("connections_suspended",
+	     counters->value(Server_Counters::SUSPENDED));
+  report.add("requests_shed", counters->value(Server_Counters::SHED));
+  report.add("overloaded",
+	     static_cast<ACE_UINT64> (echo_task_->overloaded() ? 1 : 0));
+  report.add("accepts_per_second", rate);
+  report.add("bytes_in", counters->value(Server_Counters::BYTES_IN));
+  report.add("bytes_out", counters->value(Server_Counters::BYTES_OUT));
+  report.add("messages", messages);
+  report.add("dequeues", dequeues);
+  report.add("messages_per_dequeue",
+	     dequeues == 0 ? 0.0 : (double) dequeued / dequeues);
+  report.add("sends", sends);
+  report.add("sends_per_message",
+	     messages == 0 ? 0.0 : (double) sends / messages);
+  report.add("recvs", recvs);
+  report.add("ring_syscalls", ring_calls);
+  report.add("syscalls_per_message",
+	     messages == 0
+	     ? 0.0
+	     : (double) (recvs + sends + ring_calls) / messages);
+  report.add("queue_depth",
+	     static_cast<ACE_UINT64> (echo_task_->queue_depth()));
+  report.add("workers", workers);
+  report.add("workers_busy", busy);
+  report.add("workers_idle", workers - busy);
+  report.add("log_dropped", Binary_Log::instance()->dropped());
+  report.add("handlers_allocated",
+	     static_cast<ACE_UINT64> (handler_pool_->allocations()));
+  message_pools_->report(report);
+}
+
+
+
+Server_Options::Server_Options()
+  : port(ACE_DEFAULT_SERVER_PORT),
+    model(HALF_SYNC_HALF_ASYNC),
+    lockfree_queue(false),
+    queue_capacity(Lockfree_Message_Queue::DEFAULT_CAPACITY),
+    reactor_type(SELECT_REACTOR),
+    stats_interval(0),
+    timer_workload(false),
+    http(false),
+    admin_port(0),
+    log_threshold(LM_DEBUG),
+    prewarm_handlers(0),
+    max_batch(1)
+{
+}
+
+int Server_Options::parse_args(int argc, ACE_TCHAR *argv[])
+{
+  ACE_Get_Opt get_opt(argc, argv, ACE_TEXT("m:q:c:r:s:w:l:p:a:t:g:d:k:i:b:o:n:x:"));
+
+  for (int c; (c = get_opt()) != -1; )
+    switch (c)
+      {
+      case 'm':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("hsha")) == 0)
+	  model = HALF_SYNC_HALF_ASYNC;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("steal")) == 0)
+	  model = WORK_STEALING;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("lf")) == 0)
+	  model = LEADER_FOLLOWERS;
+	else
+	  return -1;
+	break;
+      case 'q':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("lockfree")) == 0)
+	  lockfree_queue = true;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("mt")) == 0)
+	  lockfree_queue = false;
+	else
+	  return -1;
+	break;
+      case 'c':
+	{
+	  ACE_TCHAR *end = 0;
+	  long capacity = ACE_OS::strtol(get_opt.opt_arg(), &end, 10);
+	  if (end == get_opt.opt_arg()
+	      || *end != 0
+	      || capacity < 1
+	      || capacity > Lockfree_Message_Queue::MAX_CAPACITY)
+	    return -1;
+	  queue_capacity = capacity;
+	}
+	break;
+      case 'r':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("select")) == 0)
+	  reactor_type = SELECT_REACTOR;
+#if defined (ACE_HAS_EVENT_POLL) || defined (ACE_HAS_DEV_POLL)
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("epoll")) == 0)
+	  reactor_type = DEV_POLL_REACTOR;
+#endif /* ACE_HAS_EVENT_POLL || ACE_HAS_DEV_POLL */
+#if defined (ECHO_HAS_IO_URING)
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("uring")) == 0)
+	  reactor_type = URING;
+#endif /* ECHO_HAS_IO_URING */
+	else
+	  return -1;
+	break;
+      case 's':
+	stats_interval = ACE_OS::atoi(get_opt.opt_arg());
+	break;
+      case 'w':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("timer")) == 0)
+	  timer_workload = true;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("sleep")) == 0)
+	  timer_workload = false;
+	else
+	  return -1;
+	break;
+      case 'l':
+	if (latency.parse(get_opt.opt_arg()) == -1)
+	  return -1;
+	break;
+      case 'p':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("http")) == 0)
+	  http = true;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("raw")) == 0)
+	  http = false;
+	else
+	  return -1;
+	break;
+      case 'a':
+	admin_port = static_cast<u_short> (ACE_OS::atoi(get_opt.opt_arg()));
+	break;
+      case 't':
+	if (pool.parse_threads(get_opt.opt_arg()) == -1)
+	  return -1;
+	break;
+      case 'g':
+	if (pool.parse_policy(get_opt.opt_arg()) == -1)
+	  return -1;
+	break;
+      case 'd':
+	if (Binary_Log::parse(get_opt.opt_arg(), log_threshold) == -1)
+	  return -1;
+	break;
+      case 'k':
+	{
+	  ACE_TCHAR *end = 0;
+	  long handlers = ACE_OS::strtol(get_opt.opt_arg(), &end, 10);
+	  if (end == get_opt.opt_arg()
+	      || *end != 0
+	      || handlers < 0
+	      || handlers > ACE::max_handles())
+	    return -1;
+	  prewarm_handlers = handlers;
+	}
+	break;
+      case 'i':
+	if (timeouts.parse(get_opt.opt_arg()) == -1)
+	  return -1;
+	break;
+      case 'b':
+	if (admission.parse(get_opt.opt_arg()) == -1)
+	  return -1;
+	break;
+      case 'o':
+	if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("suspend")) == 0)
+	  admission.shed = false;
+	else if (ACE_OS::strcmp(get_opt.opt_arg(), ACE_TEXT("shed")) == 0)
+	  admission.shed = true;
+	else
+	  return -1;
+	break;
+      case 'n':
+	{
+	  int n = ACE_OS::atoi(get_opt.opt_arg());
+	  if (n < 1 || n > Echo_Task::MAX_BATCH)
+	    return -1;
+	  max_batch = n;
+	}
+	break;
+      case 'x':
+	if (placement.parse(get_opt.opt_arg()) == -1)
+	  return -1;
+	break;
+      default:
+	return -1;
+      }
+
+  if (get_opt.opt_ind() < argc)
+    port = ACE_OS::atoi(argv[get_opt.opt_ind()]);
+
+  return 0;
+}
+
+
+Latency_Model::Seed::Seed()
+  : value(static_cast<unsigned int> (ACE_OS::gettimeofday().usec())
+	  ^ static_cast<unsigned int> (reinterpret_cast<size_t> (this)))
+{
+}
+
+Latency_Model::Latency_Model()
+  : distribution_(FIXED),
+    a_(3000),
+    b_(0)
+{
+}
+
+bool Latency_Model::is_name(const ACE_TCHAR *spec,
+			    size_t length,
+			    const ACE_TCHAR *name)
+{
+  // The whole name, not a prefix of it
+  return ACE_OS::strlen(name) == length
+    && ACE_OS::strncmp(spec, name, length) == 0;
+}
+
+int Latency_Model::parse(const ACE_TCHAR *spec)
+{
+  const ACE_TCHAR *colon = ACE_OS::strchr(spec, ACE_TEXT(':'));
+  if (colon == 0)
+    return -1;
+
+  ACE_TCHAR *end = 0;
+  double a = ACE_OS::strtod(colon + 1, &end);
+  double b = 0;
+  bool two = *end == ACE_TEXT(':');
+  if (two)
+    b = ACE_OS::strtod(end + 1, &end);
+  if (*end != 0 || a < 0 || b < 0)
+    return -1;
+
+  size_t name = colon - spec;
+  if (is_name(spec, name, ACE_TEXT("fixed")) && !two)
+    distribution_ = FIXED;
+  else if (is_name(spec, name, ACE_TEXT("uniform")) && two && a <= b)
+    distribution_ = UNIFORM;
+  else if (is_name(spec, name, ACE_TEXT("exp")) && !two)
+    distribution_ = EXPONENTIAL;
+  else
+    return -1;
+
+  a_ = a;
+  b_ = b;
+  return 0;
+}
+
+ACE_Time_Value Latency_Model::sample(void)
+{
+  // Uniform in [0, 1)
+  double u = ACE_OS::rand_r(&seed_->value) / (RAND_MAX + 1.0);
+
+  double msec = a_;
+  if (distribution_ == UNIFORM)
+    msec = a_ + (b_ - a_) * u;
+  else if (distribution_ == EXPONENTIAL)
+    msec = -a_ * std::log(1.0 - u);
+
+  ACE_Time_Value tv;
+  tv.set(msec / 1000.0);
+  return tv;
+}
+
+
+Pool_Sizing::Pool_Sizing()
+  : min_threads(POOL_SIZE),
+    max_threads(POOL_SIZE),
+    grow_depth(16),
+    grow_wait_usecs(10000),
+    idle_timeout(10)
+{
+}
+
+int Pool_Sizing::parse_threads(const ACE_TCHAR *spec)
+{
+  ACE_TCHAR *end = 0;
+  long min = ACE_OS::strtol(spec, &end, 10);
+  long max = min;
+  if (*end == ACE_TEXT(':'))
+    max = ACE_OS::strtol(end + 1, &end, 10);
+  if (*end != 0 || min < 1 || max < min)
+    return -1;
+
+  min_threads = min;
+  max_threads = max;
+  return 0;
+}
+
+int Pool_Sizing::parse_policy(const ACE_TCHAR *spec)
+{
+  ACE_TCHAR *end = 0;
+  long depth = ACE_OS::strtol(spec, &end, 10);
+  if (*end != ACE_TEXT(':'))
+    return -1;
+  double wait = ACE_OS::strtod(end + 1, &end);
+  if (*end != ACE_TEXT(':'))
+    return -1;
+  double idle = ACE_OS::strtod(end + 1, &end);
+  if (*end != 0 || depth < 0 || wait < 0 || idle <= 0)
+    return -1;
+
+  grow_depth = depth;
+  grow_wait_usecs = wait;
+  idle_timeout.set(idle);
+  return 0;
+}
+
+bool Pool_Sizing::adaptive(void) const
+{
+  return max_threads > min_threads;
+}
+
+
+Connection_Timeouts::Connection_Timeouts()
+  : idle_timeout(60),
+    read_timeout(10),
+    wheel(0)
+{
+}
+
+int Connection_Timeouts::parse(const ACE_TCHAR *spec)
+{
+  ACE_TCHAR *end = 0;
+  double idle = ACE_OS::strtod(spec, &end);
+  double read = read_timeout.sec();
+  if (*end == ACE_TEXT(':'))
+    read = ACE_OS::strtod(end + 1, &end);
+  if (*end != 0 || idle < 0 || read < 0)
+    return -1;
+
+  idle_timeout.set(idle);
+  read_timeout.set(read);
+  return 0;
+}
+
+
+Admission_Control::Admission_Control()
+  : high_water(0),
+    low_water(0),
+    shed(false)
+{
+}
+
+int Admission_Control::parse(const ACE_TCHAR *spec)
+{
+  ACE_TCHAR *end = 0;
+  long high = ACE_OS::strtol(spec, &end, 10);
+  long low = high / 2;
+  if (*end == ACE_TEXT(':'))
+    low = ACE_OS::strtol(end + 1, &end, 10);
+  if (*end != 0 || high < 0 || low < 0 || (high > 0 && low >= high))
+    return -1;
+
+  high_water = high;
+  low_water = low;
+  return 0;
+}
+
+
+void Stage_Stats::record(const Request_Stamp &stamp,
+			 ACE_hrtime_t ready,
+			 ACE_hrtime_t sent)
+{
+  Histograms *h = histograms_.get();
+  if (h == 0)
+    return;
+  h->stages[RECEIVE].record(stamp.queued - stamp.received);
+  h->stages[QUEUE].record(stamp.dequeued - stamp.queued);
+  h->stages[PROCESS].record(ready - stamp.dequeued);
+  h->stages[SEND].record(sent - ready);
+  h->stages[TOTAL].record(sent - stamp.received);
+}
+
+void Stage_Stats::record(Stage stage, ACE_UINT64 ticks)
+{
+  Histograms *h = histograms_.get();
+  if (h != 0)
+    h->stages[stage].record(ticks);
+}
+
+void Stage_Stats::merge(Latency_Histogram merged[STAGES])
+{
+  for (const Per_Thread < Histograms >::Node *node = histograms_.head();
+       node != 0;
+       node = node->next)
+    for (int i = 0; i < STAGES; ++i)
+      merged[i].merge(node->value.stages[i]);
+}
+
+double Stage_Stats::usecs(ACE_UINT64 ticks)
+{
+  ACE_Time_Value tv;
+  ACE_High_Res_Timer::hrtime_to_tv(tv, ticks * 1000);
+  ACE_UINT64 thousandths;
+  tv.to_usec(thousandths);
+  return thousandths / 1000.0;
+}
+
+int Stage_Stats::handle_timeout(const ACE_Time_Value &, const void *)
+{
+  const char *names[STAGES] =
+    { "receive", "queue", "process", "send", "total", "first byte" };
+
+  Latency_Histogram *merged = 0;
+  ACE_NEW_RETURN(merged, Latency_Histogram[STAGES], 0);
+  this->merge(merged);
+
+  for (int i = 0; i < STAGES; ++i)
+    ACE_DEBUG((LM_INFO,
+	       ACE_TEXT("(%t) stage %s: %lu samples, p50 %.1f, p99 %.1f,")
+	       ACE_TEXT(" p99.9 %.1f, max %.1f usecs\n"),
+	       names[i],
+	       (unsigned long) merged[i].count(),
+	       usecs(merged[i].percentile(50)),
+	       usecs(merged[i].percentile(99)),
+	       usecs(merged[i].percentile(99.9)),
+	       usecs(merged[i].max())));
+
+  delete [] merged;
+  return 0;
+}
+
+
+ACE_UINT64 Server_Counters::value(Counter counter) const
+{
+  ACE_UINT64 sum = 0;
+  for (const Per_Thread < Shard >::Node *node = shards_.head();
+       node != 0;
+       node = node->next)
+    sum += node->value.counts[counter].load(std::memory_order_relaxed);
+  return sum;
+}
+
+
+Stats_Report::Stats_Report(bool json)
+  : json_(json),
+    count_(0),
+    length_(0)
+{
+  text_[0] = '\0';
+}
+
+void Stats_Report::add(const char *name, ACE_UINT64 value)
+{
+  char text[32];
+  ACE_OS::snprintf(text, sizeof text, ACE_UINT64_FORMAT_SPECIFIER_ASCII, value);
+  this->append(name, text);
+}
+
+void Stats_Report::add(const char *name, double value)
+{
+  char text[32];
+  ACE_OS::snprintf(text, sizeof text, "%.3f", value);
+  this->append(name, text);
+}
+
+void Stats_Report::append(const char *name, const char *value)
+{
+  // A value that does not fit is left out, as is any later one
+  int n = json_
+    ? ACE_OS::snprintf(text_ + length_, MAX_LENGTH - length_,
+		       "%s\"%s\": %s", count_ == 0 ? "{" : ", ", name, value)
+    : ACE_OS::snprintf(text_ + length_, MAX_LENGTH - length_,
+		       "%s %s\n", name, value);
+  if (n > 0 && length_ + n < MAX_LENGTH)
+    length_ += n;
+  else
+    text_[length_] = '\0';
+  ++count_;
+}
+
+void Stats_Report::finish(void)
+{
+  if (!json_)
+    return;
+  int n = ACE_OS::snprintf(text_ + length_, MAX_LENGTH - length_,
+			   "%s}\n", count_ == 0 ? "{" : "");
+  if (n > 0 && length_ + n < MAX_LENGTH)
+    length_ += n;
+}
+
+bool Stats_Report::json(void) const
+{
+  return json_;
+}
+
+const char *Stats_Report::text(void) const
+{
+  return text_;
+}
+
+size_t Stats_Report::length(void) const
+{
+  return length_;
+}
+
+
+Message_Pools::Message_Pools()
+  : message_blocks_(sizeof(ACE_Message_Block), MAX_FREE_BLOCKS),
+    data_blocks_(sizeof(ACE_Data_Block), MAX_FREE_BLOCKS),
+    buffers_(BUFFER_SIZE, MAX_FREE_BUFFERS),
+    stamps_(sizeof(Request_Stamp), MAX_FREE_BLOCKS)
+{
+}
+
+ACE_Message_Block *Message_Pools::make_block(size_t size, const char *data)
+{
+  return this->make_block(size, data, &buffers_);
+}
+
+ACE_Message_Block *Message_Pools::make_stamp(void)
+{
+  ACE_Message_Block *mb = this->make_block(sizeof(Request_Stamp), 0, &stamps_);
+  if (mb != 0)
+    mb->wr_ptr(sizeof(Request_Stamp));
+  return mb;
+}
+
+ACE_Message_Block *Message_Pools::make_block(size_t size,
+					     const char *data,
+					     Pooled_Allocator *buffers)
+{
+  // The block, its data block and its buffer (unless data is given) are
+  // all freed back into the pools by ACE_Message_Block::release()
+  ACE_Message_Block *mb = 0;
+  ACE_NEW_MALLOC_RETURN(mb,
+			static_cast<ACE_Message_Block *> (
+			  message_blocks_.malloc(sizeof(ACE_Message_Block))),
+			ACE_Message_Block(size,
+					  ACE_Message_Block::MB_DATA,
+					  0,
+					  data,
+					  buffers,
+					  0,
+					  ACE_DEFAULT_MESSAGE_BLOCK_PRIORITY,
+					  ACE_Time_Value::zero,
+					  ACE_Time_Value::max_time,
+					  &data_blocks_,
+					  &message_blocks_),
+			0);
+  return mb;
+}
+
+void Message_Pools::pools(Pooled_Allocator *pools[POOLS])
+{
+  pools[0] = &message_blocks_;
+  pools[1] = &data_blocks_;
+  pools[2] = &buffers_;
+  pools[3] = &stamps_;
+}
+
+int Message_Pools::handle_timeout(const ACE_Time_Value &, const void *)
+{
+  Pooled_Allocator *pools[POOLS];
+  this->pools(pools);
+  const char *names[POOLS] =
+    { "message blocks", "data blocks", "buffers", "stamps" };
+
+  for (int i = 0; i < POOLS; ++i)
+    {
+      size_t hits = pools[i]->hits();
+      size_t misses = pools[i]->misses();
+      ACE_DEBUG((LM_INFO,
+		 ACE_TEXT("(%t) pool %s: %lu hits, %lu misses, %d%% hit rate\n"),
+		 names[i],
+		 (unsigned long) hits,
+		 (unsigned long) misses,
+		 hits + misses == 0 ? 0 : (int) (hits * 100 / (hits + misses))));
+    }
+  return 0;
+}
+
+void Message_Pools::report(Stats_Report &report)
+{
+  Pooled_Allocator *pools[POOLS];
+  this->pools(pools);
+  const char *names[POOLS] =
+    { "message_blocks", "data_blocks", "buffers", "stamps" };
+
+  for (int i = 0; i < POOLS; ++i)
+    {
+      char name[64];
+      ACE_OS::snprintf(name, sizeof name, "pool_%s_hits", names[i]);
+      report.add(name, static_cast<ACE_UINT64> (pools[i]->hits()));
+      ACE_OS::snprintf(name, sizeof name, "pool_%s_misses", names[i]);
+      report.add(name, static_cast<ACE_UINT64> (pools[i]->misses()));
+    }
+}
+
+
+/* Program's entry point */
+int ACE_TMAIN(int argc, ACE_TCHAR *argv[])
+{
+  ACE_OS::printf("Usage: %s [-m hsha|steal|lf] [-q mt|lockfree] [-c queue-capacity]"
+		 " [-r select|epoll|uring] [-s stats-seconds] [-w sleep|timer]"
+		 " [-l fixed:MSEC|uniform:MIN:MAX|exp:MEAN] [-p raw|http]"
+		 " [-a admin-port] [-t min[:max]]"
+		 " [-g depth:wait-usecs:idle-seconds] [-d log-level]"
+		 " [-k prewarm-handlers] [-i idle-seconds[:read-seconds]]"
+		 " [-b high[:low]] [-o suspend|shed] [-n max-batch]"
+		 " [-x cpu-list|numa] [port-number]\n",
+		 argv[0]);
+  Server_Options options;
+  if (options.parse_args(argc, argv) == -1)
+    return 1;
+  u_short port = options.port;
+  ACE_INET_Addr addr(port);
+
+  ACE_DEBUG((LM_DEBUG,
+	     "(%t) Program's entry point\n"));
+
+  ACE_OS::printf("listening at port %d\n", port);
+
+  // Before anything is allocated, main() moves to the reactor's node: the
+  // pools the reactor thread fills come from its memory, and the helper
+  // threads started below run there too
+  const Thread_Placement *placement = 0;
+  if (options.placement.enabled())
+    {
+      placement = &options.placement;
+      if (placement->pin_home() == -1)
+	ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "pin"), 1);
+    }
+
+  // Implement a main() function that:
+
+  //1. Creates an  ACE_Reactor(or use the singleton instance of the ACE_Reactor)
+  // Leader/Followers needs a reactor whose event loop many threads can run,
+  // which ACE_Dev_Poll_Reactor also allows. Either one is installed as the
+  // singleton so that it is deleted at program exit.
+  bool leader_followers =
+    options.model == Server_Options::LEADER_FOLLOWERS;
+  bool dev_poll =
+    options.reactor_type == Server_Options::DEV_POLL_REACTOR;
+  bool uring = false;
+#if defined (ECHO_HAS_IO_URING)
+  uring = options.reactor_type == Server_Options::URING;
+  if (uring && leader_followers)
+    ACE_ERROR_RETURN((LM_ERROR,
+		      ACE_TEXT("(%t) -r uring needs a worker pool (-m hsha")
+		      ACE_TEXT(" or -m steal)\n")),
+		     1);
+#endif /* ECHO_HAS_IO_URING */
+  ACE_Reactor_Impl *reactor_impl = 0;
+#if defined (ACE_HAS_EVENT_POLL) || defined (ACE_HAS_DEV_POLL)
+  if (dev_poll)
+    {
+      // epoll is not limited to FD_SETSIZE handles: let the process
+      // (and the reactor, which sizes itself on it) use as many as allowed
+      ACE::set_handle_limit();
+      ACE_NEW_RETURN(reactor_impl, ACE_Dev_Poll_Reactor, 1);
+    }
+  else
+#endif /* ACE_HAS_EVENT_POLL || ACE_HAS_DEV_POLL */
+  if (leader_followers)
+    ACE_NEW_RETURN(reactor_impl, ACE_TP_Reactor, 1);
+  if (reactor_impl != 0)
+    {
+      ACE_Reactor *r = 0;
+      ACE_NEW_RETURN(r, ACE_Reactor(reactor_impl, true), 1);
+      ACE_Reactor::instance(r, true);
+    }
+  ACE_Reactor *reactor = ACE_Reactor::instance();
+
+  //2. Creates an Echo_Task instance and have it spawn a pool of N threads
+  // (where N > 1) within itself (Echo_Task::activate()).
+  // The request queue is either the task's own ACE_Message_Queue or a
+  // lock-free one that outlives the task.
+  Lockfree_Message_Queue *lockfree_queue = 0;
+  if (options.lockfree_queue)
+    ACE_NEW_RETURN(lockfree_queue,
+		   Lockfree_Message_Queue(options.queue_capacity),
+		   1);
+
+  // Declared before the task, so that it is destroyed after it: whatever is
+  // still queued is released into these pools, and the handlers it closes
+  // go back to theirs.
+  Message_Pools message_pools;
+  Echo_Timeout_Wheel timeout_wheel;
+  Echo_Handler_Pool handler_pool;
+  if (handler_pool.prewarm(options.prewarm_handlers) == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "prewarm"), 1);
+
+  // The request path logs through the drain thread of the Binary_Log
+  Binary_Log *log = Binary_Log::instance();
+  log->threshold(options.log_threshold);
+  if (log->open() == -1)
+    ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "log open"), 1);
+
+  Echo_Task echo_task(lockfree_queue);
+  Echo_Task *ptask = &echo_task;
+  size_t pool_size = options.pool.min_threads;
+  bool adaptive = options.pool.adaptive();
+  if (adaptive && options.model != Server_Options::HALF_SYNC_HALF_ASYNC)
+    {
+      ACE_DEBUG((LM_WARNING,
+		 ACE_TEXT("(%t) Only the hsha pool adapts; using %d workers\n"),
+		 static_cast<int> (pool_size)));
+      adaptive = false;
+    }
+  if (adaptive)
+    echo_task.pool_sizing(&options.pool);
+  if (placement != 0)
+    echo_task.placement(placement);
+  if (options.model == Server_Options::WORK_STEALING
+      && echo_task.work_stealing(pool_size) == -1)
+    {
+      log->close();
+      return 1;
+    }
+  if (leader_followers)
+    echo_task.leader_followers(reactor);
+  echo_task.latency(&options.latency);
+  echo_task.batching(options.max_batch);
+  if (options.http)
+    echo_task.http();
+  if (options.timer_workload && echo_task.timer_workload() == -1)
+    {
+      log->close();
+      return 1;
+    }
+  if (options.admission.high_water > 0 && uring)
+    ACE_DEBUG((LM_WARNING,
+	       ACE_TEXT("(%t) Admission control needs a reactor;")
+	       ACE_TEXT(" ignored with -r uring\n")));
+  else if (options.admission.high_water > 0 && !leader_followers)
+    echo_task.admission(&options.admission, reactor);
+  //Create pool_size kernel-level threads. A fixed pool's threads can be
+  // joined with; an adaptive pool's workers come and go, so they are
+  // detached instead, and ACE_Thread_Manager::wait() still waits for those
+  // left at exit.
+  echo_task.activate(THR_NEW_LWP | (adaptive ? THR_DETACHED : THR_JOINABLE),
+		     static_cast<int> (pool_size));
+  if (echo_task.placed() == -1)
+    {
+      ACE_ERROR((LM_ERROR, "(%t) %p\n", "placement"));
+      log->close();
+      return 1;
+    }
+
+  ///3. Creates an Echo_Acceptor instance and associate it with the Echo_Task.
+  Echo_Acceptor acceptor;
+  acceptor.echo_task(ptask); // Using a setter method defined in Echo_Acceptor
+  acceptor.message_pools(&message_pools);
+  acceptor.handler_pool(&handler_pool);
+  if (options.timeouts.idle_timeout != ACE_Time_Value::zero)
+    {
+      if (timeout_wheel.open(reactor) == -1)
+	{
+	  ACE_ERROR((LM_ERROR, "(%t) %p\n", "timeout wheel"));
+	  log->close();
+	  return 1;
+	}
+      options.timeouts.wheel = &timeout_wheel;
+    }
+  acceptor.timeouts(&options.timeouts);
+  if (options.stats_interval > 0)
+    {
+      ACE_Time_Value interval(options.stats_interval);
+      reactor->schedule_timer(&message_pools, 0, interval, interval);
+      reactor->schedule_timer(&handler_pool, 0, interval, interval);
+      reactor->schedule_timer(echo_task.stage_stats(), 0, interval, interval);
+    }
+  if (adaptive)
+    reactor->schedule_timer(ptask,
+			    0,
+			    Echo_Task::GROW_INTERVAL,
+			    Echo_Task::GROW_INTERVAL);
+
+  //4. Registers the Echo_Acceptor instance with the reactor
+  // With epoll the accepted connections are made non-blocking. With
+  // io_uring the engine's thread accepts them instead, configuring the
+  // handlers through the acceptor.
+#if defined (ECHO_HAS_IO_URING)
+  Uring_Engine engine(acceptor, ptask);
+  if (uring)
+    {
+      if (engine.listen(addr) == -1)
+	{
+	  log->close();
+	  return 1;
+	}
+      if (engine.activate(THR_NEW_LWP | THR_JOINABLE) == -1)
+	{
+	  ACE_ERROR((LM_ERROR, "(%t) %p\n", "activate"));
+	  log->close();
+	  return 1;
+	}
+    }
+  else
+#endif /* ECHO_HAS_IO_URING */
+  acceptor.open(addr, reactor, dev_poll ? ACE_NONBLOCK : 0);
+
+  // The admin port answers on the same reactor; the server runs without
+  // it if it cannot be opened, as the pool threads are already running
+  Admin_Acceptor admin(ptask, &message_pools, &handler_pool);
+  if (options.admin_port != 0
+      && admin.open(ACE_INET_Addr(options.admin_port), reactor) == -1)
+    ACE_ERROR((LM_ERROR, "(%t) %p\n", "admin port"));
 
   //5. Run the reactor's event loop [ACE_Reactor::run_reactor_event_loop()] 
   // to wait for connections/data to arrive from a client. 
-  reactor->run_reactor_event_loop();
+  // In Leader/Followers mode the pool threads are already running it.
+  // Under a placement the reactor thread now leaves its node's other CPUs
+  // to the helper threads.
+  if (!leader_followers)
+    {
+      if (placement != 0 && !uring && placement->pin_reactor() == -1)
+	ACE_ERROR((LM_ERROR, "(%t) %p\n", "pin reactor"));
+      reactor->run_reactor_event_loop();
+    }
+
+#if defined (ECHO_HAS_IO_URING)
+  if (uring)
+    engine.stop();
+#endif /* ECHO_HAS_IO_URING */
 
   // Wait for all threads to exit
   ACE_Thread_Manager::instance()->wait();
 
+  // Connections still open are closed while the pools their handlers
+  // release buffers into are alive
+  reactor->cancel_timer(&message_pools);
+  reactor->cancel_timer(&handler_pool);
+  reactor->cancel_timer(echo_task.stage_stats());
+  reactor->cancel_timer(ptask);
+  timeout_wheel.close();
+#if defined (ECHO_HAS_IO_URING)
+  if (uring)
+    engine.finish();
+#endif /* ECHO_HAS_IO_URING */
+  echo_task.readmit();
+  reactor->close();
+  delete lockfree_queue;
+  log->close();
   return 0;
 }
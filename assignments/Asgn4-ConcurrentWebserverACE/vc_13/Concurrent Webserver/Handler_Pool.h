@@ -0,0 +1,220 @@
+// $Id$
+
+/**
+ * @file Handler_Pool.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Free list of closed service handlers, reused for new connections.
+ */
+
+#ifndef HANDLER_POOL_H
+#define HANDLER_POOL_H
+
+#include "ace/Event_Handler.h"
+#include "ace/Guard_T.h"
+#include "ace/High_Res_Timer.h"
+#include "ace/Log_Msg.h"
+#include "ace/OS_Memory.h"
+
+/**
+ * @class Handler_Pool
+ * @brief Keeps closed service handlers for the next connections
+ *
+ * A handler that supports recycling overrides ACE_Svc_Handler::destroy()
+ * to shut itself down, reset its state and put() itself here instead of
+ * deleting itself; the acceptor's make_svc_handler() then take()s it back
+ * for a new connection. A storm of short connections is thus served by a
+ * steady set of handlers, and prewarm() builds them up before the first
+ * connection arrives. Beyond max_free handlers, closed ones are deleted.
+ *
+ * Counts the connections and the handlers allocated for them, and the time
+ * to the first byte of those whose handler reports it. As an event handler
+ * it logs these on every timeout. ACE_LOCK is ACE_Null_Mutex for a pool
+ * used by a single event loop.
+ */
+template <class SVC_HANDLER, class ACE_LOCK>
+class Handler_Pool : public ACE_Event_Handler
+{
+public:
+  enum
+  {
+    DEFAULT_MAX_FREE = 1024
+  };
+
+  explicit Handler_Pool(size_t max_free = DEFAULT_MAX_FREE)
+    : free_(0),
+      n_free_(0),
+      max_free_(0),
+      connections_(0),
+      allocations_(0),
+      first_bytes_(0),
+      first_byte_ticks_(0),
+      first_byte_max_(0)
+  {
+    this->reserve(max_free);
+  }
+
+  virtual ~Handler_Pool()
+  {
+    for (size_t i = 0; i < n_free_; ++i)
+      delete free_[i];
+    delete [] free_;
+  }
+
+  /// Allocates n handlers up front, keeping room for at least n. Returns
+  /// -1 if out of memory.
+  int prewarm(size_t n)
+  {
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, -1);
+    if (n > max_free_ && this->reserve(n) == -1)
+      return -1;
+    while (n_free_ < n)
+      {
+	SVC_HANDLER *sh = 0;
+	ACE_NEW_RETURN(sh, SVC_HANDLER, -1);
+	sh->handler_pool(this);
+	free_[n_free_++] = sh;
+	++allocations_;
+      }
+    return 0;
+  }
+
+  /// Returns a handler for a new connection: a recycled one, else one
+  /// allocated now, or 0 if out of memory.
+  SVC_HANDLER *take(void)
+  {
+    {
+      ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+      ++connections_;
+      if (n_free_ > 0)
+	return free_[--n_free_];
+      ++allocations_;
+    }
+
+    SVC_HANDLER *sh = 0;
+    ACE_NEW_RETURN(sh, SVC_HANDLER, 0);
+    sh->handler_pool(this);
+    return sh;
+  }
+
+  /// Keeps sh, which has been reset, for a later connection, or deletes
+  /// it if the pool is full.
+  void put(SVC_HANDLER *sh)
+  {
+    {
+      ACE_GUARD(ACE_LOCK, guard, lock_);
+      if (n_free_ < max_free_)
+	{
+	  free_[n_free_++] = sh;
+	  return;
+	}
+    }
+    sh->handler_pool(0);
+    delete sh;
+  }
+
+  /// Records the time from accept to the first byte of a connection.
+  void first_byte(ACE_hrtime_t ticks)
+  {
+    ACE_GUARD(ACE_LOCK, guard, lock_);
+    ++first_bytes_;
+    first_byte_ticks_ += ticks;
+    if (ticks > first_byte_max_)
+      first_byte_max_ = ticks;
+  }
+
+  size_t connections(void)
+  {
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+    return connections_;
+  }
+
+  size_t allocations(void)
+  {
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+    return allocations_;
+  }
+
+  /// Logs the connections, the handler allocations they needed and, if
+  /// reported, the time to their first byte.
+  virtual int handle_timeout(const ACE_Time_Value &, const void *)
+  {
+    size_t connections, allocations, first_bytes;
+    ACE_UINT64 first_byte_ticks, first_byte_max;
+    {
+      ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+      connections = connections_;
+      allocations = allocations_;
+      first_bytes = first_bytes_;
+      first_byte_ticks = first_byte_ticks_;
+      first_byte_max = first_byte_max_;
+    }
+
+    double per_connection =
+      connections == 0 ? 0.0 : (double) allocations / connections;
+    if (first_bytes == 0)
+      ACE_DEBUG((LM_INFO,
+		 ACE_TEXT("(%t) handlers: %lu connections, %lu allocated,")
+		 ACE_TEXT(" %.3f allocations per connection\n"),
+		 (unsigned long) connections,
+		 (unsigned long) allocations,
+		 per_connection));
+    else
+      ACE_DEBUG((LM_INFO,
+		 ACE_TEXT("(%t) handlers: %lu connections, %lu allocated,")
+		 ACE_TEXT(" %.3f allocations per connection,")
+		 ACE_TEXT(" first byte %.1f usecs (max %.1f)\n"),
+		 (unsigned long) connections,
+		 (unsigned long) allocations,
+		 per_connection,
+		 usecs(first_byte_ticks) / first_bytes,
+		 usecs(first_byte_max)));
+    return 0;
+  }
+
+private:
+  /// Makes room for n free handlers. Returns -1 if out of memory.
+  int reserve(size_t n)
+  {
+    SVC_HANDLER **free = 0;
+    ACE_NEW_RETURN(free, SVC_HANDLER *[n], -1);
+    for (size_t i = 0; i < n_free_; ++i)
+      free[i] = free_[i];
+    delete [] free_;
+    free_ = free;
+    max_free_ = n;
+    return 0;
+  }
+
+  static double usecs(ACE_UINT64 ticks)
+  {
+    ACE_Time_Value tv;
+    ACE_High_Res_Timer::hrtime_to_tv(tv, ticks);
+    return tv.sec() * 1e6 + tv.usec();
+  }
+
+  ACE_LOCK lock_;
+
+  /// The free handlers, a stack so that the most recently used, whose
+  /// memory is most likely still cached, goes first.
+  SVC_HANDLER **free_;
+  size_t n_free_;
+  size_t max_free_;
+
+  size_t connections_;
+  size_t allocations_;
+
+  /// Connections that sent something, and their time to the first byte.
+  size_t first_bytes_;
+  ACE_UINT64 first_byte_ticks_;
+  ACE_UINT64 first_byte_max_;
+
+  // = Disallow copying.
+  Handler_Pool(const Handler_Pool &);
+  Handler_Pool &operator=(const Handler_Pool &);
+};
+
+#endif /* HANDLER_POOL_H */
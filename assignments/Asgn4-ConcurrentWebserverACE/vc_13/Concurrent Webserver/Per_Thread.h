@@ -0,0 +1,159 @@
+// $Id$
+
+/**
+ * @file Per_Thread.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Thread-private objects that other threads can still visit, for
+ * statistics updated without locking and summed up when read.
+ */
+
+#ifndef PER_THREAD_H
+#define PER_THREAD_H
+
+#include "ace/TSS_T.h"
+#include "ace/OS_Memory.h"
+
+#include <atomic>
+
+#if !defined (ECHO_CACHE_LINE_SIZE)
+# define ECHO_CACHE_LINE_SIZE 64
+#endif /* ECHO_CACHE_LINE_SIZE */
+
+/**
+ * @class Per_Thread
+ * @brief One T per thread, all of which any thread can walk through
+ *
+ * get() returns the calling thread's T, created on its first call and
+ * pushed onto a lock-free list; head() starts a walk through the Ts of
+ * every thread. Each T is padded to its own cache lines, so threads
+ * updating theirs never share a line. The Ts outlive their threads, as
+ * what those recorded still counts, and go away with the Per_Thread.
+ *
+ * The T of a thread that exited is handed over, as it is, to the next
+ * thread that calls get() for the first time, so a pool whose threads
+ * come and go does not pile up Ts. Its owner then carries on from where
+ * the previous one left off, so a T must not assume that it starts out
+ * fresh.
+ */
+template <class T>
+class Per_Thread
+{
+public:
+  struct Node
+  {
+    Node()
+      : next(0),
+	owned(true)
+    {
+    }
+
+    char pad0_[ECHO_CACHE_LINE_SIZE];
+    T value;
+    Node *next;
+
+    /// Cleared when the owning thread exits.
+    std::atomic<bool> owned;
+    char pad1_[ECHO_CACHE_LINE_SIZE];
+  };
+
+  Per_Thread()
+    : head_(0)
+  {
+  }
+
+  ~Per_Thread()
+  {
+    // The calling thread's slot goes away with slot_, after the nodes
+    Slot *slot = slot_.ts_object();
+    if (slot != 0)
+      slot->node = 0;
+
+    for (Node *node = head_.load(); node != 0; )
+      {
+	Node *next = node->next;
+	delete node;
+	node = next;
+      }
+  }
+
+  /// The calling thread's T, or 0 if out of memory.
+  T *get(void)
+  {
+    Slot *slot = slot_;
+    if (slot == 0)
+      return 0;
+    if (slot->node == 0)
+      slot->node = this->adopt();
+    if (slot->node == 0)
+      slot->node = this->push();
+    return slot->node == 0 ? 0 : &slot->node->value;
+  }
+
+  /// The newest thread's T; follow Node::next for the others.
+  const Node *head(void) const
+  {
+    return head_.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Slot
+  {
+    Slot()
+      : node(0)
+    {
+    }
+
+    /// Runs when the thread exits.
+    ~Slot()
+    {
+      if (node != 0)
+	node->owned.store(false, std::memory_order_release);
+    }
+
+    Node *node;
+  };
+
+  /// Takes over the node of a thread that exited, if any.
+  Node *adopt(void)
+  {
+    for (Node *node = head_.load(std::memory_order_acquire);
+	 node != 0;
+	 node = node->next)
+      {
+	bool owned = false;
+	if (!node->owned.load(std::memory_order_relaxed)
+	    && node->owned.compare_exchange_strong(owned,
+						   true,
+						   std::memory_order_acquire))
+	  return node;
+      }
+    return 0;
+  }
+
+  /// Adds a node, or returns 0 if out of memory.
+  Node *push(void)
+  {
+    Node *node = 0;
+    ACE_NEW_RETURN(node, Node, 0);
+    node->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(node->next,
+					node,
+					std::memory_order_release,
+					std::memory_order_relaxed))
+      ;
+    return node;
+  }
+
+  ACE_TSS < Slot > slot_;
+  std::atomic<Node *> head_;
+
+  // = Disallow copying.
+  Per_Thread(const Per_Thread &);
+  Per_Thread &operator=(const Per_Thread &);
+};
+
+#endif /* PER_THREAD_H */
@@ -0,0 +1,261 @@
+// $Id$
+
+/**
+ * @file Thread_Placement.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Which CPUs the reactor thread and the pool threads run on, and so which
+ * NUMA node the memory they allocate comes from.
+ */
+
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include "ace/OS_NS_Thread.h"
+#include "ace/OS_NS_stdio.h"
+#include "ace/OS_NS_stdlib.h"
+#include "ace/OS_NS_string.h"
+#include "ace/OS_NS_unistd.h"
+#include "ace/OS_NS_errno.h"
+
+/**
+ * @class Thread_Placement
+ * @brief The CPUs of the reactor thread and of each pool worker
+ *
+ * With a CPU list (say 0,2-7) the reactor thread runs on the first CPU
+ * listed and the workers are dealt the others in turn, one CPU each; a
+ * single CPU takes them all. With "numa" the reactor thread runs on the
+ * CPUs of the first node and the workers are dealt out to the nodes in
+ * turn, each free to move between the CPUs of its node. The nodes are read
+ * from /sys/devices/system/node; a host without them is a single node.
+ *
+ * A page comes from the node of the thread that first touches it, so a
+ * thread is pinned before it allocates what it uses. main() moves to the
+ * reactor's node (pin_home()) before it creates the pools the reactor
+ * thread fills. Threads start on the CPUs of their creator, so the helper
+ * threads main() starts stay on that node too, and main() narrows itself
+ * down to the reactor's CPUs (pin_reactor()) once they are running.
+ *
+ * Only hosts with cpu_set_t (Linux) can pin threads; elsewhere parse()
+ * fails with ENOTSUP.
+ */
+class Thread_Placement
+{
+public:
+  enum
+  {
+    /// Most NUMA nodes, and highest CPU number plus one, taken into account.
+    MAX_NODES = 64,
+    MAX_CPUS = 1024
+  };
+
+  Thread_Placement()
+    : n_cpus_(0),
+      n_nodes_(0),
+      numa_(false),
+      enabled_(false)
+  {
+  }
+
+  /// Parses CPU-LIST or "numa" (-x). Returns -1 if spec is malformed or
+  /// names a CPU of no node.
+  int parse(const ACE_TCHAR *spec)
+  {
+#if !defined (ACE_HAS_CPU_SET_T)
+    ACE_UNUSED_ARG(spec);
+    errno = ENOTSUP;
+    return -1;
+#else
+    this->read_nodes();
+    numa_ = ACE_OS::strcmp(spec, ACE_TEXT("numa")) == 0;
+    if (numa_)
+      {
+	reactor_ = nodes_[0];
+	home_ = nodes_[0];
+	enabled_ = true;
+	return 0;
+      }
+
+    int count = parse_list(ACE_TEXT_ALWAYS_CHAR(spec), cpus_, MAX_CPUS);
+    if (count <= 0)
+      return -1;
+    n_cpus_ = count;
+    for (size_t i = 0; i < n_cpus_; ++i)
+      if (this->node_of(cpus_[i]) == -1)
+	return -1;
+
+    to_set(cpus_, 1, reactor_);
+    home_ = nodes_[this->node_of(cpus_[0])];
+    enabled_ = true;
+    return 0;
+#endif /* ACE_HAS_CPU_SET_T */
+  }
+
+  /// True once parse() succeeded.
+  bool enabled(void) const
+  {
+    return enabled_;
+  }
+
+  /// Pins the calling thread to the CPUs of the reactor's node.
+  int pin_home(void) const
+  {
+    return pin(home_);
+  }
+
+  /// Pins the calling thread to the reactor's CPUs.
+  int pin_reactor(void) const
+  {
+    return pin(reactor_);
+  }
+
+  /// Pins the calling thread to the CPUs of worker.
+  int pin_worker(size_t worker) const
+  {
+    if (numa_)
+      return pin(nodes_[worker % n_nodes_]);
+
+    cpu_set_t set;
+    int cpu = this->cpu_of(worker);
+    to_set(&cpu, 1, set);
+    return pin(set);
+  }
+
+  /// The node worker runs on.
+  size_t node(size_t worker) const
+  {
+    if (numa_)
+      return worker % n_nodes_;
+    int node = this->node_of(this->cpu_of(worker));
+    return node == -1 ? 0 : static_cast<size_t> (node);
+  }
+
+private:
+  /// Reads the CPUs of each node that has some.
+  void read_nodes(void)
+  {
+#if defined (ACE_HAS_CPU_SET_T)
+    n_nodes_ = 0;
+    for (int i = 0; i < MAX_NODES; ++i)
+      {
+	char path[64];
+	ACE_OS::snprintf(path, sizeof path,
+			 "/sys/devices/system/node/node%d/cpulist", i);
+	FILE *fp = ACE_OS::fopen(path, "r");
+	if (fp == 0)
+	  continue;
+
+	// Memory-only nodes list no CPU
+	char line[4096];
+	int cpus[MAX_CPUS];
+	int count = ACE_OS::fgets(line, sizeof line, fp) == 0
+	  ? -1
+	  : parse_list(line, cpus, MAX_CPUS);
+	ACE_OS::fclose(fp);
+	if (count > 0)
+	  to_set(cpus, count, nodes_[n_nodes_++]);
+      }
+
+    if (n_nodes_ == 0)
+      {
+	CPU_ZERO(&nodes_[0]);
+	long online = ACE_OS::num_processors_online();
+	for (long cpu = 0; cpu < online && cpu < MAX_CPUS; ++cpu)
+	  CPU_SET(cpu, &nodes_[0]);
+	n_nodes_ = 1;
+      }
+#endif /* ACE_HAS_CPU_SET_T */
+  }
+
+  /// The node of cpu, or -1.
+  int node_of(int cpu) const
+  {
+#if defined (ACE_HAS_CPU_SET_T)
+    for (size_t i = 0; i < n_nodes_; ++i)
+      if (CPU_ISSET(cpu, &nodes_[i]))
+	return static_cast<int> (i);
+#else
+    ACE_UNUSED_ARG(cpu);
+#endif /* ACE_HAS_CPU_SET_T */
+    return -1;
+  }
+
+  /// The CPU of worker in a CPU list: the first one is the reactor's.
+  int cpu_of(size_t worker) const
+  {
+    return n_cpus_ == 1 ? cpus_[0] : cpus_[1 + worker % (n_cpus_ - 1)];
+  }
+
+  /// Parses a list such as 0,2-7 (the format of the node cpulist files)
+  /// into at most max CPUs. Returns their number, or -1 if list is
+  /// malformed.
+  static int parse_list(const char *list, int cpus[], int max)
+  {
+    int count = 0;
+    for (const char *p = list; ; ++p)
+      {
+	char *end = 0;
+	long first = ACE_OS::strtol(p, &end, 10);
+	long last = first;
+	if (end == p)
+	  return -1;
+	if (*end == '-')
+	  {
+	    p = end + 1;
+	    last = ACE_OS::strtol(p, &end, 10);
+	    if (end == p)
+	      return -1;
+	  }
+	if (first < 0 || last < first || last >= MAX_CPUS)
+	  return -1;
+	for (long cpu = first; cpu <= last && count < max; ++cpu)
+	  cpus[count++] = static_cast<int> (cpu);
+
+	p = end;
+	if (*p != ',')
+	  return *p == '\0' || *p == '\n' ? count : -1;
+      }
+  }
+
+  static void to_set(const int cpus[], int count, cpu_set_t &set)
+  {
+#if defined (ACE_HAS_CPU_SET_T)
+    CPU_ZERO(&set);
+    for (int i = 0; i < count; ++i)
+      CPU_SET(cpus[i], &set);
+#else
+    ACE_UNUSED_ARG(cpus);
+    ACE_UNUSED_ARG(count);
+    ACE_UNUSED_ARG(set);
+#endif /* ACE_HAS_CPU_SET_T */
+  }
+
+  static int pin(const cpu_set_t &set)
+  {
+    ACE_hthread_t self;
+    ACE_OS::thr_self(self);
+    return ACE_OS::thr_setaffinity(self, sizeof set, &set);
+  }
+
+  /// The reactor's CPUs, and those of its node.
+  cpu_set_t reactor_;
+  cpu_set_t home_;
+
+  /// CPU list: the CPUs in the order listed.
+  int cpus_[MAX_CPUS];
+  size_t n_cpus_;
+
+  /// The CPUs of each node.
+  cpu_set_t nodes_[MAX_NODES];
+  size_t n_nodes_;
+
+  /// Set with "numa".
+  bool numa_;
+
+  bool enabled_;
+};
+
+#endif /* THREAD_PLACEMENT_H */
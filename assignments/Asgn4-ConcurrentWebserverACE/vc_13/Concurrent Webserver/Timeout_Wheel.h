@@ -0,0 +1,284 @@
+// $Id$
+
+/**
+ * @file Timeout_Wheel.h
+ * @author Ariel Machado <arielgmachado AT gmail DOT com>
+ *
+ *  Programming Cloud Services for Android Handheld Systems
+ *  Optional Assignment 4 - Concurrent Webserver (ACE C++)
+ *
+ * Hashed timing wheel for the coarse timeouts of many connections.
+ */
+
+#ifndef TIMEOUT_WHEEL_H
+#define TIMEOUT_WHEEL_H
+
+#include "ace/Event_Handler.h"
+#include "ace/Reactor.h"
+#include "ace/Time_Value.h"
+#include "ace/OS_NS_sys_time.h"
+#include "ace/Guard_T.h"
+
+#include <atomic>
+
+/**
+ * @class Timeout_Wheel
+ * @brief Hashed timing wheel of per-connection timeouts
+ *
+ * Unlike ACE_Timer_Wheel, which is a full timer queue, it only keeps
+ * coarse deadlines that are pushed back far more often than they expire.
+ *
+ * Time advances in ticks of a single reactor timer, or of the owner's calls
+ * to handle_timeout() when it runs without a reactor. A timer is linked into
+ * the slot of its deadline modulo SLOTS, so arming, re-arming and
+ * cancelling are O(1) whatever the number of timers, and a tick only walks
+ * one slot. A deadline more than SLOTS ticks away stays in its slot for as
+ * many revolutions as it takes.
+ *
+ * Re-arming a timer for a later deadline, as a connection does on every
+ * read, only stores the new deadline: the timer stays where it is, and is
+ * moved along when the wheel gets to its slot. Only an earlier deadline
+ * takes the lock to move it at once. The store and the wheel's decision
+ * to expire the timer are both compare-and-swaps of the deadline, so a
+ * deadline pushed back while the wheel looks at the timer is either seen
+ * by the wheel or, once the wheel has claimed the timer, re-arms it under
+ * the lock after the upcall.
+ *
+ * When a timer expires the wheel calls handle_timeout() on its handler,
+ * with the Timer as the act; if that returns -1 the handler is removed
+ * from the wheel's reactor, which closes it. The upcall runs still holding
+ * the lock: cancel() therefore waits for the upcall to finish, and a
+ * handler that cancels its timer before going away is never called after
+ * that. The upcall may re-arm the timer, so ACE_LOCK must be recursive (or
+ * ACE_Null_Mutex when a single thread uses the wheel).
+ */
+template <class ACE_LOCK>
+class Timeout_Wheel : public ACE_Event_Handler
+{
+public:
+  enum
+  {
+    /// Must be a power of two.
+    SLOTS = 1024,
+
+    DEFAULT_TICK_MSEC = 100
+  };
+
+  /**
+   * @class Timer
+   * @brief A handler's place in the wheel
+   */
+  class Timer
+  {
+  public:
+    Timer()
+      : handler_(0),
+	prev_(0),
+	next_(0),
+	due_(NEVER),
+	deadline_(0)
+    {
+    }
+
+  private:
+    friend class Timeout_Wheel;
+
+    ACE_Event_Handler *handler_;
+    Timer *prev_;
+    Timer *next_;
+
+    /// Tick at which the wheel looks at the timer next, or NEVER while
+    /// it is not armed.
+    std::atomic<ACE_UINT64> due_;
+
+    /// Tick at which the timer expires; no earlier than due_. NEVER once
+    /// the wheel has claimed the timer to expire it.
+    std::atomic<ACE_UINT64> deadline_;
+  };
+
+  explicit Timeout_Wheel(const ACE_Time_Value &tick
+		       = ACE_Time_Value(0, DEFAULT_TICK_MSEC * 1000))
+    : tick_(tick),
+      tick_msec_(tick.msec() > 0 ? tick.msec() : 1),
+      current_(0),
+      armed_(0),
+      expired_(0)
+  {
+    for (size_t i = 0; i < SLOTS; ++i)
+      slots_[i] = 0;
+  }
+
+  /// Starts ticking on reactor; with none, the caller calls
+  /// handle_timeout() every tick() instead.
+  int open(ACE_Reactor *reactor)
+  {
+    this->reactor(reactor);
+    start_ = ACE_OS::gettimeofday();
+    if (reactor == 0)
+      return 0;
+    return reactor->schedule_timer(this, 0, tick_, tick_) == -1 ? -1 : 0;
+  }
+
+  /// Stops ticking; the timers still armed never expire.
+  void close(void)
+  {
+    if (this->reactor() != 0)
+      this->reactor()->cancel_timer(this);
+  }
+
+  /// Arms timer to call handler->handle_timeout() once timeout has
+  /// passed, replacing any earlier deadline. Returns -1 on failure.
+  int schedule(Timer *timer,
+	       ACE_Event_Handler *handler,
+	       const ACE_Time_Value &timeout)
+  {
+    ACE_UINT64 deadline = current_.load(std::memory_order_relaxed)
+      + (timeout.msec() + tick_msec_ - 1) / tick_msec_;
+    if (deadline == current_.load(std::memory_order_relaxed))
+      ++deadline;
+
+    // Due no later than the new deadline: the wheel finds it when it gets
+    // there, unless it has just claimed the timer
+    if (deadline >= timer->due_.load(std::memory_order_acquire))
+      {
+	ACE_UINT64 current = timer->deadline_.load(std::memory_order_relaxed);
+	while (current != NEVER)
+	  if (timer->deadline_.compare_exchange_weak(current,
+						     deadline,
+						     std::memory_order_relaxed))
+	    return 0;
+      }
+
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, -1);
+    if (timer->due_.load(std::memory_order_relaxed) != NEVER)
+      this->unlink(timer);
+    else
+      ++armed_;
+    timer->handler_ = handler;
+    timer->deadline_.store(deadline, std::memory_order_relaxed);
+    this->link(timer, deadline);
+    return 0;
+  }
+
+  /// Disarms timer, waiting for its upcall if it is in progress.
+  void cancel(Timer *timer)
+  {
+    ACE_GUARD(ACE_LOCK, guard, lock_);
+    if (timer->due_.load(std::memory_order_relaxed) == NEVER)
+      return;
+    this->unlink(timer);
+    timer->due_.store(NEVER, std::memory_order_relaxed);
+    --armed_;
+  }
+
+  const ACE_Time_Value &tick(void) const
+  {
+    return tick_;
+  }
+
+  size_t armed(void)
+  {
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+    return armed_;
+  }
+
+  size_t expired(void)
+  {
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+    return expired_;
+  }
+
+  /// Advances to the current time, a slot per tick, expiring the timers
+  /// that are due.
+  virtual int handle_timeout(const ACE_Time_Value &now, const void *)
+  {
+    ACE_GUARD_RETURN(ACE_LOCK, guard, lock_, 0);
+    ACE_UINT64 target = (now - start_).msec() / tick_msec_;
+    for (ACE_UINT64 tick = current_.load(std::memory_order_relaxed);
+	 tick < target; )
+      {
+	current_.store(++tick, std::memory_order_relaxed);
+
+	Timer *next = 0;
+	for (Timer *timer = slots_[tick & MASK]; timer != 0; timer = next)
+	  {
+	    next = timer->next_;
+	    if (timer->due_.load(std::memory_order_relaxed) != tick)
+	      continue;     // A later revolution
+
+	    // Claims the timer, unless its deadline was pushed back since it
+	    // was linked here, even while the wheel was looking at it
+	    this->unlink(timer);
+	    ACE_UINT64 deadline =
+	      timer->deadline_.load(std::memory_order_relaxed);
+	    while (deadline <= tick
+		   && !timer->deadline_.compare_exchange_weak(
+			deadline, NEVER, std::memory_order_relaxed))
+	      ;
+	    if (deadline > tick)
+	      {
+		this->link(timer, deadline);
+		continue;
+	      }
+
+	    timer->due_.store(NEVER, std::memory_order_relaxed);
+	    --armed_;
+	    ++expired_;
+	    ACE_Event_Handler *handler = timer->handler_;
+	    if (handler->handle_timeout(now, timer) == -1
+		&& this->reactor() != 0)
+	      this->reactor()->remove_handler(handler,
+					      ACE_Event_Handler::ALL_EVENTS_MASK);
+	  }
+      }
+    return 0;
+  }
+
+private:
+  enum { MASK = SLOTS - 1 };
+
+  static const ACE_UINT64 NEVER = ~static_cast<ACE_UINT64> (0);
+
+  /// Adds timer at the head of the slot of tick.
+  void link(Timer *timer, ACE_UINT64 tick)
+  {
+    Timer *&head = slots_[tick & MASK];
+    timer->prev_ = 0;
+    timer->next_ = head;
+    if (head != 0)
+      head->prev_ = timer;
+    head = timer;
+    timer->due_.store(tick, std::memory_order_release);
+  }
+
+  void unlink(Timer *timer)
+  {
+    if (timer->prev_ != 0)
+      timer->prev_->next_ = timer->next_;
+    else
+      slots_[timer->due_.load(std::memory_order_relaxed) & MASK] =
+	timer->next_;
+    if (timer->next_ != 0)
+      timer->next_->prev_ = timer->prev_;
+  }
+
+  ACE_LOCK lock_;
+
+  const ACE_Time_Value tick_;
+  const ACE_UINT64 tick_msec_;
+  ACE_Time_Value start_;
+
+  /// Ticks elapsed since open(); written under lock_.
+  std::atomic<ACE_UINT64> current_;
+
+  Timer *slots_[SLOTS];
+
+  size_t armed_;
+  size_t expired_;
+
+  // = Disallow copying.
+  Timeout_Wheel(const Timeout_Wheel &);
+  Timeout_Wheel &operator=(const Timeout_Wheel &);
+};
+
+#endif /* TIMEOUT_WHEEL_H */